@@ -0,0 +1,234 @@
+#include "Benchmark.h"
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <pthread.h>
+#include <unistd.h>
+#include "Server.h"
+#include "ServerConfig.h"
+#include "../common/Message.h"
+
+const uint64_t Benchmark::STALL_TIMEOUT_MICROS;
+
+Benchmark::Benchmark(const BenchOptions& options)
+    : options(options), random(options.seed), serverClock(CLOCK_THREAD_CPUTIME_ID) {}
+
+uint64_t Benchmark::monotonicMicros() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+uint64_t Benchmark::cpuMicros(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000 + static_cast<uint64_t>(ts.tv_nsec) / 1000;
+}
+
+size_t Benchmark::residentBytes() {
+    long pages = 0, resident = 0;
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if (statm != nullptr) {
+        if (fscanf(statm, "%ld %ld", &pages, &resident) != 2) {
+            resident = 0;
+        }
+        fclose(statm);
+    }
+    return static_cast<size_t>(resident) * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+}
+
+// A plain LCG, the traffic only has to be the same for the same seed
+uint32_t Benchmark::nextRandom() {
+    random = random * 1664525u + 1013904223u;
+    return random >> 8;
+}
+
+bool Benchmark::run() {
+    // Only the server's own work counts: no rate limits, timers or presence digests
+    // that would fire during the run
+    ServerConfig config;
+    config.clientMessagesPerSecond = config.clientBytesPerSecond = 0;
+    config.roomMessagesPerSecond = config.roomBytesPerSecond = 0;
+    config.heartbeatIntervalSeconds = 3600;
+    config.loginTimeoutSeconds = 3600;
+    config.presenceWindowMillis = 3600 * 1000;
+    config.fanoutThreads = options.fanoutThreads;
+    config.historyLimit = 100;
+
+    // The server logs every connection, which would be most of what it does here
+    std::cout.setstate(std::ios::badbit);
+    Server server("loopback", 0, config, &transport);
+    if (!server.init()) {
+        std::cout.clear();
+        std::cerr << "The server failed to start." << std::endl;
+        return false;
+    }
+
+    std::atomic<bool> finished(false);
+    std::thread serverThread([&server, &finished]() {
+        server.run();
+        finished = true;
+    });
+    pthread_getcpuclockid(serverThread.native_handle(), &serverClock);
+
+    // Every session logs in and joins one room, the first session of each room creates it
+    std::vector<int> memberCount(options.rooms, 0);
+    connections.reserve(static_cast<size_t>(options.sessions));
+    residentBeforeSessions = residentBytes();
+    beginPhase(sessionPhase);
+    for (int i = 0; i < options.sessions; i++) {
+        int connection = transport.connect();
+        connections.push_back(connection);
+        std::string frame;
+        Message(MessageType::LOGIN, "user" + std::to_string(i)).serializeTo(frame);
+        write(connection, frame);
+        int room = i % options.rooms;
+        std::string name = "bench" + std::to_string(room);
+        if (memberCount[room]++ == 0) {
+            Message(MessageType::CREATE, name + ";").serializeTo(frame);
+        } else {
+            Message(MessageType::JOIN, name).serializeTo(frame);
+        }
+        write(connection, frame);
+    }
+    bool ok = waitFor(joined, static_cast<uint64_t>(options.sessions));
+    sessionPhase.operations = joined;
+    endPhase(sessionPhase);
+    residentAfterSessions = residentBytes();
+
+    // Posts from sessions picked at random, every member of the room receives them
+    std::string text(static_cast<size_t>(options.postBytes), 'x');
+    std::string frame;
+    beginPhase(postPhase);
+    for (int i = 0; ok && i < options.posts; i++) {
+        int session = static_cast<int>(nextRandom() % static_cast<uint32_t>(options.sessions));
+        expectedDeliveries += static_cast<uint64_t>(memberCount[session % options.rooms]);
+        Message::serializeTo(MessageType::POST, text.data(), text.length(), frame);
+        write(connections[session], frame);
+    }
+    ok = ok && waitFor(deliveries, expectedDeliveries);
+    postPhase.operations = static_cast<uint64_t>(options.posts);
+    endPhase(postPhase);
+
+    // The server closes its connections on the way out, which needs room in the queue
+    server.stop();
+    transport.flush();
+    while (!finished) {
+        drain();
+        std::this_thread::yield();
+    }
+    serverThread.join();
+    std::cout.clear();
+    return ok;
+}
+
+void Benchmark::write(int connection, const std::string& frame) {
+    while (!transport.write(connection, frame)) {
+        transport.flush();
+        unflushed = 0;
+        drain();
+        std::this_thread::yield();
+    }
+    if (++unflushed == WRITE_BATCH) {
+        transport.flush();
+        unflushed = 0;
+        drain();
+    }
+}
+
+// Reads what the server sent and counts the answers that matter
+void Benchmark::drain() {
+    LoopbackChunk chunk;
+    while (transport.read(chunk)) {
+        if (chunk.kind != LoopbackChunk::DATA) {
+            continue;
+        }
+        bytesReceived += chunk.data.length();
+        // Most chunks hold whole frames, only a partial one is kept until the rest arrives
+        auto pending = inbound.find(chunk.connection);
+        if (pending != inbound.end()) {
+            pending->second.append(chunk.data);
+            chunk.data.swap(pending->second);
+            inbound.erase(pending);
+        }
+        size_t offset = 0;
+        const char* payload;
+        size_t payloadLength;
+        while (Message::findFrame(chunk.data.data() + offset, chunk.data.length() - offset, payload, payloadLength) ==
+               FrameStatus::Complete) {
+            MessageView view = Message::parse(payload, payloadLength);
+            if (view.type == MessageType::CHAT) {
+                deliveries++;
+            } else if (view.type == MessageType::JOIN) {
+                joined++;
+            }
+            offset += Message::FRAME_HEADER_SIZE + payloadLength;
+        }
+        if (offset < chunk.data.length()) {
+            inbound[chunk.connection].assign(chunk.data, offset, std::string::npos);
+        }
+    }
+}
+
+bool Benchmark::waitFor(const uint64_t& counter, uint64_t target) {
+    transport.flush();
+    unflushed = 0;
+    uint64_t lastProgressMicros = monotonicMicros();
+    uint64_t lastValue = counter;
+    while (counter < target) {
+        drain();
+        if (counter != lastValue) {
+            lastValue = counter;
+            lastProgressMicros = monotonicMicros();
+        } else if (monotonicMicros() - lastProgressMicros > STALL_TIMEOUT_MICROS) {
+            std::cerr << "The server stalled at " << counter << " of " << target << "." << std::endl;
+            return false;
+        } else {
+            std::this_thread::yield();
+        }
+    }
+    return true;
+}
+
+void Benchmark::beginPhase(BenchPhase& phase) {
+    phase.wallMicros = monotonicMicros();
+    phase.serverCpuMicros = cpuMicros(serverClock);
+    phase.processCpuMicros = cpuMicros(CLOCK_PROCESS_CPUTIME_ID) - cpuMicros(CLOCK_THREAD_CPUTIME_ID);
+}
+
+void Benchmark::endPhase(BenchPhase& phase) {
+    phase.wallMicros = monotonicMicros() - phase.wallMicros;
+    phase.serverCpuMicros = cpuMicros(serverClock) - phase.serverCpuMicros;
+    phase.processCpuMicros = cpuMicros(CLOCK_PROCESS_CPUTIME_ID) - cpuMicros(CLOCK_THREAD_CPUTIME_ID) -
+                             phase.processCpuMicros;
+}
+
+static double perSecond(uint64_t count, uint64_t micros) {
+    return micros == 0 ? 0 : static_cast<double>(count) * 1000000.0 / static_cast<double>(micros);
+}
+
+static double microsEach(uint64_t micros, uint64_t count) {
+    return count == 0 ? 0 : static_cast<double>(micros) / static_cast<double>(count);
+}
+
+void Benchmark::printReport() const {
+    std::cout << options.sessions << " sessions in " << options.rooms << " rooms, " << options.posts << " posts of "
+              << options.postBytes << " bytes, seed " << options.seed << std::endl;
+    std::cout << "Sessions: " << sessionPhase.operations << " logged in and joined in "
+              << sessionPhase.wallMicros / 1000.0 << " ms, " << perSecond(sessionPhase.operations, sessionPhase.wallMicros)
+              << "/s, event loop CPU " << microsEach(sessionPhase.serverCpuMicros, sessionPhase.operations)
+              << " us each" << std::endl;
+    std::cout << "Posts: " << postPhase.operations << " in " << postPhase.wallMicros / 1000.0 << " ms, "
+              << perSecond(postPhase.operations, postPhase.wallMicros) << "/s, event loop CPU "
+              << microsEach(postPhase.serverCpuMicros, postPhase.operations) << " us each" << std::endl;
+    std::cout << "Deliveries: " << deliveries << " of " << expectedDeliveries << ", "
+              << perSecond(deliveries, postPhase.wallMicros) << "/s, server CPU (all threads) "
+              << microsEach(postPhase.processCpuMicros, deliveries) * 1000.0 << " ns each" << std::endl;
+    std::cout << "Bytes received by the sessions: " << bytesReceived << std::endl;
+    if (sessionPhase.operations > 0 && residentAfterSessions > residentBeforeSessions) {
+        // The idle sessions after they joined, the driver's and the transport's share included
+        std::cout << "Resident memory per idle session: "
+                  << (residentAfterSessions - residentBeforeSessions) / sessionPhase.operations << " bytes" << std::endl;
+    }
+}
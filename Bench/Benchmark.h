@@ -0,0 +1,73 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <ctime>
+#include "Transport/LoopbackTransport.h"
+
+struct BenchOptions {
+    int sessions = 10000;
+    int rooms = 100;
+    int posts = 100000;
+    int postBytes = 64;
+    int fanoutThreads = 0; // Threads of the server that help with big rooms
+    uint32_t seed = 1;
+};
+
+// Time and server CPU one phase of the benchmark took.
+struct BenchPhase {
+    uint64_t operations = 0;
+    uint64_t wallMicros = 0;
+    uint64_t serverCpuMicros = 0; // The event loop thread
+    uint64_t processCpuMicros = 0; // The server threads together, the driver excluded
+};
+
+// Runs a server in this process on a loopback transport and drives simulated sessions
+// through it: they log in, join their rooms and post. Nothing touches the network, so
+// the numbers are the CPU cost of the server's own protocol and room logic, and a
+// given seed sends the same traffic every time.
+class Benchmark {
+public:
+    explicit Benchmark(const BenchOptions& options);
+
+    bool run();
+    void printReport() const;
+
+private:
+    // Give up waiting for the server when it makes no progress for this long
+    static const uint64_t STALL_TIMEOUT_MICROS = 10000000;
+
+    // Frames written before the server is woken up
+    static const int WRITE_BATCH = 256;
+
+    BenchOptions options;
+    LoopbackTransport transport;
+    std::vector<int> connections;
+    std::unordered_map<int, std::string> inbound; // Partial frames received, by connection
+    uint64_t joined = 0;
+    uint64_t deliveries = 0;
+    uint64_t expectedDeliveries = 0;
+    uint64_t bytesReceived = 0;
+    size_t residentBeforeSessions = 0;
+    size_t residentAfterSessions = 0;
+    int unflushed = 0;
+    uint32_t random;
+    clockid_t serverClock;
+    BenchPhase sessionPhase;
+    BenchPhase postPhase;
+
+    void write(int connection, const std::string& frame);
+    void drain();
+    bool waitFor(const uint64_t& counter, uint64_t target);
+    uint32_t nextRandom();
+    void beginPhase(BenchPhase& phase);
+    void endPhase(BenchPhase& phase);
+    static uint64_t monotonicMicros();
+    static uint64_t cpuMicros(clockid_t clock);
+    static size_t residentBytes();
+};
+
+#endif // BENCHMARK_H
@@ -0,0 +1,59 @@
+#include <iostream>
+#include <string>
+#include <cstdlib>
+#include "Benchmark.h"
+
+using namespace std;
+
+static void printUsage(const char* program) {
+    cerr << "Usage: " << program << " [options]" << endl;
+    cerr << "Runs a server in this process over an in-memory transport and reports what" << endl;
+    cerr << "sessions, posts and their deliveries cost it, without any network stack." << endl;
+    cerr << "Options:" << endl;
+    cerr << "  --sessions <count>        simulated sessions (default 10000)" << endl;
+    cerr << "  --rooms <count>           chatrooms they are spread over (default 100)" << endl;
+    cerr << "  --posts <count>           posts sent by randomly picked sessions (default 100000)" << endl;
+    cerr << "  --post-bytes <bytes>      text length of each post (default 64)" << endl;
+    cerr << "  --fanout-threads <count>  threads helping the server with big rooms (default 0)" << endl;
+    cerr << "  --seed <n>                picks the posting sessions, same seed same traffic (default 1)" << endl;
+}
+
+int main(int argc, char* argv[]) {
+    if ((argc - 1) % 2 != 0) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    BenchOptions options;
+    for (int i = 1; i < argc; i += 2) {
+        string option = argv[i];
+        int value = atoi(argv[i + 1]);
+        if (option == "--sessions") {
+            options.sessions = value;
+        } else if (option == "--rooms") {
+            options.rooms = value;
+        } else if (option == "--posts") {
+            options.posts = value;
+        } else if (option == "--post-bytes") {
+            options.postBytes = value;
+        } else if (option == "--fanout-threads") {
+            options.fanoutThreads = value;
+        } else if (option == "--seed") {
+            options.seed = static_cast<uint32_t>(strtoul(argv[i + 1], nullptr, 10));
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (options.sessions <= 0 || options.rooms <= 0 || options.rooms > options.sessions || options.postBytes < 0) {
+        cerr << "Sessions and rooms must be positive, with at least one session per room." << endl;
+        return 1;
+    }
+
+    Benchmark benchmark(options);
+    if (!benchmark.run()) {
+        return 1;
+    }
+    benchmark.printReport();
+    return 0;
+}
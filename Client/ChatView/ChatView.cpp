@@ -0,0 +1,164 @@
+#include "ChatView.h"
+#include <algorithm>
+#include <chrono>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+
+// Terminal control sequence: cursor home, then erase the screen
+static const char CLEAR_SCREEN[] = "\033[H\033[2J";
+
+const size_t ChatView::DEFAULT_CAPACITY;
+const int ChatView::FRAME_INTERVAL_MILLIS;
+
+ChatView::ChatView(size_t capacity) : capacity(capacity) {}
+
+ChatView::~ChatView() {
+    stop();
+}
+
+void ChatView::start() {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (running) {
+        return;
+    }
+    running = true;
+    renderer = std::thread(&ChatView::renderLoop, this);
+}
+
+void ChatView::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        running = false;
+    }
+    cv.notify_one();
+    if (renderer.joinable()) {
+        renderer.join();
+    }
+    render();
+}
+
+void ChatView::append(const std::string& text) {
+    std::lock_guard<std::mutex> lock(mtx);
+    size_t start = 0;
+    while (true) {
+        size_t end = text.find('\n', start);
+        lines.push_back(text.substr(start, end == std::string::npos ? std::string::npos : end - start));
+        if (lines.size() > capacity) {
+            lines.pop_front();
+        }
+        pendingLines++;
+        if (scrollOffset > 0) {
+            // Keep the page that is being read where it is
+            scrollOffset = std::min(scrollOffset + 1, lines.size() - 1);
+        }
+        if (end == std::string::npos) {
+            break;
+        }
+        start = end + 1;
+    }
+}
+
+void ChatView::clear() {
+    std::lock_guard<std::mutex> lock(mtx);
+    lines.clear();
+    pendingLines = 0;
+    scrollOffset = 0;
+    redrawAll = true;
+}
+
+void ChatView::pageUp() {
+    size_t page = screenRows() - 2;
+    std::lock_guard<std::mutex> lock(mtx);
+    size_t oldest = lines.size() > page ? lines.size() - page : 0;
+    scrollOffset = std::min(scrollOffset + page, oldest);
+    redrawAll = true;
+}
+
+void ChatView::pageDown() {
+    size_t page = screenRows() - 2;
+    std::lock_guard<std::mutex> lock(mtx);
+    scrollOffset -= std::min(scrollOffset, page);
+    redrawAll = true;
+}
+
+void ChatView::scrollToEnd() {
+    std::lock_guard<std::mutex> lock(mtx);
+    scrollOffset = 0;
+    redrawAll = true;
+}
+
+void ChatView::renderLoop() {
+    std::unique_lock<std::mutex> lock(mtx);
+    while (running) {
+        cv.wait_for(lock, std::chrono::milliseconds(FRAME_INTERVAL_MILLIS), [this] { return !running; });
+        lock.unlock();
+        render();
+        lock.lock();
+    }
+}
+
+void ChatView::render() {
+    size_t rows = screenRows();
+    std::string output;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (!redrawAll && pendingLines == 0) {
+            return;
+        }
+        buildFrame(rows);
+        pendingLines = 0;
+        redrawAll = false;
+        output.swap(frame);
+    }
+
+    // The terminal is written without holding the lock, appends never wait for it
+    size_t written = 0;
+    while (written < output.length()) {
+        ssize_t result = write(STDOUT_FILENO, output.data() + written, output.length() - written);
+        if (result == -1 && errno == EINTR) {
+            continue;
+        }
+        if (result <= 0) {
+            break;
+        }
+        written += static_cast<size_t>(result);
+    }
+}
+
+void ChatView::buildFrame(size_t rows) {
+    // The bottom row belongs to the input line
+    size_t page = rows - 1;
+    frame.clear();
+    if (scrollOffset == 0) {
+        if (!redrawAll && pendingLines < page) {
+            // Let the terminal scroll the new lines in
+            appendPage(lines.size(), pendingLines);
+        } else {
+            // Lines that would scroll past before anyone could read them aren't drawn
+            frame += CLEAR_SCREEN;
+            appendPage(lines.size(), page);
+        }
+        return;
+    }
+
+    frame += CLEAR_SCREEN;
+    appendPage(lines.size() - scrollOffset, page - 1);
+    frame += "-- " + std::to_string(scrollOffset) + " newer lines, /down to page, /end to return --\n";
+}
+
+void ChatView::appendPage(size_t end, size_t count) {
+    count = std::min(count, end);
+    for (size_t i = end - count; i < end; i++) {
+        frame += lines[i];
+        frame += '\n';
+    }
+}
+
+size_t ChatView::screenRows() {
+    struct winsize size;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_row > 3) {
+        return size.ws_row;
+    }
+    return 24;
+}
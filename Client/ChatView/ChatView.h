@@ -0,0 +1,56 @@
+#ifndef CHATVIEW_H
+#define CHATVIEW_H
+
+#include <string>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <cstddef>
+
+// What the client shows of its chatroom. The receiving thread only appends lines to
+// a bounded scrollback; a render thread puts them on the terminal at most once per
+// frame with a single write(). When more lines arrive in a frame than fit on the
+// screen only the last screenful is drawn, so a busy room never waits on the terminal.
+// The scrollback can be paged through without asking the server.
+class ChatView {
+public:
+    explicit ChatView(size_t capacity = DEFAULT_CAPACITY);
+    ~ChatView();
+
+    void start();
+    void stop(); // Draws what is pending and ends the render thread
+
+    // Adds 'text', one line per '\n'
+    void append(const std::string& text);
+
+    // Empties the scrollback and the screen
+    void clear();
+
+    void pageUp();
+    void pageDown();
+    void scrollToEnd();
+
+private:
+    static const size_t DEFAULT_CAPACITY = 10000;
+    static const int FRAME_INTERVAL_MILLIS = 33; // About 30 frames per second
+
+    std::deque<std::string> lines;
+    size_t capacity;
+    size_t pendingLines = 0;  // Appended since the last frame
+    size_t scrollOffset = 0;  // Lines between the bottom of the page and the newest line, 0 = live
+    bool redrawAll = false;
+    bool running = false;
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::thread renderer;
+    std::string frame;
+
+    void renderLoop();
+    void render();
+    void buildFrame(size_t rows);
+    void appendPage(size_t end, size_t count);
+    static size_t screenRows();
+};
+
+#endif // CHATVIEW_H
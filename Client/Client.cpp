@@ -5,9 +5,11 @@
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <thread>
+#include <chrono>
 #include "../common/Message.h"
 #include <atomic>
 #include <termios.h>
+#include <algorithm>
 
 // Terminal control sequences
 const std::string MOVE_CURSOR_UP = "\033[A";
@@ -57,27 +59,74 @@ void Client::startReceivingMessages() {
             Message response = receiveMessage();
 
             // Process the received message based on its type
+            std::string text;
             switch (response.getType()) {
-                case MessageType::JOIN:
-                    system("clear");
+                case MessageType::JOIN: {
+                    // "room;next sequence;history", the room becomes the one the client posts to
+                    std::string room;
+                    uint64_t sequence;
+                    if (Message::splitChat(response.getBody(), room, sequence, text)) {
+                        std::lock_guard<std::mutex> lock(roomsMtx);
+                        activeRoom = room;
+                        nextSequences[room] = sequence;
+                    }
+                    view.clear();
                     state = ClientState::InChatroom;
-                    std::cout << response.getBody() << std::endl;
+                    view.append(text);
                     notifyReadyToSend();
                     break;
+                }
+                case MessageType::CHAT: {
+                    std::string room;
+                    uint64_t sequence;
+                    if (Message::splitChat(response.getBody(), room, sequence, text)) {
+                        std::lock_guard<std::mutex> lock(roomsMtx);
+                        nextSequences[room] = sequence + 1;
+                        // Messages of the other joined chatrooms are tagged with their room
+                        view.append(room == activeRoom ? text : "[#" + room + "] " + text);
+                    }
+                    notifyReadyToSend();
+                    break;
+                }
+                case MessageType::RESUME:
+                    resumeToken = response.getBody();
+                    break;
                 case MessageType::MENU:
-                    system("clear");
+                    {
+                        std::lock_guard<std::mutex> lock(roomsMtx);
+                        activeRoom.clear();
+                    }
+                    view.clear();
                     state = ClientState::SelectingChatroom;
-                    std::cout << response.getBody() << std::endl;
+                    view.append(response.getBody());
                     notifyReadyToSend();
                     break;
                 case MessageType::QUIT:
+                    if (connectionLost && state != ClientState::Quitting && resumeSession()) {
+                        break; // Carry on with the same session over a new connection
+                    }
                     state = ClientState::Quitting;
+                    view.stop();
                     std::cerr << response.getBody() << std::endl;
+                    notifyReadyToSend(); // Wake the main thread so it can clean up
                     return; // Exiting the thread
                 case MessageType::POST:
-                    std::cout << response.getBody() << std::endl;
+                    view.append(response.getBody());
+                    notifyReadyToSend();
+                    break;
+                case MessageType::PRESENCE:
+                    view.append(response.getBody());
+                    break;
+                case MessageType::PING:
+                    sendMessage(Message(MessageType::PONG, ""));
+                    break;
+                case MessageType::DOWNLOAD:
+                    startDownload(response.getBody());
                     notifyReadyToSend();
                     break;
+                case MessageType::CHUNK:
+                    receiveChunk(response.getBody());
+                    break;
                 default:
                     std::cerr << "Unknown message type received." << std::endl;
                     break;
@@ -95,19 +144,26 @@ void Client::startChatSession() {
         return; // Exit the function if the connection fails
     }
 
-    // Start a separate thread to receive messages from the server
+    // Start a separate thread to receive messages from the server, and one to draw them
+    view.start();
     startReceivingMessages();
 
     if (state == ClientState::PreLogin) {
-        handleServerResponse(); // Handle initial setup like username
-        state = ClientState::SelectingChatroom;
+        waitForMessageReady(); // Wait for the welcome message
+        setNotReadyToSend();
+        handleLogin(); // Handle initial setup like username
     }
     
      // Continue running as long as the client is not in the "Quitting" state
     while (state != ClientState::Quitting) {
         waitForMessageReady();
+        setNotReadyToSend(); // Before handling the input, so a local command can wake the loop again
 
         switch (state) {
+            case ClientState::PreLogin:
+                // Still waiting for the server to accept the username
+                break;
+
             case ClientState::SelectingChatroom:
                 handleSelectingChatroom();
                 break;
@@ -121,14 +177,13 @@ void Client::startChatSession() {
                 return;
 
         }
-        setNotReadyToSend();
     }
 }
 
 
 void Client::handleQuitting() {
     // Close the socket and perform any necessary cleanup
-    
+    view.stop();
     if (clientSocket != -1) {
         close(clientSocket);
         clientSocket = -1;
@@ -149,12 +204,40 @@ void Client::handleSelectingChatroom() {
         system("clear");
         sendMessage(Message(MessageType::QUIT, ""));
         state = ClientState::Quitting;
-    } else {
+    } else if (!handleRoomCommand(message)) {
         sendMessage(Message(MessageType::JOIN, message));
     }
 }
 
 
+// The commands for the chatrooms the client is subscribed to, available at the menu and in a chatroom
+bool Client::handleRoomCommand(const std::string& message) {
+    if (message.rfind("/join ", 0) == 0) {
+        sendMessage(Message(MessageType::JOIN, message.substr(6)));
+    } else if (message.rfind("/part ", 0) == 0) {
+        std::string room = message.substr(6);
+        {
+            std::lock_guard<std::mutex> lock(roomsMtx);
+            nextSequences.erase(room);
+        }
+        sendMessage(Message(MessageType::PART, room));
+    } else if (message == "/rooms") {
+        std::string rooms = "Your chatrooms:";
+        {
+            std::lock_guard<std::mutex> lock(roomsMtx);
+            for (const auto& entry : nextSequences) {
+                rooms += "\n  " + entry.first + (entry.first == activeRoom ? " (posting here)" : "");
+            }
+        }
+        view.append(rooms);
+        notifyReadyToSend(); // Nothing to wait for
+    } else {
+        return false;
+    }
+    return true;
+}
+
+
 // Function to read input line with echo, then clear the line after sending
 std::string Client::getInputAndClearLine() {
     std::string input;
@@ -169,7 +252,31 @@ std::string Client::getInputAndClearLine() {
 void Client::handleInChatroom() {
     std::string message = getInputAndClearLine();
     if (message == "/leave") {
+        {
+            std::lock_guard<std::mutex> lock(roomsMtx);
+            nextSequences.erase(activeRoom);
+        }
         sendMessage(Message(MessageType::MENU, ""));
+    } else if (handleRoomCommand(message)) {
+        // Handled
+    } else if (message == "/presence on" || message == "/presence off") {
+        sendMessage(Message(MessageType::PRESENCE, message.substr(10)));
+    } else if (message.rfind("/search ", 0) == 0) {
+        sendMessage(Message(MessageType::SEARCH, message.substr(8)));
+    } else if (message.rfind("/attach ", 0) == 0) {
+        sendAttachment(message.substr(8));
+    } else if (message.rfind("/download ", 0) == 0) {
+        sendMessage(Message(MessageType::DOWNLOAD, message.substr(10)));
+    } else if (message == "/up" || message == "/down" || message == "/end") {
+        // Paging happens locally, nothing to wait for
+        if (message == "/up") {
+            view.pageUp();
+        } else if (message == "/down") {
+            view.pageDown();
+        } else {
+            view.scrollToEnd();
+        }
+        notifyReadyToSend();
     } else if (message == "/quit") {
         system("clear");
         sendMessage(Message(MessageType::QUIT, ""));
@@ -201,36 +308,132 @@ void Client::setNotReadyToSend() {
 
 void Client::sendMessage(const Message& message) {
     std::string serializedMessage = message.serialize();
-    send(clientSocket, serializedMessage.c_str(), serializedMessage.length(), 0);
+    std::lock_guard<std::mutex> lock(sendMtx);
+    send(clientSocket, serializedMessage.c_str(), serializedMessage.length(), MSG_NOSIGNAL);
 }
 
 
 Message Client::receiveMessage() {
-    char buffer[1024] = {0};
-    int bytesReceived = recv(clientSocket, buffer, sizeof(buffer), 0);
+    while (true) {
+        const char* payload;
+        size_t payloadLength;
+        FrameStatus status = Message::findFrame(receiveBuffer.data() + receiveOffset, receiveBuffer.length() - receiveOffset,
+                                                payload, payloadLength);
+        if (status == FrameStatus::Complete) {
+            // The frame is only skipped, a burst of them is dropped from the buffer at once below
+            receiveOffset += Message::FRAME_HEADER_SIZE + payloadLength;
+            return Message(Message::parse(payload, payloadLength));
+        }
+        if (status == FrameStatus::Invalid) {
+            return Message(MessageType::QUIT, "Received an invalid message from the server");
+        }
 
-    if (bytesReceived <= 0) {
-        return Message(MessageType::QUIT, "Connection error or server closed the connection");
+        receiveBuffer.erase(0, receiveOffset);
+        receiveOffset = 0;
+        size_t received = receiveBuffer.length();
+        receiveBuffer.resize(received + RECEIVE_CHUNK_SIZE);
+        ssize_t bytesReceived = recv(clientSocket, &receiveBuffer[received], RECEIVE_CHUNK_SIZE, 0);
+        receiveBuffer.resize(received + (bytesReceived > 0 ? static_cast<size_t>(bytesReceived) : 0));
+        if (bytesReceived <= 0) {
+            connectionLost = true;
+            return Message(MessageType::QUIT, "Connection error or server closed the connection");
+        }
     }
-    
-    std::string receivedData(buffer, bytesReceived);
-    Message deserializedMessage = Message::deserialize(receivedData);
-    return deserializedMessage;
 }
 
 
-void Client::handleServerResponse() {
-    // Getting username from the user
+// Announces the file with an ATTACH, then streams it as CHUNKs.
+void Client::sendAttachment(const std::string& path) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) {
+        view.append("Can't open " + path);
+        notifyReadyToSend();
+        return;
+    }
+    uint64_t size = static_cast<uint64_t>(file.tellg());
+    file.seekg(0);
+    std::string name = path.substr(path.rfind('/') + 1);
+    sendMessage(Message(MessageType::ATTACH, name + ";" + std::to_string(size)));
+
+    std::string chunk(UPLOAD_CHUNK_SIZE, '\0');
+    while (file.read(&chunk[0], chunk.size()) || file.gcount() > 0) {
+        sendMessage(Message(MessageType::CHUNK, chunk.substr(0, static_cast<size_t>(file.gcount()))));
+    }
+}
+
+
+// DOWNLOAD header "id;name;size", the content follows as CHUNKs.
+void Client::startDownload(const std::string& body) {
+    size_t first = body.find(';');
+    size_t last = body.rfind(';');
+    if (first == std::string::npos || first == last) {
+        return;
+    }
+    std::string name = body.substr(first + 1, last - first - 1);
+    downloadPath = "download-" + body.substr(0, first) + "-" + name.substr(name.rfind('/') + 1);
+    downloadRemaining = std::stoull(body.substr(last + 1));
+    downloadFile.close(); // An interrupted download is left as it was
+    downloadFile.open(downloadPath, std::ios::binary | std::ios::trunc);
+    view.append("Downloading " + name + " (" + std::to_string(downloadRemaining) + " bytes)...");
+}
+
+
+void Client::receiveChunk(const std::string& data) {
+    if (!downloadFile.is_open()) {
+        return;
+    }
+    downloadFile.write(data.data(), static_cast<std::streamsize>(data.size()));
+    downloadRemaining -= std::min(downloadRemaining, static_cast<uint64_t>(data.size()));
+    if (downloadRemaining == 0) {
+        downloadFile.close();
+        view.append("Saved to " + downloadPath);
+    }
+}
+
+
+bool Client::resumeSession() {
+    if (resumeToken.empty()) {
+        return false; // Never logged in, there is nothing to resume
+    }
+    for (int attempt = 1; attempt <= RESUME_ATTEMPTS; attempt++) {
+        std::cerr << "Connection lost, reconnecting (attempt " << attempt << ")..." << std::endl;
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        {
+            // The main thread must not send on the socket while it is replaced
+            std::lock_guard<std::mutex> lock(sendMtx);
+            close(clientSocket);
+            receiveBuffer.clear();
+            receiveOffset = 0;
+            connectionLost = false;
+            if (!connectToServer()) {
+                continue;
+            }
+        }
+
+        // Skip the welcome message and present the token instead of a username
+        receiveMessage();
+        if (connectionLost) {
+            continue;
+        }
+        // The token, then every joined chatroom with the sequence to continue it from
+        std::string body = resumeToken;
+        {
+            std::lock_guard<std::mutex> lock(roomsMtx);
+            for (const auto& entry : nextSequences) {
+                body += ";" + entry.first + ";" + std::to_string(entry.second);
+            }
+        }
+        sendMessage(Message(MessageType::RESUME, body));
+        return true;
+    }
+    return false;
+}
+
+
+void Client::handleLogin() {
+    // Getting username from the user, the receiving thread handles the server's answer
+    // (the chatroom menu, or a QUIT if the username was rejected)
     std::string username;
     std::getline(std::cin, username);
     sendMessage(Message(MessageType::LOGIN, username)); // Sending username to the server
-    
-    Message serverResponse = receiveMessage();
-    if (serverResponse.getType() == MessageType::QUIT) {
-        std::cerr << serverResponse.getBody() << std::endl;
-        handleQuitting();
-    } else {
-        system("clear");
-        std::cout << serverResponse.getBody(); // Displaying chatroom options or other messages
-    }
 }
@@ -2,9 +2,14 @@
 #define CLIENT_H
 
 #include <string>
+#include <cstdint>
 #include "../common/Message.h"
+#include "ChatView/ChatView.h"
 #include <atomic>
 #include <condition_variable>
+#include <fstream>
+#include <map>
+#include <mutex>
 
 
 
@@ -37,10 +42,30 @@ private:
     void notifyReadyToSend();
     void waitForMessageReady();
     void setNotReadyToSend();
-    void handleServerResponse();
+    void handleLogin();
+    bool resumeSession();
+    void sendAttachment(const std::string& path);
+    void startDownload(const std::string& body);
+    void receiveChunk(const std::string& data);
     void displayChatInterface();
+    bool handleRoomCommand(const std::string& message);
     std::atomic<ClientState> state;
     std::mutex mtx;
+    std::mutex sendMtx; // The receiving thread answers PINGs while the main thread sends chat messages
+    std::string receiveBuffer; // Received bytes, frames before receiveOffset were already returned
+    size_t receiveOffset = 0;
+    static const size_t RECEIVE_CHUNK_SIZE = 64 * 1024;
+    ChatView view;             // Messages received, drawn in batches by its own thread
+    bool connectionLost = false;
+    std::string resumeToken;   // Lets the client pick up its session after the connection dropped
+    std::mutex roomsMtx;       // Guards the two below, the main thread drops rooms on /leave and /part
+    std::string activeRoom;    // The chatroom the client posts to, empty at the menu
+    std::map<std::string, uint64_t> nextSequences; // Per joined chatroom, sequence of the next message expected
+    static const int RESUME_ATTEMPTS = 5;
+    static const size_t UPLOAD_CHUNK_SIZE = 64 * 1024;
+    std::ofstream downloadFile;  // Attachment being downloaded, written by the receiving thread
+    std::string downloadPath;
+    uint64_t downloadRemaining = 0;
     std::condition_variable cv;
     bool readyToSend = false;
     std::string getInputAndClearLine();
@@ -0,0 +1,353 @@
+#include "Replayer.h"
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/tcp.h>
+
+const uint64_t Replayer::DRAIN_TIMEOUT_MICROS;
+
+Replayer::Replayer(const std::string& serverIP, int serverPort, bool fast)
+    : serverIP(serverIP), serverPort(serverPort), fast(fast), epoll_fd(-1), startMicros(0), elapsedMicros(0) {}
+
+Replayer::~Replayer() {
+    for (auto& pair : connections) {
+        close(pair.second.fd);
+    }
+    if (epoll_fd != -1) {
+        close(epoll_fd);
+    }
+}
+
+uint64_t Replayer::monotonicMicros() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+bool Replayer::run(const std::string& tracePath) {
+    TraceReader reader;
+    if (!reader.open(tracePath)) {
+        std::cerr << "Can't read the trace " << tracePath << std::endl;
+        return false;
+    }
+    epoll_fd = epoll_create1(0);
+    if (epoll_fd == -1) {
+        std::cerr << "Error creating epoll: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    TraceRecord record;
+    bool more = reader.next(record);
+    startMicros = monotonicMicros();
+    uint64_t lastTrafficMicros = 0;
+    const int MAX_EVENTS = 64;
+    struct epoll_event events[MAX_EVENTS];
+
+    while (true) {
+        elapsedMicros = monotonicMicros() - startMicros;
+
+        // Play every record that is due
+        int played = 0;
+        while (more && (fast ? played < FAST_BATCH : record.timeMicros <= elapsedMicros)) {
+            play(record);
+            more = reader.next(record);
+            played++;
+            lastTrafficMicros = elapsedMicros;
+        }
+
+        int timeout;
+        if (more) {
+            timeout = fast ? 0 : static_cast<int>((record.timeMicros - std::min(record.timeMicros, elapsedMicros)) / 1000);
+        } else if (awaitingAnswers() && elapsedMicros - lastTrafficMicros < DRAIN_TIMEOUT_MICROS) {
+            timeout = static_cast<int>((DRAIN_TIMEOUT_MICROS - (elapsedMicros - lastTrafficMicros)) / 1000) + 1;
+        } else {
+            break;
+        }
+
+        int num_events = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout);
+        if (num_events == -1 && errno != EINTR) {
+            std::cerr << "Epoll wait error: " << strerror(errno) << std::endl;
+            return false;
+        }
+        for (int i = 0; i < num_events; i++) {
+            handleEvent(events[i].data.fd, events[i].events);
+        }
+        if (num_events > 0) {
+            lastTrafficMicros = monotonicMicros() - startMicros;
+        }
+    }
+    elapsedMicros = monotonicMicros() - startMicros;
+
+    // What is still open didn't get all its answers within the drain timeout
+    while (!connections.empty()) {
+        closeConnection(connections.begin()->first);
+    }
+    return true;
+}
+
+void Replayer::play(const TraceRecord& record) {
+    switch (record.kind) {
+        case TraceRecordKind::CONNECT:
+            openConnection(record.connection);
+            break;
+        case TraceRecordKind::FRAME: {
+            // Connections that were open before the capture started are opened on their first frame
+            auto it = connections.find(record.connection);
+            ReplayConnection* connection = nullptr;
+            if (it != connections.end()) {
+                connection = &it->second;
+            } else if (closedConnections.count(record.connection) == 0) {
+                connection = openConnection(record.connection);
+            }
+            if (connection == nullptr || connection->closing) {
+                break;
+            }
+            MessageView view = Message::parse(record.payload.data(), record.payload.length());
+            if (view.type == MessageType::PONG) {
+                break; // Answered the PINGs of the recorded server, not of this one
+            }
+            uint64_t now = monotonicMicros();
+            if (view.type == MessageType::POST) {
+                connection->pendingPosts.emplace_back(now, std::string(view.body, view.bodyLength));
+            } else if ((view.type == MessageType::LOGIN || view.type == MessageType::JOIN ||
+                        view.type == MessageType::CREATE || view.type == MessageType::MENU) &&
+                       connection->requestSentMicros == 0) {
+                connection->requestSentMicros = now;
+            }
+            sendFrame(*connection, record.payload);
+            break;
+        }
+        case TraceRecordKind::CLOSE: {
+            auto it = connections.find(record.connection);
+            if (it != connections.end()) {
+                it->second.closing = true;
+                closeIfDone(record.connection, it->second);
+            }
+            break;
+        }
+    }
+}
+
+ReplayConnection* Replayer::openConnection(uint32_t id) {
+    closeConnection(id); // In case the trace reuses an id, which the server doesn't do
+    closedConnections.erase(id);
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_in serverAddress;
+    memset(&serverAddress, 0, sizeof(serverAddress));
+    serverAddress.sin_family = AF_INET;
+    serverAddress.sin_port = htons(serverPort);
+    inet_pton(AF_INET, serverIP.c_str(), &serverAddress.sin_addr);
+    if (fd == -1 || connect(fd, (struct sockaddr*)&serverAddress, sizeof(serverAddress)) == -1) {
+        std::cerr << "Error connecting connection " << id << ": " << strerror(errno) << std::endl;
+        if (fd != -1) {
+            close(fd);
+        }
+        stats.connectFailures++;
+        return nullptr;
+    }
+
+    // Non-blocking, so a server that is busy sending to us can't stall what we send it
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    int noDelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+
+    ReplayConnection& connection = connections[id];
+    connection.fd = fd;
+    socketConnections[fd] = id;
+    stats.connections++;
+    return &connection;
+}
+
+void Replayer::closeConnection(uint32_t id) {
+    auto it = connections.find(id);
+    if (it == connections.end()) {
+        return;
+    }
+    stats.postsWithoutEcho += it->second.pendingPosts.size();
+    closedConnections.insert(id);
+    socketConnections.erase(it->second.fd);
+    close(it->second.fd); // Also removes it from epoll
+    connections.erase(it);
+}
+
+// Replayed faster than recorded, a connection can reach its CLOSE before the answers
+// to what it sent arrive. They are waited for, up to the drain timeout.
+void Replayer::closeIfDone(uint32_t id, ReplayConnection& connection) {
+    if (connection.closing && !awaitingAnswers(connection)) {
+        closeConnection(id);
+    }
+}
+
+void Replayer::sendFrame(ReplayConnection& connection, const std::string& payload) {
+    bool idle = connection.outboundOffset == connection.outbound.length();
+    std::string frame;
+    Message::writeFrameHeader(static_cast<uint32_t>(payload.length()), frame);
+    connection.outbound += frame;
+    connection.outbound += payload;
+    stats.framesSent++;
+    stats.bytesSent += frame.length() + payload.length();
+
+    if (idle && !flushOutbound(connection)) {
+        // The rest goes out when the socket is writable again
+        struct epoll_event event;
+        event.events = EPOLLIN | EPOLLOUT;
+        event.data.fd = connection.fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, connection.fd, &event);
+    }
+}
+
+// Sends what it can, returns true once 'outbound' is empty.
+bool Replayer::flushOutbound(ReplayConnection& connection) {
+    while (connection.outboundOffset < connection.outbound.length()) {
+        ssize_t sent = send(connection.fd, connection.outbound.data() + connection.outboundOffset,
+                            connection.outbound.length() - connection.outboundOffset, MSG_NOSIGNAL);
+        if (sent == -1 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return false; // EAGAIN, or an error that reading the socket will report
+        }
+        connection.outboundOffset += static_cast<size_t>(sent);
+    }
+    connection.outbound.clear();
+    connection.outboundOffset = 0;
+    return true;
+}
+
+void Replayer::handleEvent(int fd, uint32_t events) {
+    auto socketIt = socketConnections.find(fd);
+    if (socketIt == socketConnections.end()) {
+        return;
+    }
+    uint32_t id = socketIt->second;
+    ReplayConnection& connection = connections[id];
+
+    if (events & EPOLLOUT) {
+        if (flushOutbound(connection)) {
+            struct epoll_event event;
+            event.events = EPOLLIN;
+            event.data.fd = fd;
+            epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &event);
+        }
+    }
+    if ((events & (EPOLLIN | EPOLLHUP | EPOLLERR)) == 0) {
+        closeIfDone(id, connection);
+        return;
+    }
+
+    char buffer[64 * 1024];
+    ssize_t received = recv(fd, buffer, sizeof(buffer), 0);
+    if (received == -1 && (errno == EAGAIN || errno == EINTR)) {
+        return;
+    }
+    if (received <= 0) {
+        closeConnection(id); // The server closed it, e.g. after a QUIT
+        return;
+    }
+    stats.bytesReceived += static_cast<uint64_t>(received);
+    connection.inbound.append(buffer, static_cast<size_t>(received));
+
+    size_t consumed = 0;
+    const char* payload;
+    size_t payloadLength;
+    while (Message::findFrame(connection.inbound.data() + consumed, connection.inbound.length() - consumed,
+                              payload, payloadLength) == FrameStatus::Complete) {
+        consumed += Message::FRAME_HEADER_SIZE + payloadLength;
+        stats.framesReceived++;
+        processFrame(connection, Message::parse(payload, payloadLength));
+    }
+    connection.inbound.erase(0, consumed);
+    closeIfDone(id, connection);
+}
+
+void Replayer::processFrame(ReplayConnection& connection, const MessageView& view) {
+    uint64_t now = monotonicMicros();
+    switch (view.type) {
+        case MessageType::PING:
+            sendFrame(connection, std::to_string(static_cast<int>(MessageType::PONG)) + ";");
+            break;
+        case MessageType::CHAT: {
+            // "room;sequence;[username]: text", a POST of this connection comes back to it as well.
+            // POSTs before the one that came back were refused.
+            std::string body(view.body, view.bodyLength);
+            for (size_t i = 0; i < connection.pendingPosts.size(); i++) {
+                const std::string& text = connection.pendingPosts[i].second;
+                if (body.length() >= text.length() + 2 &&
+                    body.compare(body.length() - text.length() - 2, std::string::npos, ": " + text) == 0) {
+                    stats.postLatencies.push_back(now - connection.pendingPosts[i].first);
+                    stats.postsWithoutEcho += i;
+                    connection.pendingPosts.erase(connection.pendingPosts.begin(), connection.pendingPosts.begin() + i + 1);
+                    break;
+                }
+            }
+            break;
+        }
+        case MessageType::MENU:
+        case MessageType::JOIN:
+        case MessageType::QUIT:
+            if (connection.requestSentMicros != 0) {
+                stats.requestLatencies.push_back(now - connection.requestSentMicros);
+                connection.requestSentMicros = 0;
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+bool Replayer::awaitingAnswers(const ReplayConnection& connection) {
+    return !connection.pendingPosts.empty() || connection.requestSentMicros != 0 ||
+           connection.outboundOffset < connection.outbound.length();
+}
+
+bool Replayer::awaitingAnswers() const {
+    for (const auto& pair : connections) {
+        if (awaitingAnswers(pair.second)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Replayer::printReport() const {
+    double seconds = static_cast<double>(elapsedMicros) / 1000000.0;
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << "Replayed " << stats.connections << " connections in " << seconds << " s";
+    if (stats.connectFailures > 0) {
+        std::cout << " (" << stats.connectFailures << " failed to connect)";
+    }
+    std::cout << std::endl;
+    std::cout << "Sent " << stats.framesSent << " frames (" << stats.bytesSent << " bytes), "
+              << (seconds > 0 ? static_cast<double>(stats.framesSent) / seconds : 0.0) << " frames/s" << std::endl;
+    std::cout << "Received " << stats.framesReceived << " frames (" << stats.bytesReceived << " bytes), "
+              << (seconds > 0 ? static_cast<double>(stats.framesReceived) / seconds : 0.0) << " frames/s" << std::endl;
+    printLatencies("POST -> CHAT echo", stats.postLatencies);
+    printLatencies("LOGIN/JOIN/CREATE/MENU -> answer", stats.requestLatencies);
+    std::cout << "POSTs without an echo (refused or unanswered): " << stats.postsWithoutEcho << std::endl;
+}
+
+void Replayer::printLatencies(const char* label, std::vector<uint64_t> latencies) {
+    std::cout << label << " latency";
+    if (latencies.empty()) {
+        std::cout << ": no samples" << std::endl;
+        return;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&latencies](double p) {
+        size_t index = static_cast<size_t>(p * static_cast<double>(latencies.size() - 1) + 0.5);
+        return static_cast<double>(latencies[index]) / 1000.0;
+    };
+    std::cout << " (" << latencies.size() << " samples, ms): p50 " << percentile(0.5) << ", p90 " << percentile(0.9)
+              << ", p99 " << percentile(0.99) << ", max " << percentile(1.0) << std::endl;
+}
@@ -0,0 +1,81 @@
+#ifndef REPLAYER_H
+#define REPLAYER_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <unordered_set>
+#include <cstdint>
+#include "../common/Message.h"
+#include "../common/Trace.h"
+
+// One connection of the trace, played against the server.
+struct ReplayConnection {
+    int fd = -1;
+    std::string outbound;       // Frames not sent yet, from outboundOffset on
+    size_t outboundOffset = 0;
+    std::string inbound;        // Received bytes that don't form a whole frame yet
+    bool closing = false;       // The trace closed it, it closes once everything sent was answered
+    std::deque<std::pair<uint64_t, std::string>> pendingPosts; // Send time and text of POSTs awaiting their echo
+    uint64_t requestSentMicros = 0; // LOGIN/JOIN/CREATE/MENU awaiting its answer, 0 = none
+};
+
+struct ReplayStats {
+    uint64_t connections = 0;
+    uint64_t connectFailures = 0;
+    uint64_t framesSent = 0;
+    uint64_t bytesSent = 0;
+    uint64_t framesReceived = 0;
+    uint64_t bytesReceived = 0;
+    uint64_t postsWithoutEcho = 0;
+    std::vector<uint64_t> postLatencies;    // POST until its own CHAT comes back, microseconds
+    std::vector<uint64_t> requestLatencies; // LOGIN/JOIN/CREATE/MENU until the MENU/JOIN/QUIT answer
+};
+
+// Plays a trace recorded with the server's --capture option back against a server:
+// every connection is opened, fed its frames at the recorded times (or as fast as
+// possible) and closed again. Recorded PONGs are skipped, the replayer answers the
+// PINGs of the server it talks to. Reports the throughput and the latency of the
+// server's answers.
+class Replayer {
+public:
+    Replayer(const std::string& serverIP, int serverPort, bool fast);
+    ~Replayer();
+
+    bool run(const std::string& tracePath);
+    void printReport() const;
+
+private:
+    // Records played in a row in fast mode before the sockets are serviced
+    static const int FAST_BATCH = 64;
+
+    // After the last record, how long to wait for answers still outstanding
+    static const uint64_t DRAIN_TIMEOUT_MICROS = 2000000;
+
+    std::string serverIP;
+    int serverPort;
+    bool fast;
+    int epoll_fd;
+    uint64_t startMicros;
+    uint64_t elapsedMicros;
+    std::unordered_map<uint32_t, ReplayConnection> connections; // By the connection id of the trace
+    std::unordered_map<int, uint32_t> socketConnections;        // Socket FD -> connection id
+    std::unordered_set<uint32_t> closedConnections;             // Not reopened by later frames
+    ReplayStats stats;
+
+    void play(const TraceRecord& record);
+    ReplayConnection* openConnection(uint32_t id);
+    void closeConnection(uint32_t id);
+    void closeIfDone(uint32_t id, ReplayConnection& connection);
+    void sendFrame(ReplayConnection& connection, const std::string& payload);
+    bool flushOutbound(ReplayConnection& connection);
+    void handleEvent(int fd, uint32_t events);
+    void processFrame(ReplayConnection& connection, const MessageView& view);
+    static bool awaitingAnswers(const ReplayConnection& connection);
+    bool awaitingAnswers() const;
+    static uint64_t monotonicMicros();
+    static void printLatencies(const char* label, std::vector<uint64_t> latencies);
+};
+
+#endif // REPLAYER_H
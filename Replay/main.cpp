@@ -0,0 +1,22 @@
+#include <iostream>
+#include <string>
+#include <cstdlib>
+#include "Replayer.h"
+
+using namespace std;
+
+int main(int argc, char* argv[]) {
+    if (argc < 4 || argc > 5 || (argc == 5 && string(argv[4]) != "--fast")) {
+        cerr << "Usage: " << argv[0] << " <server_ip> <server_port> <trace_file> [--fast]" << endl;
+        cerr << "Plays a trace recorded with the server's --capture option at its original pace," << endl;
+        cerr << "or as fast as possible with --fast, and reports throughput and latency." << endl;
+        return 1;
+    }
+
+    Replayer replayer(argv[1], atoi(argv[2]), argc == 5);
+    if (!replayer.run(argv[3])) {
+        return 1;
+    }
+    replayer.printReport();
+    return 0;
+}
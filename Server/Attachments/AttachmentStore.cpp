@@ -0,0 +1,67 @@
+#include "AttachmentStore.h"
+#include <iostream>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+bool AttachmentStore::init(const std::string& spoolDirectory, size_t limit) {
+    directory = spoolDirectory;
+    maxAttachments = limit;
+    if (mkdir(directory.c_str(), 0700) == -1 && errno != EEXIST) {
+        std::cerr << "Error creating attachment directory " << directory << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+int AttachmentStore::createSpoolFile(Attachment& attachment) {
+    // Other servers on this host, or an earlier run of this one, may share the directory.
+    // Their files are never opened over, ids that are taken are skipped instead.
+    int fd;
+    do {
+        attachment.id = nextId++;
+        attachment.path = directory + "/" + std::to_string(attachment.id);
+        fd = open(attachment.path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    } while (fd == -1 && errno == EEXIST);
+    if (fd == -1) {
+        std::cerr << "Error creating spool file " << attachment.path << ": " << strerror(errno) << std::endl;
+    }
+    return fd;
+}
+
+void AttachmentStore::add(const Attachment& attachment) {
+    attachments[attachment.id] = attachment;
+    ids.push_back(attachment.id);
+    while (ids.size() > maxAttachments) {
+        auto it = attachments.find(ids.front());
+        if (it != attachments.end()) {
+            discard(it->second.path);
+            attachments.erase(it);
+        }
+        ids.pop_front();
+    }
+}
+
+const Attachment* AttachmentStore::find(uint64_t id) const {
+    auto it = attachments.find(id);
+    return it != attachments.end() ? &it->second : nullptr;
+}
+
+void AttachmentStore::discard(const std::string& path) {
+    // A download that already opened the file keeps reading it until it is done
+    unlink(path.c_str());
+}
+
+const std::deque<uint64_t>& AttachmentStore::getIds() const {
+    return ids;
+}
+
+uint64_t AttachmentStore::getNextId() const {
+    return nextId;
+}
+
+void AttachmentStore::setNextId(uint64_t id) {
+    nextId = id;
+}
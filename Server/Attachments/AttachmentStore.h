@@ -0,0 +1,65 @@
+#ifndef ATTACHMENTSTORE_H
+#define ATTACHMENTSTORE_H
+
+#include <string>
+#include <deque>
+#include <unordered_map>
+#include <cstdint>
+
+// A file shared in a chatroom. Its content lives in a spool file, the server never
+// holds it in memory.
+struct Attachment {
+    uint64_t id = 0;
+    std::string name;
+    uint64_t size = 0;
+    std::string chatroomName;
+    std::string path;
+};
+
+// An attachment a client is uploading, chunks are written to the spool file as they arrive.
+struct UploadState {
+    int fd = -1;
+    Attachment attachment;
+    uint64_t received = 0;
+};
+
+// An attachment being streamed to a client with sendfile(). 'frameRemaining' bytes of the
+// current chunk frame (after 'headerRemaining' bytes of its header) are still to be sent;
+// nothing else may be written to the socket until they are, or the frame would be torn apart.
+struct DownloadState {
+    int fd = -1;
+    uint64_t id = 0;
+    uint64_t offset = 0;
+    uint64_t size = 0;
+    uint64_t frameRemaining = 0;  // Content bytes of the CHUNK frame being sent, 0 between frames
+    uint8_t headerRemaining = 0;  // Bytes of that frame's header still to send
+};
+
+// Keeps the spool directory and the attachments that can still be downloaded. Beyond
+// 'maxAttachments' the oldest one is deleted.
+class AttachmentStore {
+public:
+    bool init(const std::string& directory, size_t maxAttachments);
+
+    // Creates the spool file for a new upload, filling in the id and path of 'attachment'.
+    // The id is one no file in the directory has yet.
+    int createSpoolFile(Attachment& attachment);
+
+    void add(const Attachment& attachment);
+    const Attachment* find(uint64_t id) const;
+    void discard(const std::string& path);
+
+    // For the handoff snapshot
+    const std::deque<uint64_t>& getIds() const;
+    uint64_t getNextId() const;
+    void setNextId(uint64_t id);
+
+private:
+    std::string directory;
+    size_t maxAttachments = 0;
+    uint64_t nextId = 1;
+    std::unordered_map<uint64_t, Attachment> attachments;
+    std::deque<uint64_t> ids; // Oldest first
+};
+
+#endif // ATTACHMENTSTORE_H
@@ -1,6 +1,8 @@
 #include "Chatroom.h"
 #include <iostream>
+#include <algorithm>
 
+const size_t Chatroom::DEFAULT_HISTORY_LIMIT;
 
 Chatroom::Chatroom(const std::string& name) : name(name) {}
 
@@ -16,46 +18,174 @@ bool Chatroom::isWordForbidden(const std::string& word) const {
 }
 
 void Chatroom::addClient(int clientSocket) {
-    clients.insert(clientSocket);
+    if (!clientIndex.emplace(clientSocket, clients.size()).second) {
+        return;
+    }
+    clients.push_back(clientSocket);
+    LogCursor cursor;
+    cursor.index = log.getHead();
+    cursor.nextSequence = getNextMessageNumber();
+    cursors.push_back(cursor);
     std::cout << "Client " << clientSocket << " joined chatroom: " << name << std::endl;
 }
 
 void Chatroom::removeClient(int clientSocket) {
-    clients.erase(clientSocket);
+    auto it = clientIndex.find(clientSocket);
+    if (it == clientIndex.end()) {
+        return;
+    }
+    // Move the last member into the hole, the order of members doesn't matter
+    size_t index = it->second;
+    clients[index] = clients.back();
+    cursors[index] = cursors.back();
+    clientIndex[clients[index]] = index;
+    clients.pop_back();
+    cursors.pop_back();
+    clientIndex.erase(clientSocket);
     std::cout << "Client " << clientSocket << " left chatroom: " << name << std::endl;
 }
 
 void Chatroom::addMessage(const std::string& message) {
-    messages.push_back(message);
+    if (messages.size() < historyLimit) {
+        messages.push_back(message);
+    } else {
+        // Overwrite the oldest message, assign() reuses the slot's memory when it fits
+        searchIndex.removeMessage(messages[firstMessage], getFirstMessageNumber());
+        messages[firstMessage].assign(message);
+        firstMessage = (firstMessage + 1) % messages.size();
+    }
+    searchIndex.addMessage(message, messagesAdded++);
+}
+
+size_t Chatroom::getMessageCount() const {
+    return messages.size();
+}
+
+const std::string& Chatroom::getMessage(size_t index) const {
+    return messages[(firstMessage + index) % messages.size()];
+}
+
+void Chatroom::setHistoryLimit(size_t limit) {
+    if (limit == 0) {
+        limit = 1;
+    }
+    // Unroll the ring so the oldest message is first again, then drop what doesn't fit
+    std::rotate(messages.begin(), messages.begin() + firstMessage, messages.end());
+    firstMessage = 0;
+    if (messages.size() > limit) {
+        size_t dropped = messages.size() - limit;
+        for (size_t i = 0; i < dropped; i++) {
+            searchIndex.removeMessage(messages[i], getFirstMessageNumber() + i);
+        }
+        messages.erase(messages.begin(), messages.begin() + dropped);
+    }
+    historyLimit = limit;
+}
+
+uint64_t Chatroom::getFirstMessageNumber() const {
+    return messagesAdded - messages.size();
+}
+
+uint64_t Chatroom::getNextMessageNumber() const {
+    return messagesAdded;
+}
+
+void Chatroom::setNextMessageNumber(uint64_t number) {
+    if (messages.empty()) {
+        messagesAdded = number;
+    }
+}
+
+const SearchIndex& Chatroom::getSearchIndex() const {
+    return searchIndex;
+}
+
+void Chatroom::clearMessages(uint64_t nextNumber) {
+    messages.clear();
+    firstMessage = 0;
+    messagesAdded = nextNumber;
+    searchIndex.clear();
+}
+
+int Chatroom::getOwnerNode() const {
+    return ownerNode;
+}
+
+void Chatroom::setOwnerNode(int node) {
+    ownerNode = node;
+}
+
+uint64_t Chatroom::getLastSequence() const {
+    return lastSequence;
+}
+
+void Chatroom::setLastSequence(uint64_t sequence) {
+    lastSequence = sequence;
+}
+
+std::set<int>& Chatroom::getSubscribedNodes() {
+    return subscribedNodes;
+}
+
+bool Chatroom::isHistorySynced() const {
+    return historySynced;
+}
+
+void Chatroom::setHistorySynced(bool synced) {
+    historySynced = synced;
+}
+
+uint32_t Chatroom::getId() const {
+    return id;
+}
+
+void Chatroom::setId(uint32_t roomId) {
+    id = roomId;
 }
 
 const std::string& Chatroom::getName() const {
     return name;
 }
 
-const std::set<int> &Chatroom::getClients() const {
+const std::vector<int>& Chatroom::getClients() const {
     return clients;
 }
 
-const std::vector<std::string>& Chatroom::getMessages() const {
-    return messages;
+RoomLog& Chatroom::getLog() {
+    return log;
+}
+
+std::vector<LogCursor>& Chatroom::getCursors() {
+    return cursors;
+}
+
+LogCursor* Chatroom::findCursor(int clientSocket) {
+    auto it = clientIndex.find(clientSocket);
+    return it != clientIndex.end() ? &cursors[it->second] : nullptr;
 }
 
 const std::set<std::string> &Chatroom::getForbiddenWords() const {
     return forbiddenWords;
 }
 
-std::string Chatroom::censorMessage(const std::string& messageBody) const {
-    std::string modifiedMessage = messageBody;
+PresenceDigest& Chatroom::getPresence() {
+    return presence;
+}
+
+RateLimiter& Chatroom::getRateLimiter() {
+    return rateLimiter;
+}
 
+void Chatroom::censorMessage(std::string& messageBody) const {
     for (const auto& word : forbiddenWords) {
-        std::size_t found = modifiedMessage.find(word);
+        if (word.empty()) {
+            continue;
+        }
+        std::size_t found = messageBody.find(word);
         while (found != std::string::npos) {
-            // Replace each occurrence of the forbidden word with ***
-            modifiedMessage.replace(found, word.length(), "****");
-            found = modifiedMessage.find(word, found + 3);
+            // Replace each occurrence of the forbidden word with ****
+            messageBody.replace(found, word.length(), "****");
+            found = messageBody.find(word, found + 4);
         }
     }
-
-    return modifiedMessage;
 }
@@ -4,9 +4,17 @@
 #include <string>
 #include <set>
 #include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include "../RateLimiter/RateLimiter.h"
+#include "../Search/SearchIndex.h"
+#include "../Presence/PresenceDigest.h"
+#include "RoomLog.h"
 
 class Chatroom {
 public:
+    static const size_t DEFAULT_HISTORY_LIMIT = 1000;
+
     Chatroom() = default;
     explicit Chatroom(const std::string& name);
     Chatroom(const std::string& name, const std::set<std::string>& forbiddenWords);
@@ -15,20 +23,72 @@ public:
     void removeClient(int clientSocket);
     void addMessage(const std::string& message);
     const std::string& getName() const;
-    const std::set<int>& getClients() const;
-    const std::vector<std::string>& getMessages() const;
+    // Dense id of the room on this server, the index of its bit in a RoomSet
+    uint32_t getId() const;
+    void setId(uint32_t roomId);
+    // Members in a dense array, in no particular order, so a broadcast walks contiguous
+    // memory and can hand slices of it to several threads.
+    const std::vector<int>& getClients() const;
+
+    // Frames broadcast to the room. getCursors()[i] is where getClients()[i] stands in
+    // them, a member that joins starts at the head.
+    RoomLog& getLog();
+    std::vector<LogCursor>& getCursors();
+    LogCursor* findCursor(int clientSocket);
+
+    // History is kept in a ring of the last 'historyLimit' messages, index 0 is the oldest.
+    size_t getMessageCount() const;
+    const std::string& getMessage(size_t index) const;
+    void setHistoryLimit(size_t limit);
+    void clearMessages(uint64_t nextNumber); // The next message added gets 'nextNumber'
+
+    // Messages are numbered in the order they were added, this is the number of getMessage(0).
+    // The numbers are the sequences clients see, they keep counting when the history is cleared.
+    uint64_t getFirstMessageNumber() const;
+    uint64_t getNextMessageNumber() const;
+    void setNextMessageNumber(uint64_t number); // Only while the history is empty
+    const SearchIndex& getSearchIndex() const;
+
+    // Federation: the node that orders the room's messages, the sequence number of the
+    // last message, and (on the owner) the peer nodes that have members in the room.
+    int getOwnerNode() const;
+    void setOwnerNode(int node);
+    uint64_t getLastSequence() const;
+    void setLastSequence(uint64_t sequence);
+    std::set<int>& getSubscribedNodes();
+    bool isHistorySynced() const;
+    void setHistorySynced(bool synced);
     const std::set<std::string>& getForbiddenWords() const;
+    RateLimiter& getRateLimiter();
+
+    // Joins and leaves not yet announced to the members
+    PresenceDigest& getPresence();
 
-    std::string censorMessage(const std::string &messageBody) const;
+    // Replaces forbidden words in place, so a buffer with spare capacity is reused.
+    void censorMessage(std::string& messageBody) const;
 
     void addForbiddenWord(const std::string& word);
     bool isWordForbidden(const std::string& word) const;
 
 private:
     std::string name;
-    std::set<int> clients;
+    uint32_t id = 0;
+    std::vector<int> clients;
+    std::unordered_map<int, size_t> clientIndex; // Position of each member in 'clients'
+    std::vector<LogCursor> cursors;              // Parallel to 'clients'
+    RoomLog log;
     std::vector<std::string> messages;
+    size_t historyLimit = DEFAULT_HISTORY_LIMIT;
+    size_t firstMessage = 0; // Position of the oldest message once the ring is full
+    uint64_t messagesAdded = 0;
+    SearchIndex searchIndex; // Covers exactly the messages in the ring
     std::set<std::string> forbiddenWords;
+    RateLimiter rateLimiter; // Caps the fanout the whole room can cause
+    PresenceDigest presence;
+    int ownerNode = 0;
+    uint64_t lastSequence = 0;
+    std::set<int> subscribedNodes;
+    bool historySynced = true; // False on a replica until the owner sent its history
 };
 
 #endif // CHATROOM_H
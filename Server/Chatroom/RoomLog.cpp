@@ -0,0 +1,79 @@
+#include "RoomLog.h"
+
+const size_t RoomLog::MAX_RECORDS;
+const size_t RoomLog::DEFAULT_MAX_BYTES;
+const size_t RoomLog::SHRINK_CAPACITY;
+const size_t RoomLog::SLOT_GRANULARITY;
+
+RoomLog::RoomLog(size_t maxBytes) : maxBytes(maxBytes) {}
+
+void RoomLog::setMaxBytes(size_t bytes) {
+    maxBytes = bytes;
+}
+
+void RoomLog::append(const std::string& frame, uint64_t nextSequence, uint64_t traceId, uint64_t appendedMicros) {
+    if (records.empty()) {
+        records.resize(MAX_RECORDS);
+    }
+    // Drop the oldest records until the new one fits, the newest frame is always kept
+    while (tail < head && (head - tail == MAX_RECORDS || bytes + frame.length() > maxBytes)) {
+        bytes -= at(tail).frame.length();
+        tail++;
+    }
+
+    Record& record = records[head % MAX_RECORDS];
+    if (record.frame.capacity() > SHRINK_CAPACITY && frame.length() <= SHRINK_CAPACITY) {
+        std::string().swap(record.frame);
+    }
+    if (record.frame.capacity() < frame.length()) {
+        record.frame.reserve((frame.length() + SLOT_GRANULARITY - 1) / SLOT_GRANULARITY * SLOT_GRANULARITY);
+    }
+    record.frame.assign(frame); // Reuses the slot's memory once the ring went around
+    record.nextSequence = nextSequence;
+    record.traceId = traceId;
+    record.appendedMicros = appendedMicros;
+    bytes += frame.length();
+    head++;
+}
+
+uint64_t RoomLog::getHead() const {
+    return head;
+}
+
+uint64_t RoomLog::getTail() const {
+    return tail;
+}
+
+size_t RoomLog::getBytes() const {
+    return bytes;
+}
+
+const std::string& RoomLog::getFrame(uint64_t index) const {
+    return at(index).frame;
+}
+
+uint64_t RoomLog::getNextSequence(uint64_t index) const {
+    return at(index).nextSequence;
+}
+
+uint64_t RoomLog::getTraceId(uint64_t index) const {
+    return at(index).traceId;
+}
+
+uint64_t RoomLog::getAppendedMicros(uint64_t index) const {
+    return at(index).appendedMicros;
+}
+
+size_t RoomLog::gather(uint64_t index, struct iovec* iov, size_t maxCount) const {
+    size_t count = 0;
+    for (; index < head && count < maxCount; index++, count++) {
+        const std::string& frame = at(index).frame;
+        iov[count].iov_base = const_cast<char*>(frame.data());
+        iov[count].iov_len = frame.length();
+    }
+    return count;
+}
+
+const RoomLog::Record& RoomLog::at(uint64_t index) const {
+    return records[index % MAX_RECORDS];
+}
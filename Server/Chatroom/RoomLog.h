@@ -0,0 +1,76 @@
+#ifndef ROOMLOG_H
+#define ROOMLOG_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <sys/uio.h>
+
+// Where a member of a chatroom stands in the room's log: the index of the next record
+// it hasn't sent, and the sequence of the next chat message it expects (what the
+// history is resumed from if the log drops records before the member got to them).
+struct LogCursor {
+    uint64_t index = 0;
+    uint64_t nextSequence = 0;
+};
+
+// The encoded frames broadcast to a chatroom. Each frame is appended once and sent to
+// every member straight from here, each member following it with its own LogCursor.
+// Records are numbered from 0 and keep their index; the log holds the newest ones, at
+// most MAX_RECORDS and 'maxBytes' of frames. A cursor behind getTail() was lapped.
+//
+// There is one writer, the event loop, and appends never overlap with the reads: the
+// members are served once the event loop is done with a batch of events, from the
+// fanout threads for big rooms.
+class RoomLog {
+public:
+    static const size_t MAX_RECORDS = 4096;
+    static const size_t DEFAULT_MAX_BYTES = 4 * 1024 * 1024;
+
+    explicit RoomLog(size_t maxBytes = DEFAULT_MAX_BYTES);
+
+    void setMaxBytes(size_t bytes);
+
+    // 'nextSequence' is the sequence a member expects once it received this frame.
+    // A traced frame remembers its trace id and when it was appended.
+    void append(const std::string& frame, uint64_t nextSequence, uint64_t traceId = 0, uint64_t appendedMicros = 0);
+
+    uint64_t getHead() const; // Index the next record will get
+    uint64_t getTail() const; // Oldest record still held
+    size_t getBytes() const;
+
+    const std::string& getFrame(uint64_t index) const;
+    uint64_t getNextSequence(uint64_t index) const;
+    uint64_t getTraceId(uint64_t index) const;
+    uint64_t getAppendedMicros(uint64_t index) const;
+
+    // Points 'iov' at the frames from 'index' on, at most 'maxCount' of them, and
+    // returns how many it filled in. The frames stay valid until the next append.
+    size_t gather(uint64_t index, struct iovec* iov, size_t maxCount) const;
+
+private:
+    // A slot whose frame was this big gives its memory back when it is reused
+    static const size_t SHRINK_CAPACITY = 64 * 1024;
+
+    // Slots grow in steps of this many bytes, so frames that get a byte longer (a
+    // sequence with one more digit) don't reallocate every slot once more
+    static const size_t SLOT_GRANULARITY = 64;
+
+    struct Record {
+        std::string frame;
+        uint64_t nextSequence = 0;
+        uint64_t traceId = 0;
+        uint64_t appendedMicros = 0;
+    };
+
+    std::vector<Record> records; // Allocated with the first append, quiet rooms cost nothing
+    uint64_t head = 0;
+    uint64_t tail = 0;
+    size_t bytes = 0;
+    size_t maxBytes;
+
+    const Record& at(uint64_t index) const;
+};
+
+#endif // ROOMLOG_H
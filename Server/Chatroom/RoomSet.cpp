@@ -0,0 +1,76 @@
+#include "RoomSet.h"
+
+const uint32_t RoomSet::NONE;
+
+void RoomSet::insert(uint32_t roomId) {
+    size_t index = roomId / 64;
+    if (index == 0) {
+        firstWord |= uint64_t(1) << roomId;
+        return;
+    }
+    if (index > moreWords.size()) {
+        moreWords.resize(index, 0);
+    }
+    moreWords[index - 1] |= uint64_t(1) << (roomId % 64);
+}
+
+void RoomSet::erase(uint32_t roomId) {
+    size_t index = roomId / 64;
+    if (index == 0) {
+        firstWord &= ~(uint64_t(1) << roomId);
+    } else if (index <= moreWords.size()) {
+        moreWords[index - 1] &= ~(uint64_t(1) << (roomId % 64));
+        // Trailing empty words are dropped, so empty() stays a size check
+        while (!moreWords.empty() && moreWords.back() == 0) {
+            moreWords.pop_back();
+        }
+    }
+}
+
+bool RoomSet::contains(uint32_t roomId) const {
+    return (word(roomId / 64) >> (roomId % 64)) & 1;
+}
+
+bool RoomSet::empty() const {
+    return firstWord == 0 && moreWords.empty();
+}
+
+size_t RoomSet::count() const {
+    size_t total = static_cast<size_t>(__builtin_popcountll(firstWord));
+    for (uint64_t bits : moreWords) {
+        total += static_cast<size_t>(__builtin_popcountll(bits));
+    }
+    return total;
+}
+
+void RoomSet::clear() {
+    firstWord = 0;
+    moreWords.clear();
+}
+
+uint32_t RoomSet::next(uint32_t from) const {
+    size_t index = from / 64;
+    size_t count = wordCount();
+    if (index >= count) {
+        return NONE;
+    }
+    uint64_t bits = word(index) & (~uint64_t(0) << (from % 64));
+    while (bits == 0) {
+        if (++index == count) {
+            return NONE;
+        }
+        bits = word(index);
+    }
+    return static_cast<uint32_t>(index * 64 + static_cast<size_t>(__builtin_ctzll(bits)));
+}
+
+uint64_t RoomSet::word(size_t index) const {
+    if (index == 0) {
+        return firstWord;
+    }
+    return index <= moreWords.size() ? moreWords[index - 1] : 0;
+}
+
+size_t RoomSet::wordCount() const {
+    return moreWords.size() + 1;
+}
@@ -0,0 +1,35 @@
+#ifndef ROOMSET_H
+#define ROOMSET_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// The chatrooms a session is subscribed to, as a bitset over the rooms' dense ids.
+// A membership check is one shift and mask, and a session in a handful of rooms
+// costs a word or two instead of a set of names. The first 64 ids live inline, so
+// most sessions never allocate.
+class RoomSet {
+public:
+    static const uint32_t NONE = UINT32_MAX;
+
+    void insert(uint32_t roomId);
+    void erase(uint32_t roomId);
+    bool contains(uint32_t roomId) const;
+    bool empty() const;
+    size_t count() const;
+    void clear();
+
+    // The lowest id in the set that is >= 'from', NONE if there is none. Walks the
+    // set in id order: for (id = set.next(0); id != NONE; id = set.next(id + 1))
+    uint32_t next(uint32_t from) const;
+
+private:
+    uint64_t firstWord = 0;
+    std::vector<uint64_t> moreWords; // Ids from 64 on, without trailing empty words
+
+    uint64_t word(size_t index) const;
+    size_t wordCount() const;
+};
+
+#endif // ROOMSET_H
@@ -0,0 +1,132 @@
+#include "ClientTable.h"
+
+const size_t ClientInfo::MAX_USERNAME_LENGTH;
+const size_t ClientInfo::RESUME_TOKEN_LENGTH;
+const size_t ClientTable::SLAB_RECORDS;
+const size_t ClientTable::INDEX_PAGE_BITS;
+const size_t ClientTable::INDEX_PAGE_SIZE;
+
+ClientTable::iterator::iterator(ClientTable* table, size_t number) : table(table), number(number) {
+    skipFree();
+}
+
+ClientInfo& ClientTable::iterator::operator*() const {
+    return table->record(number);
+}
+
+ClientInfo* ClientTable::iterator::operator->() const {
+    return &table->record(number);
+}
+
+ClientTable::iterator& ClientTable::iterator::operator++() {
+    number++;
+    skipFree();
+    return *this;
+}
+
+bool ClientTable::iterator::operator!=(const iterator& other) const {
+    return number != other.number;
+}
+
+void ClientTable::iterator::skipFree() {
+    size_t capacity = table->getRecordCapacity();
+    while (number < capacity && table->record(number).socketNum == -1) {
+        number++;
+    }
+}
+
+
+ClientTable::ClientTable() : indexPageCount(0), count(0) {}
+
+ClientInfo& ClientTable::record(size_t number) {
+    return slabs[number / SLAB_RECORDS][number % SLAB_RECORDS];
+}
+
+uint32_t* ClientTable::indexEntry(int connection, bool create) {
+    size_t page = static_cast<size_t>(connection) >> INDEX_PAGE_BITS;
+    if (page >= indexPages.size()) {
+        if (!create) {
+            return nullptr;
+        }
+        indexPages.resize(page + 1);
+    }
+    if (!indexPages[page]) {
+        if (!create) {
+            return nullptr;
+        }
+        indexPages[page].reset(new uint32_t[INDEX_PAGE_SIZE]());
+        indexPageCount++;
+    }
+    return &indexPages[page][static_cast<size_t>(connection) & (INDEX_PAGE_SIZE - 1)];
+}
+
+ClientInfo& ClientTable::create(int connection) {
+    uint32_t* entry = indexEntry(connection, true);
+    if (*entry != 0) {
+        return record(*entry - 1);
+    }
+    if (freeRecords.empty()) {
+        // A new slab, its records are handed out lowest number first
+        size_t first = getRecordCapacity();
+        slabs.emplace_back(new ClientInfo[SLAB_RECORDS]);
+        for (size_t number = first + SLAB_RECORDS; number > first; number--) {
+            freeRecords.push_back(static_cast<uint32_t>(number - 1));
+        }
+    }
+    uint32_t number = freeRecords.back();
+    freeRecords.pop_back();
+    *entry = number + 1;
+    count++;
+    ClientInfo& client = record(number);
+    client.socketNum = connection;
+    return client;
+}
+
+ClientInfo* ClientTable::find(int connection) {
+    uint32_t* entry = indexEntry(connection, false);
+    return entry != nullptr && *entry != 0 ? &record(*entry - 1) : nullptr;
+}
+
+void ClientTable::erase(int connection) {
+    uint32_t* entry = indexEntry(connection, false);
+    if (entry == nullptr || *entry == 0) {
+        return;
+    }
+    uint32_t number = *entry - 1;
+    record(number) = ClientInfo(); // Gives back whatever the record held
+    freeRecords.push_back(number);
+    *entry = 0;
+    count--;
+}
+
+void ClientTable::clear() {
+    for (size_t number = 0; number < getRecordCapacity(); number++) {
+        if (record(number).socketNum != -1) {
+            erase(record(number).socketNum);
+        }
+    }
+}
+
+size_t ClientTable::size() const {
+    return count;
+}
+
+ClientTable::iterator ClientTable::begin() {
+    return iterator(this, 0);
+}
+
+ClientTable::iterator ClientTable::end() {
+    return iterator(this, getRecordCapacity());
+}
+
+size_t ClientTable::getRecordCapacity() const {
+    return slabs.size() * SLAB_RECORDS;
+}
+
+size_t ClientTable::getSlabBytes() const {
+    return getRecordCapacity() * sizeof(ClientInfo) + freeRecords.capacity() * sizeof(uint32_t);
+}
+
+size_t ClientTable::getIndexBytes() const {
+    return indexPages.capacity() * sizeof(indexPages[0]) + indexPageCount * INDEX_PAGE_SIZE * sizeof(uint32_t);
+}
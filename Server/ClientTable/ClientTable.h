@@ -0,0 +1,101 @@
+#ifndef CLIENTTABLE_H
+#define CLIENTTABLE_H
+
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include "InlineString.h"
+#include "OutboundQueue.h"
+#include "../TimingWheel/TimingWheel.h"
+#include "../RateLimiter/RateLimiter.h"
+#include "../Chatroom/RoomSet.h"
+#include "../Attachments/AttachmentStore.h"
+#include "../../common/BufferPool.h"
+
+// State of one client connection. Records are sized for the common case, a connection
+// that idles in its rooms: short strings live inline, and the buffers and the upload
+// state only take memory while they are in use.
+class ClientInfo {
+public:
+    static const size_t MAX_USERNAME_LENGTH = 25;
+    static const size_t RESUME_TOKEN_LENGTH = 32;
+
+    TimingWheel::TimerId timer = TimingWheel::NO_TIMER; // The single pending timer of this connection
+    uint64_t lastActivityMillis = 0;                    // Last time anything was received
+    uint64_t lastChatActivityMillis = 0;                // Last time anything but a PONG was received
+    RateLimiter rateLimiter;
+    RoomSet chatrooms;                     // Every room the client is in, by id
+    DownloadState download;                // Attachment being streamed to the client
+    std::unique_ptr<UploadState> upload;   // Attachment being received from the client, if any
+    PooledBuffer readBuffer;               // Received bytes that don't form a whole frame yet
+    OutboundQueue outbound;                // Frames the connection couldn't take yet, by priority
+    int socketNum = -1;                    // -1 while the record is free
+    uint32_t connectionId = 0;             // Identifies the connection in a traffic capture
+    uint32_t activeChatroom = RoomSet::NONE; // The room its POSTs, searches and files go to
+    int throttledInARow = 0;
+    InlineString<MAX_USERNAME_LENGTH> username;
+    InlineString<RESUME_TOKEN_LENGTH> resumeToken; // Handed out at login, resumes the session if the connection drops
+    bool loggedIn = false;
+    bool awaitingPong = false;
+    bool wantsPresence = true;       // Receives the join/leave digests of its chatroom
+    bool waitingForWritable = false; // Its rooms have frames it couldn't take yet
+    bool watchingWritable = false;   // Writability of the connection is watched
+};
+
+// The records of the connected clients by connection number (the socket FD with TCP).
+// Records are kept in slabs of SLAB_RECORDS that are never given back, and freed ones
+// are reused first, so memory follows the peak number of connections in fixed steps
+// and a record costs the same whatever the allocator does. A paged direct index finds
+// the record of a connection.
+class ClientTable {
+public:
+    static const size_t SLAB_RECORDS = 1024;
+    static const size_t INDEX_PAGE_BITS = 12;
+
+    // Walks the records in use, in no particular order
+    class iterator {
+    public:
+        iterator(ClientTable* table, size_t number);
+        ClientInfo& operator*() const;
+        ClientInfo* operator->() const;
+        iterator& operator++();
+        bool operator!=(const iterator& other) const;
+
+    private:
+        ClientTable* table;
+        size_t number;
+        void skipFree();
+    };
+
+    ClientTable();
+
+    // Only where a connection starts (accepted or restored): the record of 'connection',
+    // a fresh one if there is none yet. Everything else looks records up with find().
+    ClientInfo& create(int connection);
+    ClientInfo* find(int connection); // nullptr for a connection without a record
+    void erase(int connection);
+    void clear();
+    size_t size() const;
+    iterator begin();
+    iterator end();
+
+    // Memory accounting
+    size_t getRecordCapacity() const; // Records in the slabs, used or free
+    size_t getSlabBytes() const;
+    size_t getIndexBytes() const;
+
+private:
+    static const size_t INDEX_PAGE_SIZE = size_t(1) << INDEX_PAGE_BITS;
+
+    std::vector<std::unique_ptr<ClientInfo[]> > slabs;
+    std::vector<uint32_t> freeRecords;                    // Numbers of the records not in use
+    std::vector<std::unique_ptr<uint32_t[]> > indexPages; // Record number + 1 by connection, 0 = none
+    size_t indexPageCount;
+    size_t count;
+
+    ClientInfo& record(size_t number);
+    uint32_t* indexEntry(int connection, bool create);
+};
+
+#endif // CLIENTTABLE_H
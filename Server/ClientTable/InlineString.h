@@ -0,0 +1,66 @@
+#ifndef INLINESTRING_H
+#define INLINESTRING_H
+
+#include <string>
+#include <cstring>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+// A string of at most N characters stored in place, for short fields of records that
+// exist once per connection (usernames, resume tokens). Longer values are cut off.
+template <size_t N>
+class InlineString {
+    static_assert(N < 256, "the length is kept in one byte");
+
+public:
+    InlineString() : size(0) {
+        text[0] = '\0';
+    }
+
+    InlineString(const std::string& value) {
+        assign(value.data(), value.length());
+    }
+
+    InlineString& operator=(const std::string& value) {
+        assign(value.data(), value.length());
+        return *this;
+    }
+
+    void assign(const char* value, size_t length) {
+        size = static_cast<uint8_t>(length < N ? length : N);
+        memcpy(text, value, size);
+        text[size] = '\0';
+    }
+
+    bool empty() const {
+        return size == 0;
+    }
+
+    size_t length() const {
+        return size;
+    }
+
+    const char* c_str() const {
+        return text;
+    }
+
+    std::string str() const {
+        return std::string(text, size);
+    }
+
+    bool operator==(const std::string& other) const {
+        return other.length() == size && memcmp(text, other.data(), size) == 0;
+    }
+
+private:
+    char text[N + 1];
+    uint8_t size;
+};
+
+template <size_t N>
+std::ostream& operator<<(std::ostream& out, const InlineString<N>& value) {
+    return out.write(value.c_str(), static_cast<std::streamsize>(value.length()));
+}
+
+#endif // INLINESTRING_H
@@ -0,0 +1,132 @@
+#include "OutboundQueue.h"
+#include <algorithm>
+
+const size_t OutboundQueue::MAX_IOV;
+
+bool OutboundQueue::empty() const {
+    for (const PooledBuffer& lane : lanes) {
+        if (!lane.empty()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t OutboundQueue::length() const {
+    size_t bytes = 0;
+    for (const PooledBuffer& lane : lanes) {
+        bytes += lane.length();
+    }
+    return bytes;
+}
+
+size_t OutboundQueue::capacity() const {
+    size_t bytes = 0;
+    for (const PooledBuffer& lane : lanes) {
+        bytes += lane.capacity();
+    }
+    return bytes;
+}
+
+size_t OutboundQueue::getHeldBuffers() const {
+    size_t buffers = 0;
+    for (const PooledBuffer& lane : lanes) {
+        buffers += lane.capacity() != 0 ? 1 : 0;
+    }
+    return buffers;
+}
+
+void OutboundQueue::push(TrafficClass trafficClass, const char* frames, size_t length) {
+    lanes[static_cast<size_t>(trafficClass)].append(frames, length);
+}
+
+void OutboundQueue::push(TrafficClass trafficClass, const std::string& frames) {
+    push(trafficClass, frames.data(), frames.length());
+}
+
+void OutboundQueue::pushRest(TrafficClass trafficClass, const char* rest, size_t length) {
+    if (length == 0) {
+        return;
+    }
+    PooledBuffer& lane = lanes[static_cast<size_t>(trafficClass)];
+    if (lane.empty()) {
+        lane.append(rest, length);
+    } else {
+        std::string queued(rest, length);
+        queued += lane.str();
+        lane.assign(queued);
+    }
+    frameRemaining = static_cast<uint32_t>(length);
+    startedLane = static_cast<uint8_t>(trafficClass);
+}
+
+size_t OutboundQueue::gather(struct iovec* iov) const {
+    size_t count = 0;
+    if (startedLane != TRAFFIC_CLASS_COUNT) {
+        iov[count].iov_base = const_cast<char*>(lanes[startedLane].data());
+        iov[count].iov_len = frameRemaining;
+        count++;
+    }
+    for (size_t i = 0; i < TRAFFIC_CLASS_COUNT; i++) {
+        size_t skip = i == startedLane ? frameRemaining : 0;
+        if (lanes[i].length() > skip) {
+            iov[count].iov_base = const_cast<char*>(lanes[i].data() + skip);
+            iov[count].iov_len = lanes[i].length() - skip;
+            count++;
+        }
+    }
+    return count;
+}
+
+void OutboundQueue::consume(size_t count) {
+    // Same order as gather(): the started frame, then the lanes by class
+    if (startedLane != TRAFFIC_CLASS_COUNT) {
+        count -= consumeLane(startedLane, std::min<size_t>(count, frameRemaining));
+    }
+    for (size_t i = 0; i < TRAFFIC_CLASS_COUNT && count > 0; i++) {
+        count -= consumeLane(i, count);
+    }
+}
+
+void OutboundQueue::clear() {
+    for (PooledBuffer& lane : lanes) {
+        lane.clear();
+    }
+    frameRemaining = 0;
+    startedLane = TRAFFIC_CLASS_COUNT;
+}
+
+const std::string& OutboundQueue::str(TrafficClass trafficClass) const {
+    return lanes[static_cast<size_t>(trafficClass)].str();
+}
+
+uint32_t OutboundQueue::getFrameRemaining(TrafficClass trafficClass) const {
+    return static_cast<size_t>(trafficClass) == startedLane ? frameRemaining : 0;
+}
+
+// Consumes up to 'count' bytes of a lane and follows the frame boundaries across them.
+// A lane only holds whole frames behind its front one, so the header of the next frame
+// is there whenever the previous one ends. A frame cut off at the end is the started one.
+size_t OutboundQueue::consumeLane(size_t lane, size_t count) {
+    PooledBuffer& bytes = lanes[lane];
+    size_t taken = std::min(count, bytes.length());
+    uint32_t remaining = lane == startedLane ? frameRemaining : 0;
+    size_t offset = 0;
+    while (offset < taken) {
+        if (remaining == 0) {
+            remaining = Message::FRAME_HEADER_SIZE + Message::readFrameHeader(bytes.data() + offset);
+        }
+        size_t step = std::min<size_t>(taken - offset, remaining);
+        offset += step;
+        remaining -= static_cast<uint32_t>(step);
+    }
+    bytes.consume(taken);
+    if (remaining != 0) {
+        frameRemaining = remaining;
+        startedLane = static_cast<uint8_t>(lane);
+    } else if (lane == startedLane) {
+        frameRemaining = 0;
+        startedLane = TRAFFIC_CLASS_COUNT;
+    }
+    return taken;
+}
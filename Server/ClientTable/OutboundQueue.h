@@ -0,0 +1,55 @@
+#ifndef OUTBOUNDQUEUE_H
+#define OUTBOUNDQUEUE_H
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#include <sys/uio.h>
+#include "../../common/Message.h"
+#include "../../common/BufferPool.h"
+
+// The frames a connection couldn't take yet, in one lane per TrafficClass. They go out
+// lane by lane in class order, so a CONTROL frame queued behind chatroom traffic is sent
+// first. The exception is a frame that is already partly sent: whatever lane it is in,
+// its rest goes before anything else, so frames never interleave on the wire. Frames
+// of one lane keep their order. Lanes hold memory only while they have frames.
+class OutboundQueue {
+public:
+    // Most iovecs gather() fills in: the rest of a partly sent frame, then every lane
+    static const size_t MAX_IOV = TRAFFIC_CLASS_COUNT + 1;
+
+    bool empty() const;
+    size_t length() const;
+    size_t capacity() const;       // Bytes held by the lanes, 0 while idle
+    size_t getHeldBuffers() const; // Lanes that hold memory
+
+    // Queues whole frames
+    void push(TrafficClass trafficClass, const char* frames, size_t length);
+    void push(TrafficClass trafficClass, const std::string& frames);
+
+    // Queues the rest of a frame whose first bytes were already sent ahead of everything
+    // queued, it goes out before anything else. Only while no other frame is partly sent.
+    void pushRest(TrafficClass trafficClass, const char* rest, size_t length);
+
+    // Points 'iov' at the queued bytes in the order they have to be sent, returns how
+    // many it filled in (at most MAX_IOV). Valid until the queue is changed.
+    size_t gather(struct iovec* iov) const;
+
+    // Drops 'count' bytes that were sent from what gather() returned
+    void consume(size_t count);
+    void clear();
+
+    // For the handoff snapshot: a lane's bytes, and how many of them at its front finish
+    // a frame that is partly sent.
+    const std::string& str(TrafficClass trafficClass) const;
+    uint32_t getFrameRemaining(TrafficClass trafficClass) const;
+
+private:
+    PooledBuffer lanes[TRAFFIC_CLASS_COUNT];
+    uint32_t frameRemaining = 0; // Bytes of the partly sent frame still to send
+    uint8_t startedLane = TRAFFIC_CLASS_COUNT; // The lane it is at the front of, TRAFFIC_CLASS_COUNT if none
+
+    size_t consumeLane(size_t lane, size_t count);
+};
+
+#endif // OUTBOUNDQUEUE_H
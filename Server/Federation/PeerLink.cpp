@@ -0,0 +1,81 @@
+#include "PeerLink.h"
+#include <iostream>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <cstdlib>
+
+
+bool PeerSockets::parseAddress(const std::string& address, std::string& host, int& port) {
+    size_t colon = address.rfind(':');
+    if (colon == std::string::npos || colon == 0 || colon + 1 == address.length()) {
+        return false;
+    }
+    host = address.substr(0, colon);
+    port = atoi(address.c_str() + colon + 1);
+    return port > 0;
+}
+
+int PeerSockets::listenOn(const std::string& ip, int port) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        std::cerr << "Error creating federation socket: " << strerror(errno) << std::endl;
+        return -1;
+    }
+
+    int opt = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    inet_pton(AF_INET, ip.c_str(), &address.sin_addr);
+
+    if (bind(fd, (sockaddr*)&address, sizeof(address)) == -1 || listen(fd, SOMAXCONN) == -1) {
+        std::cerr << "Error listening for peers on port " << port << ": " << strerror(errno) << std::endl;
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int PeerSockets::startConnect(const std::string& host, int port) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        return -1;
+    }
+
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    if (inet_pton(AF_INET, host.c_str(), &address.sin_addr) != 1) {
+        std::cerr << "Invalid peer address: " << host << std::endl;
+        close(fd);
+        return -1;
+    }
+
+    if (connect(fd, (sockaddr*)&address, sizeof(address)) == -1 && errno != EINPROGRESS) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool PeerSockets::finishConnect(int fd) {
+    int error = 0;
+    socklen_t length = sizeof(error);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) == -1 || error != 0) {
+        return false;
+    }
+
+    // Peer links carry many small frames, don't let Nagle hold them back
+    int opt = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+    return true;
+}
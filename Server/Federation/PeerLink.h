@@ -0,0 +1,57 @@
+#ifndef PEERLINK_H
+#define PEERLINK_H
+
+#include <string>
+#include <cstdint>
+#include "../TimingWheel/TimingWheel.h"
+
+// Messages exchanged between federated server nodes. They travel in the same
+// length-prefixed frames as client messages; the payload starts with the type
+// byte and is encoded with SnapshotWriter.
+enum class PeerMessageType : uint8_t {
+    HELLO,       // nodeId: first message on a link in both directions
+    ROOM,        // name, owner, forbidden words: a room exists (sent by its owner)
+    SUBSCRIBE,   // name, has a copy, last sequence of the copy: the sender has local members
+                 // in a room owned by the receiver
+    UNSUBSCRIBE, // name: the sender's last local member left the room
+    HISTORY,     // name, replace, first sequence, last sequence, messages: one page of the owner's
+                 // answer to SUBSCRIBE, as many pages follow as it takes to catch up
+    PUBLISH,     // name, message type, body: a message posted on a non-owner node
+    DELIVER,     // name, sequence, message type, body: the owner's ordered copy of a message
+    PRESENCE,    // name, unlisted joins, unlisted leaves, count, (username, joined) pairs:
+                 // a node's presence window for the owner, or the owner's merged one
+    HEARTBEAT    // nothing: keeps a link that carries no other traffic from looking dead
+};
+
+// One TCP link to another node. The socket is non-blocking: what it can't take is kept
+// in 'writeBuffer' and sent when it becomes writable, so a slow node never stalls ours.
+struct PeerLink {
+    int fd = -1;
+    int nodeId = -1;      // Unknown until the peer's HELLO arrives
+    int peerIndex = -1;   // Index in ServerConfig::peers for links we dialed, -1 for accepted ones
+    bool connecting = false;
+    bool watchingWritable = false;
+    bool broken = false;  // Shut down after a failed send, the next read closes it
+    std::string readBuffer;
+    std::string writeBuffer;
+    uint64_t lastReceivedMillis = 0; // Anything from the peer counts, heartbeats included
+    uint64_t lastSentMillis = 0;
+    TimingWheel::TimerId timer = TimingWheel::NO_TIMER;
+};
+
+// Socket helpers for peer links.
+class PeerSockets {
+public:
+    // Splits "host:port". Returns false if it isn't in that form.
+    static bool parseAddress(const std::string& address, std::string& host, int& port);
+
+    static int listenOn(const std::string& ip, int port);
+
+    // Starts a non-blocking connect, the socket becomes writable once it completed.
+    static int startConnect(const std::string& host, int port);
+
+    // Checks the result of a connect started by startConnect. The socket stays non-blocking.
+    static bool finishConnect(int fd);
+};
+
+#endif // PEERLINK_H
@@ -0,0 +1,255 @@
+#include "Handoff.h"
+#include <iostream>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <algorithm>
+
+const size_t Handoff::FDS_PER_MESSAGE;
+
+
+void SnapshotWriter::writeU8(uint8_t value) {
+    data.push_back(static_cast<char>(value));
+}
+
+void SnapshotWriter::writeU32(uint32_t value) {
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        data.push_back(static_cast<char>((value >> shift) & 0xFF));
+    }
+}
+
+void SnapshotWriter::writeU64(uint64_t value) {
+    writeU32(static_cast<uint32_t>(value >> 32));
+    writeU32(static_cast<uint32_t>(value & 0xFFFFFFFF));
+}
+
+void SnapshotWriter::writeString(const std::string& value) {
+    writeBytes(value.data(), value.length());
+}
+
+void SnapshotWriter::writeBytes(const char* value, size_t length) {
+    writeU32(static_cast<uint32_t>(length));
+    data.append(value, length);
+}
+
+const std::string& SnapshotWriter::getData() const {
+    return data;
+}
+
+void SnapshotWriter::clear() {
+    data.clear();
+}
+
+
+SnapshotReader::SnapshotReader(const std::string& data) : data(data.data()), length(data.length()), offset(0) {}
+
+SnapshotReader::SnapshotReader(const char* data, size_t length) : data(data), length(length), offset(0) {}
+
+bool SnapshotReader::readU8(uint8_t& value) {
+    if (offset + 1 > length) {
+        return false;
+    }
+    value = static_cast<uint8_t>(data[offset++]);
+    return true;
+}
+
+bool SnapshotReader::readU32(uint32_t& value) {
+    if (offset + 4 > length) {
+        return false;
+    }
+    value = 0;
+    for (int i = 0; i < 4; i++) {
+        value = (value << 8) | static_cast<uint8_t>(data[offset++]);
+    }
+    return true;
+}
+
+bool SnapshotReader::readU64(uint64_t& value) {
+    uint32_t high, low;
+    if (!readU32(high) || !readU32(low)) {
+        return false;
+    }
+    value = (static_cast<uint64_t>(high) << 32) | low;
+    return true;
+}
+
+bool SnapshotReader::readString(std::string& value) {
+    uint32_t valueLength;
+    if (!readU32(valueLength) || offset + valueLength > length) {
+        return false;
+    }
+    value.assign(data + offset, valueLength);
+    offset += valueLength;
+    return true;
+}
+
+
+int Handoff::listenOn(const std::string& path) {
+    sockaddr_un address;
+    if (path.length() >= sizeof(address.sun_path)) {
+        std::cerr << "Handoff socket path too long: " << path << std::endl;
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        std::cerr << "Error creating handoff socket: " << strerror(errno) << std::endl;
+        return -1;
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+    unlink(path.c_str()); // Leftover of a server that didn't shut down cleanly
+
+    if (bind(fd, (sockaddr*)&address, sizeof(address)) == -1 || listen(fd, 1) == -1) {
+        std::cerr << "Error listening on handoff socket " << path << ": " << strerror(errno) << std::endl;
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int Handoff::connectTo(const std::string& path) {
+    sockaddr_un address;
+    if (path.length() >= sizeof(address.sun_path)) {
+        std::cerr << "Handoff socket path too long: " << path << std::endl;
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        std::cerr << "Error creating handoff socket: " << strerror(errno) << std::endl;
+        return -1;
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+
+    if (connect(fd, (sockaddr*)&address, sizeof(address)) == -1) {
+        std::cerr << "Error connecting to handoff socket " << path << ": " << strerror(errno) << std::endl;
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool Handoff::sendState(int channel, const std::vector<int>& fds, const std::string& snapshot) {
+    // Header: number of descriptors and snapshot length
+    SnapshotWriter header;
+    header.writeU32(static_cast<uint32_t>(fds.size()));
+    header.writeU64(snapshot.length());
+    if (!sendAll(channel, header.getData().data(), header.getData().length())) {
+        return false;
+    }
+
+    // Descriptors in batches, each batch riding on a single byte of regular data
+    for (size_t first = 0; first < fds.size(); first += FDS_PER_MESSAGE) {
+        size_t count = std::min(FDS_PER_MESSAGE, fds.size() - first);
+        std::vector<char> control(CMSG_SPACE(count * sizeof(int)), 0);
+        char marker = 'F';
+        iovec iov;
+        iov.iov_base = &marker;
+        iov.iov_len = 1;
+
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.data();
+        msg.msg_controllen = control.size();
+
+        cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(count * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fds[first], count * sizeof(int));
+
+        if (sendmsg(channel, &msg, MSG_NOSIGNAL) != 1) {
+            std::cerr << "Error sending descriptors: " << strerror(errno) << std::endl;
+            return false;
+        }
+    }
+
+    return sendAll(channel, snapshot.data(), snapshot.length());
+}
+
+bool Handoff::receiveState(int channel, std::vector<int>& fds, std::string& snapshot) {
+    std::string headerData(12, '\0');
+    if (!receiveAll(channel, &headerData[0], headerData.length())) {
+        return false;
+    }
+    SnapshotReader header(headerData);
+    uint32_t fdCount;
+    uint64_t snapshotLength;
+    header.readU32(fdCount);
+    header.readU64(snapshotLength);
+
+    fds.clear();
+    while (fds.size() < fdCount) {
+        size_t count = std::min(FDS_PER_MESSAGE, static_cast<size_t>(fdCount) - fds.size());
+        std::vector<char> control(CMSG_SPACE(count * sizeof(int)), 0);
+        char marker;
+        iovec iov;
+        iov.iov_base = &marker;
+        iov.iov_len = 1;
+
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.data();
+        msg.msg_controllen = control.size();
+
+        if (recvmsg(channel, &msg, MSG_CMSG_CLOEXEC) != 1 || (msg.msg_flags & MSG_CTRUNC)) {
+            std::cerr << "Error receiving descriptors: " << strerror(errno) << std::endl;
+            return false;
+        }
+        cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        if (cmsg == nullptr || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+            std::cerr << "Handoff message without descriptors." << std::endl;
+            return false;
+        }
+        size_t received = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        const int* data = reinterpret_cast<const int*>(CMSG_DATA(cmsg));
+        fds.insert(fds.end(), data, data + received);
+    }
+
+    snapshot.assign(snapshotLength, '\0');
+    return receiveAll(channel, &snapshot[0], snapshot.length());
+}
+
+bool Handoff::sendAll(int channel, const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t sent = send(channel, data, length, MSG_NOSIGNAL);
+        if (sent <= 0) {
+            if (sent == -1 && errno == EINTR) {
+                continue;
+            }
+            std::cerr << "Error writing to handoff socket: " << strerror(errno) << std::endl;
+            return false;
+        }
+        data += sent;
+        length -= sent;
+    }
+    return true;
+}
+
+bool Handoff::receiveAll(int channel, char* data, size_t length) {
+    while (length > 0) {
+        ssize_t received = recv(channel, data, length, 0);
+        if (received <= 0) {
+            if (received == -1 && errno == EINTR) {
+                continue;
+            }
+            std::cerr << "Error reading from handoff socket: " << strerror(errno) << std::endl;
+            return false;
+        }
+        data += received;
+        length -= received;
+    }
+    return true;
+}
@@ -0,0 +1,59 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// Flat little helper to encode binary records: the server state that is handed to a
+// successor process, and the messages exchanged with federation peers.
+class SnapshotWriter {
+public:
+    void writeU8(uint8_t value);
+    void writeU32(uint32_t value);
+    void writeU64(uint64_t value);
+    void writeString(const std::string& value);
+    void writeBytes(const char* value, size_t length);
+    const std::string& getData() const;
+    void clear();
+
+private:
+    std::string data;
+};
+
+// Reads back what SnapshotWriter wrote. Every read fails (returns false) once the
+// data is exhausted, so a truncated snapshot is detected instead of misread.
+class SnapshotReader {
+public:
+    explicit SnapshotReader(const std::string& data);
+    SnapshotReader(const char* data, size_t length);
+    bool readU8(uint8_t& value);
+    bool readU32(uint32_t& value);
+    bool readU64(uint64_t& value);
+    bool readString(std::string& value);
+
+private:
+    const char* data;
+    size_t length;
+    size_t offset;
+};
+
+// Transfers open file descriptors and a state snapshot between two server processes
+// over a UNIX socket. The descriptors travel as SCM_RIGHTS ancillary data, so the
+// connections they refer to stay open while they change owner.
+class Handoff {
+public:
+    static int listenOn(const std::string& path);
+    static int connectTo(const std::string& path);
+
+    static bool sendState(int channel, const std::vector<int>& fds, const std::string& snapshot);
+    static bool receiveState(int channel, std::vector<int>& fds, std::string& snapshot);
+
+private:
+    static const size_t FDS_PER_MESSAGE = 250; // Stays under the kernel's SCM_MAX_FD
+
+    static bool sendAll(int channel, const char* data, size_t length);
+    static bool receiveAll(int channel, char* data, size_t length);
+};
+
+#endif // HANDOFF_H
@@ -0,0 +1,89 @@
+#include "PresenceDigest.h"
+#include <vector>
+
+const size_t PresenceDigest::MAX_NAMES_LISTED;
+
+void PresenceDigest::join(const std::string& username) {
+    change(username, 1);
+}
+
+void PresenceDigest::leave(const std::string& username) {
+    change(username, -1);
+}
+
+void PresenceDigest::change(const std::string& username, int delta) {
+    auto it = changes.find(username);
+    if (it == changes.end()) {
+        changes.emplace(username, delta);
+        return;
+    }
+    it->second += delta;
+    if (it->second == 0) {
+        changes.erase(it);
+    }
+}
+
+void PresenceDigest::addUnlisted(uint32_t joinedCount, uint32_t leftCount) {
+    unlistedJoined += joinedCount;
+    unlistedLeft += leftCount;
+}
+
+bool PresenceDigest::empty() const {
+    return changes.empty() && unlistedJoined == 0 && unlistedLeft == 0;
+}
+
+void PresenceDigest::clear() {
+    changes.clear();
+    unlistedJoined = 0;
+    unlistedLeft = 0;
+}
+
+const std::map<std::string, int>& PresenceDigest::getChanges() const {
+    return changes;
+}
+
+uint32_t PresenceDigest::getUnlistedJoined() const {
+    return unlistedJoined;
+}
+
+uint32_t PresenceDigest::getUnlistedLeft() const {
+    return unlistedLeft;
+}
+
+static std::string describeGroup(const std::vector<std::string>& names, uint32_t count, bool listNames,
+                                 const char* verb, const std::string& chatroomName) {
+    std::string text;
+    if (listNames) {
+        for (size_t i = 0; i < names.size(); i++) {
+            if (i > 0) {
+                text += i + 1 == names.size() ? " and " : ", ";
+            }
+            text += "[" + names[i] + "]";
+        }
+    } else {
+        text = std::to_string(count) + (count == 1 ? " user" : " users");
+    }
+    return text + " " + verb + " " + chatroomName;
+}
+
+std::string PresenceDigest::describe(const std::string& chatroomName) const {
+    std::vector<std::string> joined, left;
+    for (const auto& pair : changes) {
+        (pair.second > 0 ? joined : left).push_back(pair.first);
+    }
+    uint32_t joinedCount = static_cast<uint32_t>(joined.size()) + unlistedJoined;
+    uint32_t leftCount = static_cast<uint32_t>(left.size()) + unlistedLeft;
+    bool listNames = unlistedJoined == 0 && unlistedLeft == 0 && changes.size() <= MAX_NAMES_LISTED;
+
+    std::string text;
+    if (joinedCount > 0) {
+        text = describeGroup(joined, joinedCount, listNames, "joined", chatroomName);
+    }
+    if (leftCount > 0) {
+        if (!text.empty()) {
+            text += ", ";
+        }
+        text += describeGroup(left, leftCount, listNames, "left", chatroomName);
+    }
+    return text;
+}
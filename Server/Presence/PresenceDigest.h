@@ -0,0 +1,41 @@
+#ifndef PRESENCEDIGEST_H
+#define PRESENCEDIGEST_H
+
+#include <string>
+#include <map>
+#include <cstdint>
+
+// Joins and leaves of one chatroom during the current presence window. A user who
+// leaves and comes back within the window (a reconnect) cancels out. The members
+// hear about the window in a single line instead of one message per user.
+class PresenceDigest {
+public:
+    void join(const std::string& username);
+    void leave(const std::string& username);
+
+    // Adds changes that are only known by number, e.g. beyond what a peer listed.
+    void addUnlisted(uint32_t joinedCount, uint32_t leftCount);
+
+    bool empty() const;
+    void clear();
+
+    // Username -> +1 (joined) or -1 (left)
+    const std::map<std::string, int>& getChanges() const;
+    uint32_t getUnlistedJoined() const;
+    uint32_t getUnlistedLeft() const;
+
+    // "[alice] and [bob] joined room, [carol] left room" or "120 users joined room"
+    std::string describe(const std::string& chatroomName) const;
+
+private:
+    // Names are spelled out up to this many changes, beyond that only counts are given
+    static const size_t MAX_NAMES_LISTED = 5;
+
+    std::map<std::string, int> changes;
+    uint32_t unlistedJoined = 0;
+    uint32_t unlistedLeft = 0;
+
+    void change(const std::string& username, int delta);
+};
+
+#endif // PRESENCEDIGEST_H
@@ -0,0 +1,56 @@
+#include "RateLimiter.h"
+
+
+TokenBucket::TokenBucket() : rate(0), burst(0), tokens(0), lastRefillMillis(0) {}
+
+TokenBucket::TokenBucket(double rate, double burst)
+    : rate(rate), burst(burst < 1 ? 1 : burst), tokens(burst < 1 ? 1 : burst), lastRefillMillis(0) {}
+
+bool TokenBucket::isLimited() const {
+    return rate > 0;
+}
+
+bool TokenBucket::hasTokens(double amount, uint64_t nowMillis) {
+    if (!isLimited()) {
+        return true;
+    }
+    refill(nowMillis);
+    // A message bigger than the whole burst passes when the bucket is full,
+    // otherwise it could never be sent at all
+    return tokens >= amount || tokens >= burst;
+}
+
+void TokenBucket::consume(double amount) {
+    if (isLimited()) {
+        tokens -= amount;
+    }
+}
+
+void TokenBucket::refill(uint64_t nowMillis) {
+    if (lastRefillMillis == 0) {
+        lastRefillMillis = nowMillis; // First use, the bucket starts full
+        return;
+    }
+    if (nowMillis > lastRefillMillis) {
+        tokens += (nowMillis - lastRefillMillis) * rate / 1000.0;
+        if (tokens > burst) {
+            tokens = burst;
+        }
+        lastRefillMillis = nowMillis;
+    }
+}
+
+
+void RateLimiter::configure(double messagesPerSecond, double messageBurst, double bytesPerSecond, double byteBurst) {
+    messageBucket = TokenBucket(messagesPerSecond, messageBurst);
+    byteBucket = TokenBucket(bytesPerSecond, byteBurst);
+}
+
+bool RateLimiter::allow(size_t bytes, uint64_t nowMillis) {
+    if (!messageBucket.hasTokens(1, nowMillis) || !byteBucket.hasTokens(static_cast<double>(bytes), nowMillis)) {
+        return false;
+    }
+    messageBucket.consume(1);
+    byteBucket.consume(static_cast<double>(bytes));
+    return true;
+}
@@ -0,0 +1,42 @@
+#ifndef RATELIMITER_H
+#define RATELIMITER_H
+
+#include <cstdint>
+#include <cstddef>
+
+// Classic token bucket: tokens accrue at 'rate' per second up to 'burst'.
+// Time is passed in by the caller (the server's cached loop timestamp), so
+// accounting is a handful of arithmetic operations and never a syscall.
+// A rate of 0 means unlimited.
+class TokenBucket {
+public:
+    TokenBucket();
+    TokenBucket(double rate, double burst);
+
+    bool isLimited() const;
+    bool hasTokens(double amount, uint64_t nowMillis);
+    void consume(double amount);
+
+private:
+    double rate;
+    double burst;
+    double tokens;
+    uint64_t lastRefillMillis;
+
+    void refill(uint64_t nowMillis);
+};
+
+// A message-rate and a byte-rate bucket that have to agree before a message passes.
+class RateLimiter {
+public:
+    void configure(double messagesPerSecond, double messageBurst, double bytesPerSecond, double byteBurst);
+
+    // Takes one message of 'bytes' bytes out of both buckets if both have room for it.
+    bool allow(size_t bytes, uint64_t nowMillis);
+
+private:
+    TokenBucket messageBucket;
+    TokenBucket byteBucket;
+};
+
+#endif // RATELIMITER_H
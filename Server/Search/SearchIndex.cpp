@@ -0,0 +1,208 @@
+#include "SearchIndex.h"
+#include <algorithm>
+#include <queue>
+#include <functional>
+#include <utility>
+
+const size_t SearchIndex::MAX_TERM_LENGTH;
+
+void PostingList::append(uint64_t number) {
+    if (count == 0) {
+        first = last = number;
+        deltas.clear();
+        offset = 0;
+        count = 1;
+        return;
+    }
+    uint64_t delta = number - last;
+    while (delta >= 0x80) {
+        deltas.push_back(static_cast<char>((delta & 0x7F) | 0x80));
+        delta >>= 7;
+    }
+    deltas.push_back(static_cast<char>(delta));
+    last = number;
+    count++;
+}
+
+void PostingList::popFront() {
+    if (count <= 1) {
+        count = 0;
+        deltas.clear();
+        offset = 0;
+        return;
+    }
+    uint64_t delta = 0;
+    int shift = 0;
+    unsigned char byte;
+    do {
+        byte = static_cast<unsigned char>(deltas[offset++]);
+        delta |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    first += delta;
+    count--;
+
+    // Give the consumed front back once it outweighs the live part
+    if (offset >= 64 && offset * 2 >= deltas.size()) {
+        deltas.erase(0, offset);
+        offset = 0;
+    }
+}
+
+PostingList PostingList::compactCopy() const {
+    PostingList copy;
+    copy.first = first;
+    copy.last = last;
+    copy.count = count;
+    copy.deltas.assign(deltas, offset, std::string::npos);
+    return copy;
+}
+
+void PostingList::decode(std::vector<uint64_t>& numbers) const {
+    numbers.clear();
+    if (count == 0) {
+        return;
+    }
+    numbers.reserve(count);
+    uint64_t number = first;
+    numbers.push_back(number);
+    size_t position = offset;
+    while (position < deltas.size()) {
+        uint64_t delta = 0;
+        int shift = 0;
+        unsigned char byte;
+        do {
+            byte = static_cast<unsigned char>(deltas[position++]);
+            delta |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            shift += 7;
+        } while ((byte & 0x80) && position < deltas.size());
+        number += delta;
+        numbers.push_back(number);
+    }
+}
+
+void SearchIndex::tokenize(const std::string& text, std::vector<std::string>& terms) {
+    terms.resize(tokenizeInto(text, terms));
+}
+
+size_t SearchIndex::tokenizeInto(const std::string& text, std::vector<std::string>& terms) {
+    size_t count = 0;
+    bool inTerm = false;
+    for (size_t i = 0; i <= text.length(); i++) {
+        char c = i < text.length() ? text[i] : ' ';
+        bool isWordChar = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9');
+        if (isWordChar) {
+            if (!inTerm) {
+                if (count == terms.size()) {
+                    terms.emplace_back();
+                    terms.back().reserve(MAX_TERM_LENGTH); // Never grows after that
+                }
+                terms[count].clear();
+                inTerm = true;
+            }
+            std::string& term = terms[count];
+            if (term.length() < MAX_TERM_LENGTH) {
+                term.push_back(c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c);
+            }
+        } else if (inTerm) {
+            // A message counts once per term, however often it repeats the term
+            auto end = terms.begin() + static_cast<std::ptrdiff_t>(count);
+            if (std::find(terms.begin(), end, terms[count]) == end) {
+                count++;
+            }
+            inTerm = false;
+        }
+    }
+    return count;
+}
+
+void SearchIndex::collectTerms(const std::string& text) {
+    messageTermCount = tokenizeInto(text, messageTerms);
+}
+
+void SearchIndex::addMessage(const std::string& text, uint64_t number) {
+    collectTerms(text);
+    for (size_t i = 0; i < messageTermCount; i++) {
+        postings[messageTerms[i]].append(number);
+    }
+}
+
+void SearchIndex::removeMessage(const std::string& text, uint64_t number) {
+    collectTerms(text);
+    for (size_t i = 0; i < messageTermCount; i++) {
+        auto it = postings.find(messageTerms[i]);
+        if (it == postings.end() || it->second.count == 0 || it->second.first != number) {
+            continue;
+        }
+        it->second.popFront();
+        if (it->second.count == 0) {
+            postings.erase(it);
+        }
+    }
+}
+
+void SearchIndex::clear() {
+    postings.clear();
+}
+
+bool SearchIndex::copyPostings(const std::string& term, PostingList& list) const {
+    auto it = postings.find(term);
+    if (it == postings.end()) {
+        return false;
+    }
+    list = it->second.compactCopy();
+    return true;
+}
+
+size_t SearchIndex::getTermCount() const {
+    return postings.size();
+}
+
+size_t rankMatches(const std::vector<PostingList>& lists, size_t limit, std::vector<uint64_t>& numbers) {
+    numbers.clear();
+    std::vector<std::vector<uint64_t>> decoded(lists.size());
+    for (size_t i = 0; i < lists.size(); i++) {
+        lists[i].decode(decoded[i]);
+    }
+
+    // Merge the sorted lists, keeping the best 'limit' messages in a min-heap
+    typedef std::pair<size_t, uint64_t> Match; // (terms matched, message number)
+    std::priority_queue<Match, std::vector<Match>, std::greater<Match>> best;
+    std::vector<size_t> cursors(lists.size(), 0);
+    size_t matchCount = 0;
+    while (true) {
+        uint64_t next = UINT64_MAX;
+        for (size_t i = 0; i < decoded.size(); i++) {
+            if (cursors[i] < decoded[i].size()) {
+                next = std::min(next, decoded[i][cursors[i]]);
+            }
+        }
+        if (next == UINT64_MAX) {
+            break;
+        }
+
+        size_t termsMatched = 0;
+        for (size_t i = 0; i < decoded.size(); i++) {
+            if (cursors[i] < decoded[i].size() && decoded[i][cursors[i]] == next) {
+                termsMatched++;
+                cursors[i]++;
+            }
+        }
+        matchCount++;
+
+        Match match(termsMatched, next);
+        if (best.size() < limit) {
+            best.push(match);
+        } else if (limit > 0 && best.top() < match) {
+            best.pop();
+            best.push(match);
+        }
+    }
+
+    while (!best.empty()) {
+        numbers.push_back(best.top().second);
+        best.pop();
+    }
+    std::reverse(numbers.begin(), numbers.end());
+    return matchCount;
+}
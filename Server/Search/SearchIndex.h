@@ -0,0 +1,71 @@
+#ifndef SEARCHINDEX_H
+#define SEARCHINDEX_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <cstddef>
+
+// The numbers of the messages that contain one term, oldest first. The first number
+// is kept as is and the others as varint deltas to their predecessor, so a posting
+// usually takes a single byte. Postings are only ever appended at the end and
+// dropped at the front, in the order the history ring adds and evicts messages.
+struct PostingList {
+    uint64_t first = 0;  // Number of the oldest message
+    uint64_t last = 0;   // Number of the newest message, the next delta is relative to it
+    uint32_t count = 0;
+    size_t offset = 0;   // Start of the delta of the second posting in 'deltas'
+    std::string deltas;
+
+    void append(uint64_t number);
+    void popFront();
+
+    // Copy holding only the live part of 'deltas'
+    PostingList compactCopy() const;
+
+    // Decodes the postings in order, 'numbers' is overwritten.
+    void decode(std::vector<uint64_t>& numbers) const;
+};
+
+// Inverted index over the history of one chatroom. Messages are numbered in the order
+// they were added; the index covers exactly the messages the room still retains.
+class SearchIndex {
+public:
+    // Terms are runs of ASCII letters and digits, folded to lower case.
+    static void tokenize(const std::string& text, std::vector<std::string>& terms);
+
+    // Like tokenize(), but fills 'terms' from the front and returns how many there are.
+    // The strings behind them are left alone, so a reused vector allocates nothing.
+    static size_t tokenizeInto(const std::string& text, std::vector<std::string>& terms);
+
+    void addMessage(const std::string& text, uint64_t number);
+
+    // 'number' must be the oldest indexed message.
+    void removeMessage(const std::string& text, uint64_t number);
+
+    void clear();
+
+    // Copies the posting list of 'term' into 'list'. Returns false if no retained
+    // message contains the term.
+    bool copyPostings(const std::string& term, PostingList& list) const;
+
+    size_t getTermCount() const;
+
+private:
+    static const size_t MAX_TERM_LENGTH = 64;
+
+    std::unordered_map<std::string, PostingList> postings;
+    std::vector<std::string> messageTerms; // Scratch, reused for every message
+    size_t messageTermCount = 0;           // Terms of the current message in it
+
+    void collectTerms(const std::string& text);
+};
+
+// Ranks the messages of a room against the posting lists of the query terms: the
+// more distinct terms a message contains the better, newer messages win ties.
+// Fills 'numbers' with at most 'limit' message numbers, best first, and returns
+// how many messages matched at least one term.
+size_t rankMatches(const std::vector<PostingList>& lists, size_t limit, std::vector<uint64_t>& numbers);
+
+#endif // SEARCHINDEX_H
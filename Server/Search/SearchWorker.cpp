@@ -0,0 +1,88 @@
+#include "SearchWorker.h"
+#include <iostream>
+#include <sys/eventfd.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+SearchWorker::SearchWorker() : event_fd(-1), stopping(false) {}
+
+SearchWorker::~SearchWorker() {
+    if (worker.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        queryReady.notify_one();
+        worker.join();
+    }
+    if (event_fd != -1) {
+        close(event_fd);
+    }
+}
+
+bool SearchWorker::start() {
+    event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (event_fd == -1) {
+        std::cerr << "Error creating search eventfd: " << strerror(errno) << std::endl;
+        return false;
+    }
+    worker = std::thread(&SearchWorker::workerLoop, this);
+    return true;
+}
+
+int SearchWorker::getEventFd() const {
+    return event_fd;
+}
+
+void SearchWorker::submit(SearchQuery&& query) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queries.push_back(std::move(query));
+    }
+    queryReady.notify_one();
+}
+
+void SearchWorker::collect(std::vector<SearchResult>& finished) {
+    uint64_t counter;
+    if (read(event_fd, &counter, sizeof(counter)) == -1 && errno != EAGAIN) {
+        std::cerr << "Error reading search eventfd: " << strerror(errno) << std::endl;
+    }
+    finished.clear();
+    std::lock_guard<std::mutex> lock(mutex);
+    finished.swap(results);
+}
+
+void SearchWorker::workerLoop() {
+    std::vector<SearchQuery> batch;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        queryReady.wait(lock, [this] { return stopping || !queries.empty(); });
+        if (stopping) {
+            return;
+        }
+        batch.swap(queries);
+        lock.unlock();
+
+        std::vector<SearchResult> ranked;
+        for (SearchQuery& query : batch) {
+            SearchResult result;
+            result.clientSocket = query.clientSocket;
+            result.username = std::move(query.username);
+            result.chatroomName = std::move(query.chatroomName);
+            result.text = std::move(query.text);
+            result.matchCount = rankMatches(query.lists, query.limit, result.numbers);
+            ranked.push_back(std::move(result));
+        }
+        batch.clear();
+
+        lock.lock();
+        for (SearchResult& result : ranked) {
+            results.push_back(std::move(result));
+        }
+        uint64_t one = 1;
+        if (write(event_fd, &one, sizeof(one)) == -1) {
+            std::cerr << "Error signalling search results: " << strerror(errno) << std::endl;
+        }
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef SEARCHWORKER_H
+#define SEARCHWORKER_H
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "SearchIndex.h"
+
+struct SearchQuery {
+    int clientSocket;
+    std::string username;  // Tells a reused socket number apart from the client that asked
+    std::string chatroomName;
+    std::string text;
+    std::vector<PostingList> lists; // Copies of the postings of the query terms
+    size_t limit;
+};
+
+struct SearchResult {
+    int clientSocket;
+    std::string username;
+    std::string chatroomName;
+    std::string text;
+    size_t matchCount;
+    std::vector<uint64_t> numbers; // Best matches first
+};
+
+// Ranks queries on a thread of its own, so a search over a huge room never stalls the
+// event loop. A query carries copies of the posting lists it needs and touches no
+// server state. Finished results are announced on an eventfd the event loop watches.
+class SearchWorker {
+public:
+    SearchWorker();
+    ~SearchWorker();
+
+    bool start();
+    int getEventFd() const;
+
+    void submit(SearchQuery&& query);
+
+    // Moves the finished results into 'results'.
+    void collect(std::vector<SearchResult>& results);
+
+private:
+    int event_fd;
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable queryReady;
+    bool stopping;
+    std::vector<SearchQuery> queries;
+    std::vector<SearchResult> results;
+
+    void workerLoop();
+};
+
+#endif // SEARCHWORKER_H
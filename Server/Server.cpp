@@ -7,36 +7,88 @@
 #include <string.h>
 #include <unistd.h>
 #include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <time.h>
 #include <unordered_map>
+#include <tuple>
+#include <utility>
 #include <sstream>
 #include <set>
 #include <atomic>
 #include <csignal>
+#include <algorithm>
+#include <thread>
+#include <random>
+#include <cstdlib>
 #include "Chatroom/Chatroom.h"
+#include "Handoff/Handoff.h"
+#include "Federation/PeerLink.h"
 #include "../common/Message.h"
-#include <thread>
 
-
-Server::Server(const std::string& ip, int port) : ip(ip), port(port), server_fd(-1), epoll_fd(-1) {
+const size_t Server::MAX_PEER_PRESENCE_NAMES;
+const size_t Server::MAX_PEER_BACKLOG;
+const uint64_t Server::FULL_HISTORY;
+const size_t Server::CHAT_FRAME_OVERHEAD;
+const uint64_t Server::DOWNLOAD_CHUNK_SIZE;
+const uint64_t Server::DOWNLOAD_BYTES_PER_EVENT;
+const size_t Server::LOG_IOV_BATCH;
+const size_t Server::MAX_TRANSPORT_EVENTS;
+
+
+Server::Server(const std::string& ip, int port, const ServerConfig& config, Transport* transport)
+    : ip(ip), port(port), config(config), transport(transport != nullptr ? transport : &tcpTransport), epoll_fd(-1), timer_fd(-1), handoff_fd(-1),
+      federation_fd(-1), handedOff(false), nowMillis(monotonicMillis()),
+      timingWheel(config.timerSlots, config.timerTickMillis), fanoutPool(fanoutThreadCount(config.fanoutThreads)),
+      lappedMembers(0) {
     std::cout << "Initializing server..." << std::endl;
 }
 
 
 Server::~Server() {
-    if (server_fd != -1) {
+    if (tcpTransport.getListenFd() != -1) {
         std::cout << "Closing server socket..." << std::endl;
-        close(server_fd);
+        tcpTransport.stopListening();
     }
     if (epoll_fd != -1) {
         std::cout << "Closing epoll file descriptor..." << std::endl;
         close(epoll_fd);
     }
+    if (timer_fd != -1) {
+        close(timer_fd);
+    }
+    if (handoff_fd != -1) {
+        close(handoff_fd);
+        unlink(config.handoffSocketPath.c_str());
+    }
+    if (federation_fd != -1) {
+        close(federation_fd);
+    }
 }
 
 
 bool Server::init() {
     std::cout << "Starting server initialization..." << std::endl;
-    if (!createServerSocket()) {
+    int handoffChannel = -1;
+    // Before a takeover, which restores the attachments of the predecessor
+    if (!attachments.init(config.attachmentDirectory, static_cast<size_t>(config.maxAttachments))) {
+        std::cerr << "Failed to prepare the attachment directory." << std::endl;
+        return false;
+    }
+    if (transport != &tcpTransport && (config.takeover || !config.handoffSocketPath.empty())) {
+        std::cerr << "Handoffs pass TCP sockets, they need the TCP transport." << std::endl;
+        return false;
+    }
+    if (config.takeover) {
+        if (!takeOver(handoffChannel)) {
+            std::cerr << "Failed to take over from the running server." << std::endl;
+            return false;
+        }
+    } else if (!transport->listen(ip, port)) {
         std::cerr << "Failed to create server socket." << std::endl;
         return false;
     }
@@ -44,74 +96,156 @@ bool Server::init() {
         std::cerr << "Failed to initialize epoll." << std::endl;
         return false;
     }
+    if (!initTimer()) {
+        std::cerr << "Failed to initialize the connection timers." << std::endl;
+        return false;
+    }
+    if (!initSearch()) {
+        std::cerr << "Failed to start the search worker." << std::endl;
+        return false;
+    }
+    if (!config.capturePath.empty()) {
+        if (!capture.open(config.capturePath)) {
+            std::cerr << "Failed to open the capture file " << config.capturePath << ": " << strerror(errno) << std::endl;
+            return false;
+        }
+        std::cout << "Capturing client traffic to " << config.capturePath << std::endl;
+    }
+    tracer.setSampleInterval(static_cast<uint32_t>(std::max(config.traceSampleInterval, 0)));
     std::cout << "Server initialization successful." << std::endl;
 
-    // Use the createChatroom method to initialize the default chatroom
-    createChatroom("defaultChat");
-    std::cout << "Default chatroom created." << std::endl;
+    if (config.takeover) {
+        if (!registerRestoredClients()) {
+            close(handoffChannel);
+            return false;
+        }
+    } else {
+        // Use the createChatroom method to initialize the default chatroom
+        createChatroom("defaultChat");
+        std::cout << "Default chatroom created." << std::endl;
+    }
+
+    if (isFederated() && !initFederation()) {
+        std::cerr << "Failed to set up federation." << std::endl;
+        close(handoffChannel);
+        return false;
+    }
+
+    if (!config.handoffSocketPath.empty() && !initHandoff()) {
+        std::cerr << "Failed to open the handoff socket." << std::endl;
+        close(handoffChannel);
+        return false;
+    }
+
+    if (handoffChannel != -1) {
+        // Tell the previous server that we own the connections now, so it can exit. It
+        // confirms, unless it gave up waiting for us and serves them again.
+        char ack = 'A';
+        char confirmation = 0;
+        if (send(handoffChannel, &ack, 1, MSG_NOSIGNAL) != 1 || recv(handoffChannel, &confirmation, 1, 0) != 1 ||
+            confirmation != 'C') {
+            std::cerr << "The previous server kept its connections." << std::endl;
+            close(handoffChannel);
+            if (handoff_fd != -1) {
+                close(handoff_fd); // The path is the previous server's again, it stays
+                handoff_fd = -1;
+            }
+            return false;
+        }
+        close(handoffChannel);
+        std::cout << "Takeover complete." << std::endl;
+    }
 
     return true;
 }
 
 
-bool Server::createServerSocket() {
-    std::cout << "Creating server socket..." << std::endl;
-    server_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_fd == -1) {
-        std::cerr << "Error creating a socket" << std::endl;
+bool Server::initEpoll() {
+    std::cout << "Initializing epoll..." << std::endl;
+    epoll_fd = epoll_create1(0);
+    if (epoll_fd == -1) {
+        std::cerr << "Error creating epoll instance" << std::endl;
         return false;
     }
 
-    // Set SO_REUSEADDR to ensure the port is freed immediately after server shutdown
-    int opt = 1;
-    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1) {
-        std::cerr << "Error setting SO_REUSEADDR" << std::endl;
+    if (!transport->attach(epoll_fd)) {
+        std::cerr << "Error adding socket to epoll" << std::endl;
         return false;
     }
+    std::cout << "Epoll instance created and configured." << std::endl;
+    return true;
+}
 
-    sockaddr_in server_address;
-    server_address.sin_family = AF_INET;
-    server_address.sin_port = htons(port);
-    inet_pton(AF_INET, ip.c_str(), &server_address.sin_addr);
 
-    if (bind(server_fd, (sockaddr*)&server_address, sizeof(server_address)) == -1) {
-        std::cerr << "Error binding to IP/port" << std::endl;
+bool Server::initTimer() {
+    // A periodic timerfd drives the timing wheel from inside the epoll loop
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd == -1) {
+        std::cerr << "Error creating timerfd: " << strerror(errno) << std::endl;
         return false;
     }
 
-    if (listen(server_fd, SOMAXCONN) == -1) {
-        std::cerr << "Error listening" << std::endl;
+    struct itimerspec spec;
+    spec.it_interval.tv_sec = timingWheel.getTickMillis() / 1000;
+    spec.it_interval.tv_nsec = (timingWheel.getTickMillis() % 1000) * 1000000L;
+    spec.it_value = spec.it_interval;
+    if (timerfd_settime(timer_fd, 0, &spec, nullptr) == -1) {
+        std::cerr << "Error arming timerfd: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = timer_fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &event) == -1) {
+        std::cerr << "Error adding timerfd to epoll" << std::endl;
         return false;
     }
-    std::cout << "Socket created and listening on IP: " << ip << ", Port: " << port << std::endl;
+    std::cout << "Connection timers armed with a " << timingWheel.getTickMillis() << "ms tick." << std::endl;
     return true;
 }
 
 
-bool Server::initEpoll() {
-    std::cout << "Initializing epoll..." << std::endl;
-    epoll_fd = epoll_create1(0);
-    if (epoll_fd == -1) {
-        std::cerr << "Error creating epoll instance" << std::endl;
+bool Server::initSearch() {
+    if (!searchWorker.start()) {
         return false;
     }
-
     struct epoll_event event;
     event.events = EPOLLIN;
-    event.data.fd = server_fd;
-
-    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_fd, &event) == -1) {
-        std::cerr << "Error adding socket to epoll" << std::endl;
+    event.data.fd = searchWorker.getEventFd();
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, searchWorker.getEventFd(), &event) == -1) {
+        std::cerr << "Error adding search eventfd to epoll" << std::endl;
         return false;
     }
-    std::cout << "Epoll instance created and configured." << std::endl;
     return true;
 }
 
+
+uint64_t Server::monotonicMillis() {
+    // clock_gettime(CLOCK_MONOTONIC) is served by the vDSO and doesn't enter the kernel
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000 + static_cast<uint64_t>(ts.tv_nsec) / 1000000;
+}
+
+size_t Server::fanoutThreadCount(int configured) {
+    if (configured >= 0) {
+        return static_cast<size_t>(configured);
+    }
+    unsigned int cores = std::thread::hardware_concurrency();
+    return cores > 1 ? cores - 1 : 0;
+}
+
 // Global variable 'running' to manage server state. It's global because signal handlers, 
 // used with signal() calls, cannot access non-static class members.
 std::atomic<bool> running(true);
 
+// Set by SIGUSR1 to ask the event loop to print its counters.
+std::atomic<bool> statsRequested(false);
+
+// Set by SIGUSR2 to ask the event loop to export the latency trace.
+std::atomic<bool> traceExportRequested(false);
+
 // Signal handler 'signalHandler' for graceful shutdown. It's global to modify 'running' 
 // and to be compatible with signal() system call requirements.
 void signalHandler(int signum) {
@@ -119,6 +253,14 @@ void signalHandler(int signum) {
     running = false;
 }
 
+void statsSignalHandler(int) {
+    statsRequested = true;
+}
+
+void traceSignalHandler(int) {
+    traceExportRequested = true;
+}
+
 
 void Server::run() {
     std::cout << "Server is now running..." << std::endl;
@@ -127,11 +269,22 @@ void Server::run() {
 
     // Set up signal handler for graceful shutdown
     signal(SIGINT, signalHandler);
+    signal(SIGUSR1, statsSignalHandler);
+    signal(SIGUSR2, traceSignalHandler);
 
-    while (running) {
+    while (running && !handedOff) {
         int num_events = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
         if (num_events == -1) {
             if (errno == EINTR) {
+                if (statsRequested.exchange(false)) {
+                    logStats();
+                }
+                if (traceExportRequested.exchange(false)) {
+                    exportTrace();
+                }
+                if (running) {
+                    continue; // Interrupted by a signal that doesn't stop the server
+                }
                 std::cout << "Server stopping due to interrupt." << std::endl;
                 break; // Interrupted by signal
             }
@@ -139,385 +292,2791 @@ void Server::run() {
             continue; // Or handle the error as appropriate
         }
 
-        for (int i = 0; i < num_events; i++) {
-            if (events[i].data.fd == server_fd) {
-               // Create a new thread to handle the new connection
-                std::thread([this] { this->handleNewConnection(); }).detach();
+        nowMillis = monotonicMillis();
+        for (int i = 0; i < num_events && !handedOff; i++) {
+            if (events[i].data.fd == transport->getEventFd()) {
+                handleTransportEvents();
+            } else if (events[i].data.fd == timer_fd) {
+                handleTimerTick();
+            } else if (events[i].data.fd == handoff_fd) {
+                handleHandoffRequest();
+            } else if (events[i].data.fd == searchWorker.getEventFd()) {
+                handleSearchResults();
+            } else if (events[i].data.fd == federation_fd) {
+                handleNewPeer();
+            } else if (!peerLinks.empty() && peerLinks.count(events[i].data.fd) != 0) {
+                handlePeerEvent(events[i].data.fd, events[i].events);
             } else {
-                handleClientData(events[i].data.fd);
+                if (events[i].events & EPOLLOUT) {
+                    handleClientWritable(events[i].data.fd);
+                }
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                    handleClientData(events[i].data.fd);
+                }
             }
         }
-    }
-
-    closeAllConnections();
-    std::cout << "Server shutdown complete." << std::endl;
-}
 
+        // Everything this batch of events broadcast goes out in one write per member
+        if (!dirtyRooms.empty() && !handedOff) {
+            serveRoomLogs();
+        }
+    }
 
-void Server::handleNewConnection() {
-    sockaddr_in client_addr;
-    socklen_t client_len = sizeof(client_addr);
-    int client_socket = accept(server_fd, (sockaddr*)&client_addr, &client_len);
+    if (tracer.isEnabled()) {
+        exportTrace();
+    }
 
-    if (client_socket == -1) {
-        std::cerr << "Error accepting new connection: " << strerror(errno) << std::endl;
+    if (handedOff) {
+        // The successor holds its own references to every socket, closing ours doesn't
+        // end any connection
+        closeAllConnections();
+        std::cout << "Server handed off to its successor." << std::endl;
         return;
     }
 
-    std::cout << "New client connected: Socket FD " << client_socket << std::endl;
-    handleUsernameRequest(client_socket);
-    std::cout << "Handled username request " << client_socket << std::endl;
-    struct epoll_event client_event;
-    client_event.events = EPOLLIN;
-    client_event.data.fd = client_socket;
-    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_socket, &client_event) == -1) {
-        std::cerr << "Error adding client socket to epoll: " << strerror(errno) << std::endl;
-        close(client_socket); // Ensure the socket is closed on error
-    }
+    closeAllConnections();
+    std::cout << "Server shutdown complete." << std::endl;
 }
 
 
-void Server::handleUsernameRequest(int client_socket) {
-    sendWelcomeMessage(client_socket);
-    char buffer[1024];
-    int bytesRead = recv(client_socket, buffer, sizeof(buffer), 0);
-    std::cout << "Handling username request for client: Socket FD " << client_socket << std::endl;
-
-    if (bytesRead > 0) {
-        buffer[bytesRead] = '\0';
-        std::string msg(buffer);
-        Message usernameMessage = Message::deserialize(msg);
-        std::string username = usernameMessage.getBody();
-        std::cout << "Received username: " << username << " from client: Socket FD " << client_socket << std::endl;
-
-        if (username.length() > 25) {
-            sendMessage(client_socket, Message(MessageType::QUIT, "Username too long. Please reconnect with a shorter username."));
-        } else if (!isUsernameAvailable(username)) {
-            sendMessage(client_socket, Message(MessageType::QUIT, "Username taken. Please reconnect with a different username."));
-        } else {
-            // If the username is valid and available, proceed to assign it to the client
-            ClientInfo newClient;
-            newClient.username = username;
-            newClient.socketNum = client_socket;
-            clientUsernames[client_socket] = newClient;
-            std::cout << "Username '" << username << "' is valid and assigned to client: Socket FD " << client_socket << std::endl;
-
-            // Display the chat menu for the client
-            displayMenu(client_socket);
-            return; // Continue with the normal flow
-        }
-    } else {
-        if (bytesRead == -1) {
-            std::cerr << "Error receiving username from client: Socket FD " << client_socket << ". Error: " << strerror(errno) << std::endl;
-        } else {
-            std::cerr << "Client: Socket FD " << client_socket << " closed the connection." << std::endl;
-        }
-    }
-    
-    // Close the connection if the username is invalid or if an error occurred
-    close(client_socket);
+// For a server run on another thread: run() returns once the event loop wakes up next,
+// with a loopback transport after the driver's next flush().
+void Server::stop() {
+    running = false;
 }
 
 
-void Server::closeAllConnections() {
-    // Close all client sockets and clean up resources
-    for (auto& pair : clientUsernames) {
-        close(pair.first); // Close each client socket
+// Connections of a transport that doesn't register them with epoll itself are
+// reported here as well.
+void Server::handleTransportEvents() {
+    TransportEvent transportEvents[MAX_TRANSPORT_EVENTS];
+    size_t count = transport->poll(transportEvents, MAX_TRANSPORT_EVENTS);
+    for (size_t i = 0; i < count && !handedOff; i++) {
+        switch (transportEvents[i].kind) {
+            case TransportEventKind::ACCEPTED:
+                handleNewConnection(transportEvents[i].connection);
+                break;
+            case TransportEventKind::READABLE:
+                handleClientData(transportEvents[i].connection);
+                break;
+            case TransportEventKind::WRITABLE:
+                handleClientWritable(transportEvents[i].connection);
+                break;
+        }
     }
-    close(server_fd);  // Close the server socket
-    close(epoll_fd);   // Close the epoll file descriptor
 }
 
 
-void Server::sendWelcomeMessage(int client_socket) {
-    Message welcomeMessage(MessageType::POST, "Welcome to the chat server!\nPlease enter username:");
-    sendMessage(client_socket, welcomeMessage);
-    std::cout << "Welcome message sent to client: Socket FD " << client_socket << std::endl;
-}
-
+void Server::handleNewConnection(int client_socket) {
+    std::cout << "New client connected: Socket FD " << client_socket << std::endl;
 
-void Server::createChatroom(const std::string& name, const std::set<std::string>& forbiddenWords) {
-    Chatroom newChatroom(name, forbiddenWords);
-    std::string welcomeMessage = "\n[Server]: Welcome to the chatroom '" + name + "'.\nYou can send messages to the chat now.\nType '/leave' to exit the chatroom.";
-    newChatroom.addMessage(welcomeMessage);
-    chatrooms[name] = newChatroom;
-    std::cout << "Chatroom '" << name << "' created successfully with welcome message." << std::endl;
+    // The username arrives as a LOGIN message through the event loop, the login timer
+    // closes connections that never send one
+    ClientInfo& newClient = clientUsernames.create(client_socket);
+    newClient.socketNum = client_socket;
+    newClient.lastActivityMillis = nowMillis;
+    newClient.connectionId = nextConnectionId++;
+    if (capture.isOpen()) {
+        capture.record(TraceRecordKind::CONNECT, newClient.connectionId);
+    }
+    scheduleTimer(newClient, static_cast<uint64_t>(config.loginTimeoutSeconds) * 1000, LOGIN_TIMER);
+    sendWelcomeMessage(client_socket);
 }
 
 
-void Server::handleClientData(int client_socket) {
-    char buffer[4096];
-    int bytesRead = recv(client_socket, buffer, sizeof(buffer), 0);
+void Server::processLoginMessage(int client_socket, const Message& message) {
+    ClientInfo* found = clientUsernames.find(client_socket);
+    if (found == nullptr) {
+        return;
+    }
+    ClientInfo& client = *found;
+    std::string username = message.getBody();
+    std::cout << "Received username: " << username << " from client: Socket FD " << client_socket << std::endl;
+
+    if (username.length() > ClientInfo::MAX_USERNAME_LENGTH) {
+        sendMessage(client_socket, Message(MessageType::QUIT, "Username too long. Please reconnect with a shorter username."));
+    } else if (!isUsernameAvailable(username)) {
+        sendMessage(client_socket, Message(MessageType::QUIT, "Username taken. Please reconnect with a different username."));
+    } else {
+        // If the username is valid and available, proceed to assign it to the client
+        completeLogin(client_socket, username);
+        client.resumeToken = newResumeToken();
+        sendMessage(client_socket, Message(MessageType::RESUME, client.resumeToken.str()));
+        std::cout << "Username '" << username << "' is valid and assigned to client: Socket FD " << client_socket << std::endl;
 
-    if (bytesRead <= 0) {
-        // Client disconnected
-        std::cout << "Client disconnected: Socket FD " << client_socket << std::endl;
+        // Display the chat menu for the client
+        displayMenu(client_socket);
+        return; // Continue with the normal flow
+    }
 
-        // Remove client from chatroom and update chatroom mappings
-        handleClientDisconnect(client_socket); 
+    // Close the connection if the username is invalid
+    closeClientConnection(client_socket);
+}
 
-        // Close the socket and remove from epoll monitoring
-        close(client_socket);
-        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client_socket, nullptr);
 
-        // Remove client information
-        clientUsernames.erase(client_socket);
-        leaveChatroom(client_socket);
+void Server::completeLogin(int client_socket, const std::string& username) {
+    ClientInfo* found = clientUsernames.find(client_socket);
+    if (found == nullptr) {
         return;
     }
-
-    buffer[bytesRead] = '\0';
-    std::string message(buffer);
-    processClientMessage(client_socket, message);
+    ClientInfo& client = *found;
+    client.username = username;
+    client.loggedIn = true;
+    loggedInUsernames.insert(username);
+    client.lastChatActivityMillis = nowMillis;
+    client.rateLimiter.configure(config.clientMessagesPerSecond, config.clientMessageBurst,
+                                 config.clientBytesPerSecond, config.clientByteBurst);
+    scheduleHeartbeat(client);
 }
 
 
-void Server::displayMenu(int client_socket) {
-    std::stringstream menu;
-    // Greeting with username
-    menu << "Hello " << clientUsernames[client_socket].username << "!\n";
-    // Note about quitting
-    menu << "At any time, use /quit to exit the chat server.\n\n";
-
-    // Displaying available chatrooms
-    menu << "Available chatrooms:\n";
-    for (const auto& pair : chatrooms) {
-        menu << "---- " << pair.first << "\n"; // Chatroom name
+// RESUME
+void Server::processResumeMessage(int client_socket, const Message& message) {
+    // "token;room;next sequence;room;next sequence..."
+    std::istringstream fields(message.getBody());
+    std::string token, room, sequence;
+    std::getline(fields, token, ';');
+    std::unordered_map<std::string, uint64_t> nextSequences;
+    while (std::getline(fields, room, ';') && std::getline(fields, sequence, ';')) {
+        nextSequences[room] = strtoull(sequence.c_str(), nullptr, 10);
     }
 
-    // Instructions for joining and creating chatrooms
-    menu << "\nTo enter a chatroom, type its name and press Enter.\n";
-    menu << "To create a new chatroom, use the command:\n\t /create [chatroom name];[forbidden words]\n";
-    menu << "\nExample: /create myRoom;word1,word2\n";
+    auto it = detachedSessions.find(token);
+    if (it == detachedSessions.end() || it->second.expiresMillis <= nowMillis) {
+        sendMessage(client_socket, Message(MessageType::QUIT, "Your session expired. Please reconnect and log in again."));
+        closeClientConnection(client_socket);
+        return;
+    }
+    DetachedSession session = std::move(it->second);
+    detachedSessions.erase(it);
+    detachedUsernames.erase(session.username);
 
-    
-    // Send the formatted menu to the client
-    Message menuMessage(MessageType::MENU, menu.str());
-    sendMessage(client_socket, menuMessage);
-    std::cout << "Menu displayed to client: Socket FD " << client_socket << std::endl;
+    completeLogin(client_socket, session.username);
+    ClientInfo* client = clientUsernames.find(client_socket);
+    if (client == nullptr) {
+        return;
+    }
+    client->resumeToken = token;
+    sendMessage(client_socket, Message(MessageType::RESUME, token));
+    std::cout << "Session of '" << session.username << "' resumed on Socket FD " << client_socket << std::endl;
+
+    // The room the client posted to is joined last, which makes it the active one again
+    for (const std::string& name : session.chatroomNames) {
+        if (chatrooms.find(name) == chatrooms.end()) {
+            continue;
+        }
+        // Within the presence window this cancels out the leave of the dropped connection
+        recordPresence(chatrooms[name], session.username, true);
+        auto sequence = nextSequences.find(name);
+        joinChatroom(client_socket, name, sequence != nextSequences.end() ? sequence->second : FULL_HISTORY);
+    }
+    if (client->activeChatroom == RoomSet::NONE) {
+        displayMenu(client_socket);
+    }
 }
 
 
-void Server::joinChatroom(int client_socket, const std::string& chatroomName) {
-    chatrooms[chatroomName].addClient(client_socket);
-    clientToChatroomMap[client_socket] = chatroomName;
-    std::cout << "Socket FD " << client_socket << " has joined room " << chatroomName << std::endl;
-
-    // Build the chat history as a single string
-    std::stringstream chatHistory;
-    for (const std::string& messageBody : chatrooms[chatroomName].getMessages()) {
-        chatHistory << messageBody << "\n";  // Add each message to the stream
+void Server::detachSession(ClientInfo& client) {
+    if (!client.loggedIn || client.resumeToken.empty() || config.resumeGraceSeconds <= 0) {
+        return;
     }
-
-    // Send the chat history as one POST message
-    if (!chatHistory.str().empty()) {
-        Message historyMessage(MessageType::JOIN, chatHistory.str());
-        sendMessage(client_socket, historyMessage);
+    std::string token = client.resumeToken.str();
+    DetachedSession& session = detachedSessions[token];
+    session.username = client.username.str();
+    session.chatroomNames.clear();
+    for (uint32_t id = client.chatrooms.next(0); id != RoomSet::NONE; id = client.chatrooms.next(id + 1)) {
+        if (id != client.activeChatroom) {
+            session.chatroomNames.push_back(chatroomsById[id]->getName());
+        }
+    }
+    if (client.activeChatroom != RoomSet::NONE) {
+        session.chatroomNames.push_back(chatroomsById[client.activeChatroom]->getName());
     }
+    session.expiresMillis = nowMillis + static_cast<uint64_t>(config.resumeGraceSeconds) * 1000;
+    detachedUsernames[session.username] = token;
+    detachedExpiry.emplace_back(session.expiresMillis, token);
 }
 
 
-void Server::broadcastMessage(const std::string& chatroomName, const Message& message) {
-    // Replace forbidden words
-    std::string modifiedMessageBody = chatrooms[chatroomName].censorMessage(message.getBody());
-
-    // Broadcast modified message
-    Message modifiedMessage(message.getType(), modifiedMessageBody);
-    for (int client_socket : chatrooms[chatroomName].getClients()) {
-        sendMessage(client_socket, modifiedMessage);
+void Server::expireDetachedSessions() {
+    // Every session gets the same grace period, so they expire in the order they were detached
+    while (!detachedExpiry.empty() && detachedExpiry.front().first <= nowMillis) {
+        auto it = detachedSessions.find(detachedExpiry.front().second);
+        // A session resumed and detached again has a later deadline further back in the queue
+        if (it != detachedSessions.end() && it->second.expiresMillis == detachedExpiry.front().first) {
+            detachedUsernames.erase(it->second.username);
+            detachedSessions.erase(it);
+        }
+        detachedExpiry.pop_front();
     }
-
-    // Add to chat history
-    chatrooms[chatroomName].addMessage(modifiedMessageBody);
 }
 
 
-void Server::sendMessage(int client_socket, const Message& message) {
-    std::string serializedMessage = message.serialize();
-    send(client_socket, serializedMessage.c_str(), serializedMessage.length(), 0);
+std::string Server::newResumeToken() {
+    // random_device reads the kernel's CSPRNG, tokens must not be guessable
+    static const char HEX_DIGITS[] = "0123456789abcdef";
+    std::random_device random;
+    std::string token;
+    for (int i = 0; i < 4; i++) {
+        uint32_t bits = random();
+        for (int j = 0; j < 8; j++) {
+            token.push_back(HEX_DIGITS[bits & 0xF]);
+            bits >>= 4;
+        }
+    }
+    return token;
 }
 
 
-void Server::processClientMessage(int client_socket, const std::string& serializedMessage) {
-    Message message = Message::deserialize(serializedMessage);
+void Server::handleTimerTick() {
+    uint64_t expirations = 0;
+    if (read(timer_fd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+        return;
+    }
 
-    std::cout << "Received message from client " << client_socket 
-              << ": Type=" << static_cast<int>(message.getType()) 
-              << ", Body=" << message.getBody() << std::endl;
+    // Catch up on every tick that elapsed, even if the loop was busy for a while
+    expiredTimers.clear();
+    for (uint64_t i = 0; i < expirations; i++) {
+        timingWheel.tick(expiredTimers);
+    }
+    for (const TimingWheel::Expired& timer : expiredTimers) {
+        handleExpiredTimer(timer);
+    }
+    expireDetachedSessions();
+    if (capture.isOpen()) {
+        capture.flush();
+    }
+}
 
 
-    switch (message.getType()) {
-        case MessageType::JOIN:
-            processJoinMessage(client_socket, message);
-            break;
-        case MessageType::CREATE:
-            processCreateChatroomMessage(client_socket, message);
-            break;
-        case MessageType::MENU:
-            processMenuMessage(client_socket, message);
-            break;
-        case MessageType::QUIT:
-            handleClientDisconnect(client_socket);
+void Server::handleExpiredTimer(const TimingWheel::Expired& timer) {
+    if (timer.kind == PEER_RECONNECT_TIMER) {
+        connectToPeer(timer.fd); // 'fd' holds the index of the configured peer
+        return;
+    }
+    if (timer.kind == PEER_HEARTBEAT_TIMER) {
+        auto link = peerLinks.find(timer.fd);
+        if (link != peerLinks.end() && link->second.timer == timer.id) {
+            checkPeerLink(link->second);
+        }
+        return;
+    }
+    if (timer.kind == PRESENCE_TIMER) {
+        flushPresence();
+        return;
+    }
+
+    ClientInfo* found = clientUsernames.find(timer.fd);
+    if (found == nullptr || found->timer != timer.id) {
+        return; // The connection is gone or the fd now belongs to someone else
+    }
+    ClientInfo& client = *found;
+    client.timer = TimingWheel::NO_TIMER;
+
+    switch (timer.kind) {
+        case LOGIN_TIMER:
+            std::cout << "Login timed out for client: Socket FD " << timer.fd << std::endl;
+            sendMessage(timer.fd, Message(MessageType::QUIT, "Login timed out. Please reconnect."));
+            closeClientConnection(timer.fd);
             break;
-        case MessageType::POST:
-            processPostMessage(client_socket, message);
+        case HEARTBEAT_TIMER:
+            checkHeartbeat(client);
             break;
-        default:
-            // Handle unknown message type
+        case PONG_TIMER:
+            if (client.awaitingPong) {
+                // The peer is gone without a FIN (half-open connection), reap it
+                std::cout << "Client " << timer.fd << " did not answer the heartbeat, reaping it." << std::endl;
+                handleClientDisconnect(timer.fd, true);
+            } else {
+                scheduleHeartbeat(client);
+            }
             break;
     }
 }
 
-// JOIN
-void Server::processJoinMessage(int client_socket, const Message& message) {
-    std::string chatroomName = message.getBody();
 
-    if (!findClientChatroom(client_socket).empty() && findClientChatroom(client_socket) != chatroomName) {
-        Message alreadyInMsg(MessageType::POST, "You are already in chatroom " + findClientChatroom(client_socket) + ". Please leave it first.");
-        sendMessage(client_socket, alreadyInMsg);
-    } else {
-        if (chatrooms.find(chatroomName) != chatrooms.end()) {
-            
-            std::string joinMsg = "[" + clientUsernames[client_socket].username + "] has joined " + chatroomName;
-            Message joinMessage(MessageType::POST, joinMsg);
-            broadcastMessage(chatroomName, joinMessage);
-            joinChatroom(client_socket, chatroomName);
+void Server::scheduleTimer(ClientInfo& client, uint64_t delayMillis, TimerKind kind) {
+    timingWheel.cancel(client.timer);
+    client.timer = timingWheel.schedule(delayMillis, client.socketNum, kind);
+}
 
-        } else {
-            Message errorMsg(MessageType::POST, "Chatroom '" + chatroomName + "' does not exist.");
-            sendMessage(client_socket, errorMsg);
+
+void Server::scheduleHeartbeat(ClientInfo& client) {
+    // Incoming traffic doesn't touch the timer, instead the next check is computed lazily
+    // from the activity timestamps when the timer fires
+    uint64_t interval = static_cast<uint64_t>(config.heartbeatIntervalSeconds) * 1000;
+    uint64_t quietFor = nowMillis - client.lastActivityMillis;
+    uint64_t delay = quietFor >= interval ? 0 : interval - quietFor;
+
+    if (config.idleTimeoutSeconds > 0) {
+        uint64_t idleTimeout = static_cast<uint64_t>(config.idleTimeoutSeconds) * 1000;
+        uint64_t idleFor = nowMillis - client.lastChatActivityMillis;
+        uint64_t idleDelay = idleFor >= idleTimeout ? 0 : idleTimeout - idleFor;
+        if (idleDelay < delay) {
+            delay = idleDelay;
         }
     }
+    scheduleTimer(client, delay, HEARTBEAT_TIMER);
 }
 
 
-void Server::processCreateChatroomMessage(int client_socket, const Message& message) {
-    std::string chatroomInfo = message.getBody();
-    std::istringstream ss(chatroomInfo);
-    std::string chatroomName;
-    std::getline(ss, chatroomName, ';');
+void Server::checkHeartbeat(ClientInfo& client) {
+    int client_socket = client.socketNum;
 
-    if (chatrooms.find(chatroomName) == chatrooms.end()) {
-        std::set<std::string> forbiddenWords;
-        std::string word;
-        while (std::getline(ss, word, ',')) {
-            forbiddenWords.insert(word);
-        }
-        createChatroom(chatroomName, forbiddenWords);
-        joinChatroom(client_socket, chatroomName); // Automatically join the creator to the chatroom
-        std::cout << "New chatroom '" << chatroomName << "' created and forbidden words set by client: " << client_socket << std::endl;
+    if (config.idleTimeoutSeconds > 0 &&
+        nowMillis - client.lastChatActivityMillis >= static_cast<uint64_t>(config.idleTimeoutSeconds) * 1000) {
+        std::cout << "Client " << client_socket << " was idle for too long, disconnecting." << std::endl;
+        sendMessage(client_socket, Message(MessageType::QUIT, "Disconnected due to inactivity."));
+        handleClientDisconnect(client_socket, false);
+        return;
+    }
+
+    if (nowMillis - client.lastActivityMillis >= static_cast<uint64_t>(config.heartbeatIntervalSeconds) * 1000) {
+        client.awaitingPong = true;
+        sendMessage(client_socket, Message(MessageType::PING, ""));
+        scheduleTimer(client, static_cast<uint64_t>(config.heartbeatTimeoutSeconds) * 1000, PONG_TIMER);
     } else {
-        Message errorMsg(MessageType::POST, "Chatroom '" + chatroomName + "' already exists.");
-        sendMessage(client_socket, errorMsg);
+        scheduleHeartbeat(client);
     }
 }
 
 
-
-// MENU
-void Server::processMenuMessage(int client_socket, const Message& message) {
-    std::string currentChatroom = findClientChatroom(client_socket);
-    std::cout << "Processing menu message for client " << client_socket << ". In chatroom: " << currentChatroom << std::endl; 
-    
-    if (!currentChatroom.empty()) {
-        displayMenu(client_socket);
-        leaveChatroom(client_socket);
-    } else {
-        Message notInChatroomMessage(MessageType::POST, "You are not currently in a chatroom.");
-        sendMessage(client_socket, notInChatroomMessage);
+void Server::closeAllConnections() {
+    // Close all client sockets and clean up resources
+    for (ClientInfo& client : clientUsernames) {
+        transport->close(client.socketNum); // Close each client connection
     }
+    clientUsernames.clear();
+    loggedInUsernames.clear();
+    for (auto& pair : peerLinks) {
+        close(pair.first); // Close each peer link
+    }
+    peerLinks.clear();
+    nodeLinks.clear();
+    if (federation_fd != -1) {
+        close(federation_fd);
+        federation_fd = -1;
+    }
+    transport->stopListening(); // Close the server socket
+    close(epoll_fd);   // Close the epoll file descriptor
+    close(timer_fd);   // Close the timer file descriptor
+    epoll_fd = timer_fd = -1;
 }
 
-// QUIT
-void Server::processQuitMessage(int client_socket, const Message& message) {
-    std::string currentChatroom = findClientChatroom(client_socket);
-    if (!currentChatroom.empty()) {
-        leaveChatroom(client_socket);
+
+bool Server::initHandoff() {
+    handoff_fd = Handoff::listenOn(config.handoffSocketPath);
+    if (handoff_fd == -1) {
+        return false;
     }
 
-    closeClientConnection(client_socket);
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = handoff_fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, handoff_fd, &event) == -1) {
+        std::cerr << "Error adding handoff socket to epoll" << std::endl;
+        return false;
+    }
+    std::cout << "Waiting for successors on handoff socket " << config.handoffSocketPath << std::endl;
+    return true;
 }
 
-// POST
-void Server::processPostMessage(int client_socket, const Message& message) {
-    std::string chatroomName = findClientChatroom(client_socket);
-    if (!chatroomName.empty()) {
-        std::string formattedMessage = "[" + clientUsernames[client_socket].username + "]: " + message.getBody();
-        Message postMessage(MessageType::POST, formattedMessage);
-        broadcastMessage(chatroomName, postMessage);
+
+void Server::handleHandoffRequest() {
+    int channel = accept4(handoff_fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (channel == -1) {
+        std::cerr << "Error accepting successor: " << strerror(errno) << std::endl;
+        return;
+    }
+    std::cout << "Successor connected, handing off " << clientUsernames.size() << " connections..." << std::endl;
+
+    // Free the path right away, the successor listens on it for the next upgrade
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, handoff_fd, nullptr);
+    close(handoff_fd);
+    handoff_fd = -1;
+    unlink(config.handoffSocketPath.c_str());
+
+    // Nothing is read from the clients until the successor answers, so every byte
+    // still in flight stays in the kernel buffers for the successor to read.
+    // File transfers are not handed over, only the rest of a CHUNK frame under way.
+    interruptTransfers();
+    spoolRoomLogs();
+    std::vector<int> fds;
+    std::string snapshot = buildSnapshot(fds);
+
+    // Every connection waits while we do, so a successor that hangs gets a deadline. Past
+    // it we serve again, the successor only takes over once we confirm its ack.
+    struct timeval timeout = {HANDOFF_TIMEOUT_SECONDS, 0};
+    setsockopt(channel, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    setsockopt(channel, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    char ack = 0;
+    char confirmation = 'C';
+    if (Handoff::sendState(channel, fds, snapshot) && recv(channel, &ack, 1, 0) == 1 && ack == 'A' &&
+        send(channel, &confirmation, 1, MSG_NOSIGNAL) == 1) {
+        handedOff = true;
+        std::cout << "Successor took over " << fds.size() - 1 << " connections." << std::endl;
     } else {
-        Message notInChatroomMessage(MessageType::POST, "You need to join a chatroom to send messages.");
-        sendMessage(client_socket, notInChatroomMessage);
+        std::cerr << "Handoff failed, continuing to serve." << std::endl;
+        initHandoff();
     }
+    close(channel);
 }
 
 
-void Server::leaveChatroom(int client_socket) {
-    // Find the chatroom that the client is in
-
-    auto it = clientToChatroomMap.find(client_socket);
-    if (it != clientToChatroomMap.end()) {
-        const std::string& chatroomName = it->second;
-        auto& chatroom = chatrooms[chatroomName];
+bool Server::takeOver(int& channel) {
+    std::cout << "Taking over from the server on " << config.handoffSocketPath << "..." << std::endl;
+    channel = Handoff::connectTo(config.handoffSocketPath);
+    if (channel == -1) {
+        return false;
+    }
 
-        // Remove the client from the chatroom's client list
+    std::vector<int> fds;
+    std::string snapshot;
+    if (!Handoff::receiveState(channel, fds, snapshot) || !restoreSnapshot(snapshot, fds)) {
+        // Dropping our copies of the descriptors leaves the connections to the old server
+        for (int fd : fds) {
+            close(fd);
+        }
+        federation_fd = -1;
+        close(channel);
+        channel = -1;
+        return false;
+    }
+    std::cout << "Received the listening socket and " << clientUsernames.size() << " connections." << std::endl;
+    return true;
+}
+
+
+std::string Server::buildSnapshot(std::vector<int>& fds) {
+    // Sockets are referenced by their position in 'fds', since the successor
+    // receives them under different numbers. The listening sockets come first.
+    // Peer links are not handed over, the successor dials its peers again.
+    std::unordered_map<int, uint32_t> fdIndex;
+    fds.push_back(tcpTransport.getListenFd());
+    if (federation_fd != -1) {
+        fds.push_back(federation_fd);
+    }
+    for (ClientInfo& client : clientUsernames) {
+        fdIndex[client.socketNum] = static_cast<uint32_t>(fds.size());
+        fds.push_back(client.socketNum);
+    }
+
+    SnapshotWriter writer;
+    writer.writeU32(SNAPSHOT_VERSION);
+    writer.writeU8(federation_fd != -1 ? 1 : 0);
+
+    writer.writeU32(static_cast<uint32_t>(clientUsernames.size()));
+    for (ClientInfo& client : clientUsernames) {
+        writer.writeU32(fdIndex[client.socketNum]);
+        writer.writeString(client.username.str());
+        writer.writeU8(client.loggedIn ? 1 : 0);
+        writer.writeString(client.readBuffer.str());
+        writer.writeU64(client.lastActivityMillis);
+        writer.writeU64(client.lastChatActivityMillis);
+        writer.writeU8(client.awaitingPong ? 1 : 0);
+        writer.writeU8(client.wantsPresence ? 1 : 0);
+        writer.writeString(client.resumeToken.str());
+        // Room ids are this process's own, the successor numbers the rooms again
+        writer.writeString(findClientChatroom(client.socketNum));
+        for (size_t lane = 0; lane < TRAFFIC_CLASS_COUNT; lane++) {
+            TrafficClass trafficClass = static_cast<TrafficClass>(lane);
+            writer.writeString(client.outbound.str(trafficClass));
+            writer.writeU32(client.outbound.getFrameRemaining(trafficClass));
+        }
+    }
+
+    writer.writeU32(static_cast<uint32_t>(chatrooms.size()));
+    for (const auto& pair : chatrooms) {
+        const Chatroom& chatroom = pair.second;
+        writer.writeString(pair.first);
+
+        writer.writeU32(static_cast<uint32_t>(chatroom.getForbiddenWords().size()));
+        for (const std::string& word : chatroom.getForbiddenWords()) {
+            writer.writeString(word);
+        }
+
+        writer.writeU64(chatroom.getFirstMessageNumber());
+        writer.writeU32(static_cast<uint32_t>(chatroom.getMessageCount()));
+        for (size_t i = 0; i < chatroom.getMessageCount(); i++) {
+            writer.writeString(chatroom.getMessage(i));
+        }
+
+        writer.writeU32(static_cast<uint32_t>(chatroom.getClients().size()));
+        for (int client_socket : chatroom.getClients()) {
+            writer.writeU32(fdIndex[client_socket]);
+        }
+
+        writer.writeU32(static_cast<uint32_t>(chatroom.getOwnerNode()));
+        writer.writeU64(chatroom.getLastSequence());
+        writer.writeU8(chatroom.isHistorySynced() ? 1 : 0);
+    }
+
+    writer.writeU64(attachments.getNextId());
+    writer.writeU32(static_cast<uint32_t>(attachments.getIds().size()));
+    for (uint64_t id : attachments.getIds()) {
+        const Attachment* attachment = attachments.find(id);
+        writer.writeU64(attachment->id);
+        writer.writeString(attachment->name);
+        writer.writeU64(attachment->size);
+        writer.writeString(attachment->chatroomName);
+        writer.writeString(attachment->path);
+    }
+
+    // Dropped sessions, in the order they expire
+    std::vector<const std::pair<uint64_t, std::string>*> liveSessions;
+    for (const auto& entry : detachedExpiry) {
+        auto it = detachedSessions.find(entry.second);
+        if (it != detachedSessions.end() && it->second.expiresMillis == entry.first) {
+            liveSessions.push_back(&entry);
+        }
+    }
+    writer.writeU32(static_cast<uint32_t>(liveSessions.size()));
+    for (const auto* entry : liveSessions) {
+        const DetachedSession& session = detachedSessions[entry->second];
+        writer.writeString(entry->second);
+        writer.writeString(session.username);
+        writer.writeU32(static_cast<uint32_t>(session.chatroomNames.size()));
+        for (const std::string& name : session.chatroomNames) {
+            writer.writeString(name);
+        }
+        writer.writeU64(session.expiresMillis > nowMillis ? session.expiresMillis - nowMillis : 0);
+    }
+    return writer.getData();
+}
+
+
+bool Server::restoreSnapshot(const std::string& snapshot, const std::vector<int>& fds) {
+    SnapshotReader reader(snapshot);
+    uint32_t version, clientCount, roomCount;
+    uint8_t hasFederationListener;
+    if (fds.empty() || !reader.readU32(version) || version != SNAPSHOT_VERSION ||
+        !reader.readU8(hasFederationListener) || (hasFederationListener && fds.size() < 2)) {
+        std::cerr << "Unsupported handoff snapshot." << std::endl;
+        return false;
+    }
+    tcpTransport.adoptListener(fds[0]);
+    if (hasFederationListener) {
+        federation_fd = fds[1];
+    }
+
+    if (!reader.readU32(clientCount)) {
+        return false;
+    }
+    std::vector<std::pair<int, std::string>> activeChatrooms; // Resolved once the rooms are back
+    for (uint32_t i = 0; i < clientCount; i++) {
+        uint32_t index;
+        uint8_t loggedIn, awaitingPong, wantsPresence;
+        uint64_t lastActivityMillis, lastChatActivityMillis;
+        std::string username, readBuffer, resumeToken, activeChatroom, outbound[TRAFFIC_CLASS_COUNT];
+        uint32_t frameRemaining[TRAFFIC_CLASS_COUNT];
+        bool complete = reader.readU32(index) && index < fds.size() && reader.readString(username) &&
+            reader.readU8(loggedIn) && reader.readString(readBuffer) &&
+            reader.readU64(lastActivityMillis) && reader.readU64(lastChatActivityMillis) &&
+            reader.readU8(awaitingPong) && reader.readU8(wantsPresence) && reader.readString(resumeToken) &&
+            reader.readString(activeChatroom);
+        for (size_t lane = 0; complete && lane < TRAFFIC_CLASS_COUNT; lane++) {
+            complete = reader.readString(outbound[lane]) && reader.readU32(frameRemaining[lane]) &&
+                       frameRemaining[lane] <= outbound[lane].length();
+        }
+        if (!complete) {
+            std::cerr << "Truncated handoff snapshot." << std::endl;
+            return false;
+        }
+        ClientInfo& client = clientUsernames.create(fds[index]);
+        client.username = username;
+        client.loggedIn = loggedIn != 0;
+        client.readBuffer.assign(readBuffer);
+        client.lastActivityMillis = lastActivityMillis;
+        client.lastChatActivityMillis = lastChatActivityMillis;
+        client.awaitingPong = awaitingPong != 0;
+        client.wantsPresence = wantsPresence != 0;
+        client.resumeToken = resumeToken;
+        for (size_t lane = 0; lane < TRAFFIC_CLASS_COUNT; lane++) {
+            // The predecessor's queue as it was, a frame it had partly sent still goes first
+            TrafficClass trafficClass = static_cast<TrafficClass>(lane);
+            client.outbound.pushRest(trafficClass, outbound[lane].data(), frameRemaining[lane]);
+            client.outbound.push(trafficClass, outbound[lane].data() + frameRemaining[lane],
+                                 outbound[lane].length() - frameRemaining[lane]);
+        }
+        client.rateLimiter.configure(config.clientMessagesPerSecond, config.clientMessageBurst,
+                                     config.clientBytesPerSecond, config.clientByteBurst);
+        if (client.loggedIn) {
+            loggedInUsernames.insert(username);
+        }
+        if (!activeChatroom.empty()) {
+            activeChatrooms.emplace_back(client.socketNum, activeChatroom);
+        }
+    }
+
+    if (!reader.readU32(roomCount)) {
+        return false;
+    }
+    for (uint32_t i = 0; i < roomCount; i++) {
+        std::string name;
+        uint32_t count;
+        if (!reader.readString(name) || !reader.readU32(count)) {
+            return false;
+        }
+
+        std::set<std::string> forbiddenWords;
+        for (uint32_t j = 0; j < count; j++) {
+            std::string word;
+            if (!reader.readString(word)) {
+                return false;
+            }
+            forbiddenWords.insert(word);
+        }
+        Chatroom& chatroom = addChatroom(name, forbiddenWords);
+
+        // Message numbers continue where the previous server was, clients resume by them
+        uint64_t firstMessageNumber;
+        if (!reader.readU64(firstMessageNumber) || !reader.readU32(count)) {
+            return false;
+        }
+        chatroom.setNextMessageNumber(firstMessageNumber);
+        for (uint32_t j = 0; j < count; j++) {
+            std::string messageBody;
+            if (!reader.readString(messageBody)) {
+                return false;
+            }
+            chatroom.addMessage(messageBody);
+        }
+
+        if (!reader.readU32(count)) {
+            return false;
+        }
+        for (uint32_t j = 0; j < count; j++) {
+            uint32_t index;
+            ClientInfo* member = reader.readU32(index) && index < fds.size() ? clientUsernames.find(fds[index]) : nullptr;
+            if (member == nullptr) {
+                return false; // Not a connection of the snapshot
+            }
+            chatroom.addClient(fds[index]);
+            member->chatrooms.insert(chatroom.getId());
+        }
+
+        uint32_t ownerNode;
+        uint64_t lastSequence;
+        uint8_t historySynced;
+        if (!reader.readU32(ownerNode) || !reader.readU64(lastSequence) || !reader.readU8(historySynced)) {
+            return false;
+        }
+        chatroom.setOwnerNode(static_cast<int>(ownerNode));
+        chatroom.setLastSequence(lastSequence);
+        chatroom.setHistorySynced(historySynced != 0);
+    }
+    for (const auto& active : activeChatrooms) {
+        auto it = chatrooms.find(active.second);
+        if (it != chatrooms.end()) {
+            clientUsernames.find(active.first)->activeChatroom = it->second.getId();
+        }
+    }
+
+    uint64_t nextAttachmentId;
+    uint32_t attachmentCount;
+    if (!reader.readU64(nextAttachmentId) || !reader.readU32(attachmentCount)) {
+        return false;
+    }
+    for (uint32_t i = 0; i < attachmentCount; i++) {
+        Attachment attachment;
+        if (!reader.readU64(attachment.id) || !reader.readString(attachment.name) ||
+            !reader.readU64(attachment.size) || !reader.readString(attachment.chatroomName) ||
+            !reader.readString(attachment.path)) {
+            return false;
+        }
+        attachments.add(attachment);
+    }
+    attachments.setNextId(nextAttachmentId);
+
+    uint32_t sessionCount;
+    if (!reader.readU32(sessionCount)) {
+        return false;
+    }
+    for (uint32_t i = 0; i < sessionCount; i++) {
+        std::string token;
+        DetachedSession session;
+        uint64_t remainingMillis;
+        uint32_t chatroomCount;
+        if (!reader.readString(token) || !reader.readString(session.username) || !reader.readU32(chatroomCount)) {
+            return false;
+        }
+        session.chatroomNames.resize(chatroomCount);
+        for (std::string& name : session.chatroomNames) {
+            if (!reader.readString(name)) {
+                return false;
+            }
+        }
+        if (!reader.readU64(remainingMillis)) {
+            return false;
+        }
+        session.expiresMillis = nowMillis + remainingMillis;
+        detachedUsernames[session.username] = token;
+        detachedExpiry.emplace_back(session.expiresMillis, token);
+        detachedSessions[token] = std::move(session);
+    }
+    return true;
+}
+
+
+bool Server::registerRestoredClients() {
+    for (ClientInfo& client : clientUsernames) {
+        client.connectionId = nextConnectionId++;
+        if (capture.isOpen()) {
+            capture.record(TraceRecordKind::CONNECT, client.connectionId);
+        }
+        if (!transport->add(client.socketNum)) {
+            std::cerr << "Error adding restored client to epoll: " << strerror(errno) << std::endl;
+            return false;
+        }
+        // Broadcasts the predecessor hadn't sent yet
+        client.waitingForWritable = !client.outbound.empty();
+        updateClientEvents(client);
+
+        // Deadlines restart under this process's timing wheel
+        if (!client.loggedIn) {
+            scheduleTimer(client, static_cast<uint64_t>(config.loginTimeoutSeconds) * 1000, LOGIN_TIMER);
+        } else if (client.awaitingPong) {
+            scheduleTimer(client, static_cast<uint64_t>(config.heartbeatTimeoutSeconds) * 1000, PONG_TIMER);
+        } else {
+            scheduleHeartbeat(client);
+        }
+    }
+    return true;
+}
+
+
+bool Server::isFederated() const {
+    return config.federationPort != 0 || !config.peers.empty();
+}
+
+
+bool Server::initFederation() {
+    // After a takeover the listening socket was inherited from the previous server
+    if (federation_fd == -1 && config.federationPort != 0) {
+        federation_fd = PeerSockets::listenOn(ip, config.federationPort);
+        if (federation_fd == -1) {
+            return false;
+        }
+    }
+    if (federation_fd != -1) {
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.fd = federation_fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, federation_fd, &event) == -1) {
+            std::cerr << "Error adding federation socket to epoll" << std::endl;
+            return false;
+        }
+        std::cout << "Node " << config.nodeId << " accepting peers on port " << config.federationPort << std::endl;
+    }
+
+    for (size_t i = 0; i < config.peers.size(); i++) {
+        connectToPeer(static_cast<int>(i));
+    }
+    return true;
+}
+
+
+void Server::connectToPeer(int peerIndex) {
+    for (const auto& pair : peerLinks) {
+        if (pair.second.peerIndex == peerIndex) {
+            return; // Already linked or being dialed
+        }
+    }
+
+    std::string host;
+    int peerPort;
+    if (!PeerSockets::parseAddress(config.peers[peerIndex], host, peerPort)) {
+        std::cerr << "Invalid peer address: " << config.peers[peerIndex] << std::endl;
+        return;
+    }
+    int fd = PeerSockets::startConnect(host, peerPort);
+    if (fd == -1) {
+        timingWheel.schedule(static_cast<uint64_t>(config.peerReconnectSeconds) * 1000, peerIndex, PEER_RECONNECT_TIMER);
+        return;
+    }
+    registerPeerLink(fd, peerIndex, true);
+}
+
+
+void Server::registerPeerLink(int fd, int peerIndex, bool connecting) {
+    PeerLink& link = peerLinks[fd];
+    link.fd = fd;
+    link.peerIndex = peerIndex;
+    link.connecting = connecting;
+    link.lastReceivedMillis = link.lastSentMillis = nowMillis;
+    link.timer = timingWheel.schedule(static_cast<uint64_t>(config.peerHeartbeatSeconds) * 1000, fd, PEER_HEARTBEAT_TIMER);
+
+    // A link being dialed is watched for writability, which signals the end of the connect
+    struct epoll_event event;
+    event.events = connecting ? EPOLLOUT : EPOLLIN;
+    event.data.fd = fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+
+    if (!connecting) {
+        startPeerLink(link);
+    }
+}
+
+
+void Server::startPeerLink(PeerLink& link) {
+    peerWriter.clear();
+    peerWriter.writeU8(static_cast<uint8_t>(PeerMessageType::HELLO));
+    peerWriter.writeU32(static_cast<uint32_t>(config.nodeId));
+    sendPeerMessage(link.fd);
+}
+
+
+void Server::handleNewPeer() {
+    int fd = accept4(federation_fd, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+    if (fd == -1) {
+        std::cerr << "Error accepting peer: " << strerror(errno) << std::endl;
+        return;
+    }
+    int opt = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+    registerPeerLink(fd, -1, false);
+}
+
+
+void Server::handlePeerEvent(int fd, uint32_t events) {
+    PeerLink& link = peerLinks[fd];
+    if (!link.connecting) {
+        if (events & EPOLLOUT) {
+            flushPeerLink(link);
+        }
+        if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+            handlePeerData(fd);
+        }
+        return;
+    }
+
+    if (!PeerSockets::finishConnect(fd)) {
+        closePeerLink(fd, true);
+        return;
+    }
+    std::cout << "Connected to peer " << config.peers[link.peerIndex] << std::endl;
+    link.connecting = false;
+    link.lastReceivedMillis = nowMillis;
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &event);
+    startPeerLink(link);
+}
+
+
+void Server::handlePeerData(int fd) {
+    char buffer[READ_CHUNK_SIZE];
+    int bytesRead = recv(fd, buffer, sizeof(buffer), 0);
+    if (bytesRead == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+        return;
+    }
+    if (bytesRead <= 0) {
+        closePeerLink(fd, true);
+        return;
+    }
+    peerLinks[fd].lastReceivedMillis = nowMillis;
+
+    // Peer traffic is one link per node, so it is simply buffered and cut into frames
+    peerLinks[fd].readBuffer.append(buffer, bytesRead);
+    size_t consumed = 0;
+    while (true) {
+        const std::string& readBuffer = peerLinks[fd].readBuffer;
+        const char* payload;
+        size_t payloadLength;
+        FrameStatus status = Message::findFrame(readBuffer.data() + consumed, readBuffer.length() - consumed,
+                                                payload, payloadLength);
+        if (status == FrameStatus::Incomplete) {
+            break;
+        }
+        if (status == FrameStatus::Invalid) {
+            std::cerr << "Invalid frame from peer link " << fd << ", closing it." << std::endl;
+            closePeerLink(fd, true);
+            return;
+        }
+        consumed += Message::FRAME_HEADER_SIZE + payloadLength;
+        processPeerMessage(fd, payload, payloadLength);
+
+        // A HELLO may close the link as a duplicate
+        if (peerLinks.find(fd) == peerLinks.end()) {
+            return;
+        }
+    }
+    peerLinks[fd].readBuffer.erase(0, consumed);
+}
+
+
+void Server::processPeerMessage(int fd, const char* payload, size_t length) {
+    SnapshotReader reader(payload, length);
+    uint8_t type;
+    if (!reader.readU8(type)) {
+        return;
+    }
+    int node = peerLinks[fd].nodeId;
+    if (static_cast<PeerMessageType>(type) != PeerMessageType::HELLO && node == -1) {
+        return; // Nothing counts before the peer said who it is
+    }
+
+    std::string name;
+    uint8_t messageType;
+    uint32_t count;
+    uint64_t sequence;
+    switch (static_cast<PeerMessageType>(type)) {
+        case PeerMessageType::HELLO: {
+            uint32_t nodeId;
+            if (reader.readU32(nodeId)) {
+                processPeerHello(fd, static_cast<int>(nodeId));
+            }
+            break;
+        }
+        case PeerMessageType::ROOM: {
+            uint32_t ownerNode;
+            std::set<std::string> forbiddenWords;
+            if (!reader.readString(name) || !reader.readU32(ownerNode) || !reader.readU32(count)) {
+                break;
+            }
+            std::string word;
+            for (uint32_t i = 0; i < count && reader.readString(word); i++) {
+                forbiddenWords.insert(word);
+            }
+            processRoomAnnouncement(name, static_cast<int>(ownerNode), forbiddenWords);
+            break;
+        }
+        case PeerMessageType::SUBSCRIBE: {
+            auto it = chatrooms.end();
+            uint8_t hasCopy;
+            if (!reader.readString(name) || !reader.readU8(hasCopy) || !reader.readU64(sequence) ||
+                (it = chatrooms.find(name)) == chatrooms.end() || it->second.getOwnerNode() != config.nodeId) {
+                break;
+            }
+            it->second.getSubscribedNodes().insert(node);
+            sendPeerHistory(fd, it->second, hasCopy != 0, sequence);
+            break;
+        }
+        case PeerMessageType::UNSUBSCRIBE: {
+            auto it = chatrooms.end();
+            if (reader.readString(name) && (it = chatrooms.find(name)) != chatrooms.end()) {
+                it->second.getSubscribedNodes().erase(node);
+            }
+            break;
+        }
+        case PeerMessageType::HISTORY:
+            processPeerHistory(fd, reader);
+            break;
+        case PeerMessageType::PRESENCE:
+            processPeerPresence(fd, reader);
+            break;
+        case PeerMessageType::HEARTBEAT:
+            break; // Arriving was all it had to do
+        case PeerMessageType::PUBLISH: {
+            std::string body;
+            auto it = chatrooms.end();
+            if (!reader.readString(name) || !reader.readU8(messageType) || !reader.readString(body) ||
+                (it = chatrooms.find(name)) == chatrooms.end() || it->second.getOwnerNode() != config.nodeId) {
+                break;
+            }
+            broadcastMessage(name, static_cast<MessageType>(messageType), body);
+            break;
+        }
+        case PeerMessageType::DELIVER: {
+            std::string body;
+            auto it = chatrooms.end();
+            if (!reader.readString(name) || !reader.readU64(sequence) || !reader.readU8(messageType) ||
+                !reader.readString(body) || (it = chatrooms.find(name)) == chatrooms.end() ||
+                it->second.getOwnerNode() != node) {
+                break;
+            }
+            // Sequence numbers drop anything already applied from a HISTORY answer
+            if (sequence > it->second.getLastSequence()) {
+                it->second.setLastSequence(sequence);
+                deliverToChatroom(it->second, static_cast<MessageType>(messageType), body, sequence);
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+
+void Server::processPeerHello(int fd, int nodeId) {
+    if (nodeId == config.nodeId) {
+        std::cerr << "Peer link " << fd << " claims our own node id " << nodeId << ", closing it." << std::endl;
+        closePeerLink(fd, false);
+        return;
+    }
+    peerLinks[fd].nodeId = nodeId;
+
+    auto existing = nodeLinks.find(nodeId);
+    if (existing != nodeLinks.end()) {
+        // Both nodes dialed each other. They both keep the link dialed by the lower node
+        // id, so exactly one link survives.
+        const PeerLink& old = peerLinks[existing->second];
+        int lowerNode = std::min(nodeId, config.nodeId);
+        int oldDialer = old.peerIndex >= 0 ? config.nodeId : nodeId;
+        int newDialer = peerLinks[fd].peerIndex >= 0 ? config.nodeId : nodeId;
+        if (oldDialer == lowerNode && newDialer != lowerNode) {
+            closePeerLink(fd, false);
+            return;
+        }
+        closePeerLink(existing->second, false);
+    }
+    nodeLinks[nodeId] = fd;
+    std::cout << "Linked with node " << nodeId << " over peer link " << fd << std::endl;
+
+    // Tell the new peer about our rooms, and pick up the rooms it owns where we have members
+    for (auto& pair : chatrooms) {
+        Chatroom& chatroom = pair.second;
+        if (chatroom.getOwnerNode() == config.nodeId) {
+            announceChatroom(chatroom, nodeId);
+        } else if (chatroom.getOwnerNode() == nodeId && !chatroom.getClients().empty()) {
+            subscribeToOwner(chatroom);
+        }
+    }
+}
+
+
+void Server::processRoomAnnouncement(const std::string& name, int ownerNode, const std::set<std::string>& forbiddenWords) {
+    auto it = chatrooms.find(name);
+    if (it == chatrooms.end()) {
+        // A replica stays empty until the first local member subscribes to it
+        Chatroom& replica = addChatroom(name, forbiddenWords);
+        replica.setOwnerNode(ownerNode);
+        replica.setHistorySynced(false);
+        std::cout << "Chatroom '" << name << "' of node " << ownerNode << " added." << std::endl;
+        return;
+    }
+
+    // Two nodes created a room with the same name: the lower node id owns it
+    Chatroom& chatroom = it->second;
+    if (ownerNode >= chatroom.getOwnerNode()) {
+        return;
+    }
+    std::cout << "Chatroom '" << name << "' is now owned by node " << ownerNode << std::endl;
+    chatroom.setOwnerNode(ownerNode);
+    chatroom.getSubscribedNodes().clear();
+    chatroom.setLastSequence(0);
+    chatroom.setHistorySynced(false);
+    if (!chatroom.getClients().empty()) {
+        subscribeToOwner(chatroom);
+    }
+}
+
+
+// Answers a SUBSCRIBE with the messages after sequence 'after', in HISTORY pages of one
+// frame each, as many as it takes. A subscriber without a copy, or one that missed more
+// than the history still holds, gets everything retained instead, and the first page
+// tells it to replace its copy.
+void Server::sendPeerHistory(int fd, const Chatroom& chatroom, bool hasCopy, uint64_t after) {
+    // The newest message has the last sequence. Older ones without a sequence (the
+    // welcome message of a new room has 0) go with a full answer.
+    uint64_t last = chatroom.getLastSequence();
+    size_t count = chatroom.getMessageCount();
+    size_t retained = static_cast<size_t>(std::min<uint64_t>(count, last + 1));
+    uint64_t oldest = last + 1 - retained;
+    bool replace = !hasCopy || after + 1 < oldest || after > last;
+    uint64_t next = replace ? oldest : after + 1;
+    size_t base = count - retained; // Index of the message with sequence 'oldest'
+
+    do {
+        uint64_t end = next;
+        size_t bytes = 64 + chatroom.getName().length();
+        while (end <= last) {
+            size_t length = chatroom.getMessage(base + static_cast<size_t>(end - oldest)).length() + 4;
+            if (end > next && bytes + length >= Message::MAX_FRAME_SIZE) {
+                break;
+            }
+            bytes += length;
+            end++;
+        }
+        peerWriter.clear();
+        peerWriter.writeU8(static_cast<uint8_t>(PeerMessageType::HISTORY));
+        peerWriter.writeString(chatroom.getName());
+        peerWriter.writeU8(replace ? 1 : 0);
+        peerWriter.writeU64(next);
+        peerWriter.writeU64(last);
+        peerWriter.writeU32(static_cast<uint32_t>(end - next));
+        for (uint64_t sequence = next; sequence < end; sequence++) {
+            peerWriter.writeString(chatroom.getMessage(base + static_cast<size_t>(sequence - oldest)));
+        }
+        if (!sendPeerMessage(fd)) {
+            return; // The link is going down, the next SUBSCRIBE starts over
+        }
+        replace = false;
+        next = end;
+    } while (next <= last);
+}
+
+
+void Server::processPeerHistory(int fd, SnapshotReader& reader) {
+    std::string name;
+    uint8_t replace;
+    uint64_t firstSequence;
+    uint64_t lastSequence;
+    uint32_t count;
+    if (!reader.readString(name) || !reader.readU8(replace) || !reader.readU64(firstSequence) ||
+        !reader.readU64(lastSequence) || !reader.readU32(count)) {
+        return;
+    }
+    auto it = chatrooms.find(name);
+    if (it == chatrooms.end() || it->second.getOwnerNode() != peerLinks[fd].nodeId) {
+        return;
+    }
+    Chatroom& chatroom = it->second;
+
+    std::vector<std::string> messages(count);
+    for (uint32_t i = 0; i < count; i++) {
+        if (!reader.readString(messages[i])) {
+            return;
+        }
+    }
+
+    if (replace) {
+        // A new copy, or we missed more than the owner still has: the members get the
+        // whole history again once the last page is in. The copy numbers its messages
+        // with the owner's sequences, so members see the same ones on every node.
+        chatroom.clearMessages(firstSequence);
+        chatroom.setHistorySynced(false);
+        for (const std::string& message : messages) {
+            chatroom.addMessage(message);
+        }
+        chatroom.setLastSequence(firstSequence + count - 1);
+    } else {
+        for (uint32_t i = 0; i < count; i++) {
+            uint64_t sequence = firstSequence + i;
+            if (sequence <= chatroom.getLastSequence()) {
+                continue; // Already applied
+            }
+            chatroom.setLastSequence(sequence);
+            if (chatroom.isHistorySynced()) {
+                // Resubscribed after a broken link: the members only miss what was posted meanwhile
+                deliverToChatroom(chatroom, MessageType::POST, messages[i], sequence);
+            } else {
+                chatroom.addMessage(messages[i]);
+            }
+        }
+    }
+
+    if (!chatroom.isHistorySynced() && chatroom.getLastSequence() >= lastSequence) {
+        chatroom.setHistorySynced(true);
+        for (int client_socket : chatroom.getClients()) {
+            sendChatroomHistory(client_socket, chatroom);
+        }
+    }
+}
+
+
+void Server::announceChatroom(const Chatroom& chatroom, int node) {
+    peerWriter.clear();
+    peerWriter.writeU8(static_cast<uint8_t>(PeerMessageType::ROOM));
+    peerWriter.writeString(chatroom.getName());
+    peerWriter.writeU32(static_cast<uint32_t>(chatroom.getOwnerNode()));
+    peerWriter.writeU32(static_cast<uint32_t>(chatroom.getForbiddenWords().size()));
+    for (const std::string& word : chatroom.getForbiddenWords()) {
+        peerWriter.writeString(word);
+    }
+
+    // node -1 announces the room to every linked node
+    if (node != -1) {
+        sendToNode(node);
+        return;
+    }
+    for (const auto& pair : nodeLinks) {
+        sendPeerMessage(pair.second);
+    }
+}
+
+
+void Server::subscribeToOwner(Chatroom& chatroom) {
+    // A copy that is in sync only needs what was posted after it
+    peerWriter.clear();
+    peerWriter.writeU8(static_cast<uint8_t>(PeerMessageType::SUBSCRIBE));
+    peerWriter.writeString(chatroom.getName());
+    peerWriter.writeU8(chatroom.isHistorySynced() ? 1 : 0);
+    peerWriter.writeU64(chatroom.getLastSequence());
+    sendToNode(chatroom.getOwnerNode());
+}
+
+
+void Server::closePeerLink(int fd, bool reconnect) {
+    auto it = peerLinks.find(fd);
+    if (it == peerLinks.end()) {
+        return;
+    }
+    int node = it->second.nodeId;
+    int peerIndex = it->second.peerIndex;
+    if (node != -1) {
+        std::cout << "Link with node " << node << " closed." << std::endl;
+    }
+
+    auto nodeIt = nodeLinks.find(node);
+    if (nodeIt != nodeLinks.end() && nodeIt->second == fd) {
+        nodeLinks.erase(nodeIt);
+        for (auto& pair : chatrooms) {
+            pair.second.getSubscribedNodes().erase(node);
+        }
+    }
+    timingWheel.cancel(it->second.timer);
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    peerLinks.erase(it);
+
+    // Links we dialed are dialed again, the peer takes care of the ones it dialed
+    if (reconnect && peerIndex >= 0) {
+        timingWheel.schedule(static_cast<uint64_t>(config.peerReconnectSeconds) * 1000, peerIndex, PEER_RECONNECT_TIMER);
+    }
+}
+
+
+bool Server::sendToNode(int node) {
+    auto it = nodeLinks.find(node);
+    return it != nodeLinks.end() && sendPeerMessage(it->second);
+}
+
+
+// Sends the message in 'peerWriter', what the socket doesn't take is queued on the link.
+// A link that fails is only shut down here: the callers may be walking 'nodeLinks', so
+// it is closed (and dialed again) once reading from it reports the end.
+bool Server::sendPeerMessage(int fd) {
+    auto it = peerLinks.find(fd);
+    if (it == peerLinks.end() || it->second.broken) {
+        return false;
+    }
+    PeerLink& link = it->second;
+    const std::string& payload = peerWriter.getData();
+    Message::writeFrameHeader(static_cast<uint32_t>(payload.length()), peerFrame);
+    peerFrame += payload;
+    link.lastSentMillis = nowMillis;
+
+    size_t sent = 0;
+    if (link.writeBuffer.empty()) {
+        ssize_t result = send(fd, peerFrame.data(), peerFrame.length(), MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (result == -1 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            std::cerr << "Sending on peer link " << fd << " failed: " << strerror(errno) << std::endl;
+            breakPeerLink(link);
+            return false;
+        }
+        sent = result > 0 ? static_cast<size_t>(result) : 0;
+    }
+    if (sent < peerFrame.length()) {
+        if (link.writeBuffer.length() + peerFrame.length() - sent > MAX_PEER_BACKLOG) {
+            std::cerr << "Peer link " << fd << " fell too far behind, closing it." << std::endl;
+            breakPeerLink(link);
+            return false;
+        }
+        link.writeBuffer.append(peerFrame, sent, std::string::npos);
+        updatePeerEvents(link);
+    }
+    return true;
+}
+
+
+void Server::flushPeerLink(PeerLink& link) {
+    if (!link.writeBuffer.empty()) {
+        ssize_t sent = send(link.fd, link.writeBuffer.data(), link.writeBuffer.length(), MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (sent == -1 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            breakPeerLink(link);
+            return;
+        }
+        if (sent > 0) {
+            link.writeBuffer.erase(0, static_cast<size_t>(sent));
+        }
+    }
+    updatePeerEvents(link);
+}
+
+
+void Server::updatePeerEvents(PeerLink& link) {
+    bool wantWritable = !link.writeBuffer.empty();
+    if (link.watchingWritable == wantWritable) {
+        return;
+    }
+    struct epoll_event event;
+    event.events = wantWritable ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+    event.data.fd = link.fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, link.fd, &event);
+    link.watchingWritable = wantWritable;
+}
+
+
+void Server::breakPeerLink(PeerLink& link) {
+    link.broken = true;
+    link.writeBuffer.clear();
+    updatePeerEvents(link);
+    shutdown(link.fd, SHUT_RDWR); // Reported as readable, handlePeerData closes it
+}
+
+
+// Runs every peerHeartbeatSeconds on each link, like the client heartbeat it works out
+// from the timestamps what is due instead of moving the timer on every frame.
+void Server::checkPeerLink(PeerLink& link) {
+    if (nowMillis - link.lastReceivedMillis >= static_cast<uint64_t>(config.peerTimeoutSeconds) * 1000) {
+        std::cout << "Peer link " << link.fd << (link.connecting ? " did not connect in time" : " went quiet")
+                  << ", closing it." << std::endl;
+        closePeerLink(link.fd, true);
+        return;
+    }
+    uint64_t interval = static_cast<uint64_t>(config.peerHeartbeatSeconds) * 1000;
+    if (!link.connecting && nowMillis - link.lastSentMillis >= interval) {
+        peerWriter.clear();
+        peerWriter.writeU8(static_cast<uint8_t>(PeerMessageType::HEARTBEAT));
+        sendPeerMessage(link.fd);
+    }
+    link.timer = timingWheel.schedule(interval, link.fd, PEER_HEARTBEAT_TIMER);
+}
+
+
+void Server::sendWelcomeMessage(int client_socket) {
+    Message welcomeMessage(MessageType::POST, "Welcome to the chat server!\nPlease enter username:");
+    sendMessage(client_socket, welcomeMessage);
+    std::cout << "Welcome message sent to client: Socket FD " << client_socket << std::endl;
+}
+
+
+void Server::createChatroom(const std::string& name, const std::set<std::string>& forbiddenWords) {
+    Chatroom& newChatroom = addChatroom(name, forbiddenWords);
+    newChatroom.setOwnerNode(config.nodeId);
+    std::string welcomeMessage = "\n[Server]: Welcome to the chatroom '" + name + "'.\nYou can send messages to the chat now.\nType '/leave' to exit the chatroom.";
+    newChatroom.addMessage(welcomeMessage);
+    std::cout << "Chatroom '" << name << "' created successfully with welcome message." << std::endl;
+}
+
+
+// Every chatroom, local, replica or restored, comes into being here and gets the next id.
+Chatroom& Server::addChatroom(const std::string& name, const std::set<std::string>& forbiddenWords) {
+    auto existing = chatrooms.find(name);
+    if (existing != chatrooms.end()) {
+        return existing->second; // Keeps its id and its settings
+    }
+    // Construct the chatroom in place instead of moving a temporary into the map
+    Chatroom& chatroom = chatrooms.emplace(std::piecewise_construct, std::forward_as_tuple(name),
+                                           std::forward_as_tuple(name, forbiddenWords)).first->second;
+    chatroom.setId(static_cast<uint32_t>(chatroomsById.size()));
+    chatroomsById.push_back(&chatroom);
+    chatroom.setHistoryLimit(config.historyLimit);
+    chatroom.getLog().setMaxBytes(static_cast<size_t>(config.roomLogBytes));
+    chatroom.getRateLimiter().configure(config.roomMessagesPerSecond, config.roomMessageBurst,
+                                        config.roomBytesPerSecond, config.roomByteBurst);
+    return chatroom;
+}
+
+
+void Server::handleClientData(int client_socket) {
+    ClientInfo* found = clientUsernames.find(client_socket);
+    if (found == nullptr) {
+        return; // Closed earlier in this batch of events
+    }
+
+    char buffer[READ_CHUNK_SIZE];
+    bool tracing = tracer.isEnabled();
+    if (tracing) {
+        recvStartMicros = LatencyTracer::nowMicros();
+    }
+    int bytesRead = transport->receive(client_socket, buffer, sizeof(buffer));
+    if (tracing) {
+        recvEndMicros = LatencyTracer::nowMicros();
+    }
+
+    if (bytesRead == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+        return; // Nothing to read after all, the socket is non-blocking
+    }
+    if (bytesRead <= 0) {
+        // Client disconnected
+        std::cout << "Client disconnected: Socket FD " << client_socket << std::endl;
+
+        // Remove client from chatroom, close the socket and remove it from epoll monitoring.
+        // The session survives, the client may be back in a moment with its resume token.
+        handleClientDisconnect(client_socket, true);
+        return;
+    }
+
+    // Any traffic proves the peer is alive
+    ClientInfo& client = *found;
+    client.lastActivityMillis = nowMillis;
+    client.awaitingPong = false;
+
+    size_t consumed = 0;
+    if (client.readBuffer.empty()) {
+        // Common case: whole frames are handled straight out of the stack buffer
+        if (!processFrames(client_socket, buffer, bytesRead, consumed)) {
+            return;
+        }
+        if (consumed < static_cast<size_t>(bytesRead)) {
+            // Keep the partial frame in a pooled buffer until the rest arrives, with
+            // room for one more read so appending it doesn't reallocate
+            client.readBuffer.reserve(bytesRead - consumed + READ_CHUNK_SIZE);
+            client.readBuffer.append(buffer + consumed, bytesRead - consumed);
+        }
+        return;
+    }
+
+    client.readBuffer.append(buffer, bytesRead);
+    if (!processFrames(client_socket, client.readBuffer.data(), client.readBuffer.length(), consumed)) {
+        return;
+    }
+    client.readBuffer.consume(consumed); // Back to the pool once the last frame is complete
+}
+
+
+bool Server::processFrames(int client_socket, const char* data, size_t length, size_t& consumed) {
+    consumed = 0;
+    while (true) {
+        const char* payload;
+        size_t payloadLength;
+        FrameStatus status = Message::findFrame(data + consumed, length - consumed, payload, payloadLength);
+        if (status == FrameStatus::Incomplete) {
+            return true;
+        }
+        if (status == FrameStatus::Invalid) {
+            std::cerr << "Invalid frame from client: Socket FD " << client_socket << ", disconnecting." << std::endl;
+            handleClientDisconnect(client_socket, false);
+            return false;
+        }
+        consumed += Message::FRAME_HEADER_SIZE + payloadLength;
+        if (capture.isOpen()) {
+            capture.record(TraceRecordKind::FRAME, clientUsernames.find(client_socket)->connectionId, payload, payloadLength);
+        }
+        processClientMessage(client_socket, Message::parse(payload, payloadLength));
+
+        // Processing a message may disconnect the client, and with it free 'data'
+        if (clientUsernames.find(client_socket) == nullptr) {
+            return false;
+        }
+    }
+}
+
+
+void Server::displayMenu(int client_socket) {
+    std::stringstream menu;
+    // Greeting with username
+    ClientInfo* client = clientUsernames.find(client_socket);
+    menu << "Hello " << (client != nullptr ? client->username.str() : std::string()) << "!\n";
+    // Note about quitting
+    menu << "At any time, use /quit to exit the chat server.\n\n";
+
+    // Displaying available chatrooms
+    menu << "Available chatrooms:\n";
+    for (const auto& pair : chatrooms) {
+        menu << "---- " << pair.first << "\n"; // Chatroom name
+    }
+
+    // Instructions for joining and creating chatrooms
+    menu << "\nTo enter a chatroom, type its name and press Enter.\n";
+    menu << "Chatrooms you joined stay joined until you /leave or /part them, /rooms lists them.\n";
+    menu << "To create a new chatroom, use the command:\n\t /create [chatroom name];[forbidden words]\n";
+    menu << "\nExample: /create myRoom;word1,word2\n";
+
+    
+    // Send the formatted menu to the client
+    Message menuMessage(MessageType::MENU, menu.str());
+    sendMessage(client_socket, menuMessage);
+    std::cout << "Menu displayed to client: Socket FD " << client_socket << std::endl;
+}
+
+
+void Server::joinChatroom(int client_socket, const std::string& chatroomName, uint64_t nextSequence) {
+    Chatroom& chatroom = chatrooms[chatroomName];
+    ClientInfo* found = clientUsernames.find(client_socket);
+    if (found == nullptr) {
+        return;
+    }
+    ClientInfo& client = *found;
+    chatroom.addClient(client_socket);
+    client.chatrooms.insert(chatroom.getId());
+    client.activeChatroom = chatroom.getId();
+    std::cout << "Socket FD " << client_socket << " has joined room " << chatroomName << std::endl;
+
+    if (chatroom.getOwnerNode() != config.nodeId) {
+        // Our copy of a remote room is only kept current while we have members in it,
+        // so the first member subscribes and the owner's answer brings the history
+        if (chatroom.getClients().size() == 1) {
+            chatroom.setHistorySynced(false);
+            subscribeToOwner(chatroom);
+        }
+        if (!chatroom.isHistorySynced() && nodeLinks.find(chatroom.getOwnerNode()) != nodeLinks.end()) {
+            return;
+        }
+    }
+    if (nextSequence == FULL_HISTORY) {
+        sendChatroomHistory(client_socket, chatroom);
+    } else {
+        sendMissedMessages(client_socket, chatroom, nextSequence);
+    }
+}
+
+
+void Server::sendChatroomHistory(int client_socket, const Chatroom& chatroom) {
+    // The JOIN carries the room, the sequence of the first message it leaves out and as
+    // much of the history as fits one frame. The rest follows as CHAT messages, which
+    // carry their sequences, so the client ends up expecting the next message either way.
+    size_t budget = maxChatTextLength(chatroom.getName());
+    size_t count = chatroom.getMessageCount();
+    size_t included = 0;
+    size_t bytes = 0;
+    while (included < count && bytes + chatroom.getMessage(included).length() + 1 <= budget) {
+        bytes += chatroom.getMessage(included).length() + 1;
+        included++;
+    }
+    uint64_t first = chatroom.getFirstMessageNumber();
+    std::string chatHistory = chatroom.getName() + ";" + std::to_string(first + included) + ";";
+    chatHistory.reserve(chatHistory.length() + bytes);
+    for (size_t i = 0; i < included; i++) {
+        chatHistory += chatroom.getMessage(i);
+        chatHistory += "\n";
+    }
+    sendMessage(client_socket, Message(MessageType::JOIN, std::move(chatHistory)));
+
+    for (size_t i = included; i < count; i++) {
+        const std::string& body = chatroom.getMessage(i);
+        Message::serializeTo(MessageType::CHAT, chatroom.getName(), first + i, body.data(), body.length(), sendBuffer);
+        sendFrame(client_socket, MessageType::CHAT, sendBuffer);
+    }
+}
+
+
+// Longest text a CHAT frame of the room, or the history in its JOIN, can carry without
+// going over Message::MAX_FRAME_SIZE, which the client would take for a broken stream
+size_t Server::maxChatTextLength(const std::string& chatroomName) {
+    size_t overhead = CHAT_FRAME_OVERHEAD + chatroomName.length();
+    return overhead < Message::MAX_FRAME_SIZE ? Message::MAX_FRAME_SIZE - overhead : 0;
+}
+
+
+void Server::sendMissedMessages(int client_socket, const Chatroom& chatroom, uint64_t nextSequence) {
+    uint64_t first = chatroom.getFirstMessageNumber();
+    if (nextSequence < first || nextSequence > chatroom.getNextMessageNumber()) {
+        // Part of what the client missed was evicted (or the sequence is not ours), start over
+        sendChatroomHistory(client_socket, chatroom);
+        return;
+    }
+    for (uint64_t number = nextSequence; number < chatroom.getNextMessageNumber(); number++) {
+        const std::string& body = chatroom.getMessage(static_cast<size_t>(number - first));
+        Message::serializeTo(MessageType::CHAT, chatroom.getName(), number, body.data(), body.length(), sendBuffer);
+        sendFrame(client_socket, MessageType::CHAT, sendBuffer);
+    }
+    sendMessage(client_socket, Message(MessageType::POST, "Reconnected to chatroom '" + chatroom.getName() + "'."));
+}
+
+
+void Server::broadcastMessage(const std::string& chatroomName, MessageType type, std::string& body) {
+    Chatroom& chatroom = chatrooms[chatroomName];
+
+    if (chatroom.getOwnerNode() != config.nodeId) {
+        // The owner node orders the room's messages, it sends this one back to us
+        // together with everyone else's
+        peerWriter.clear();
+        peerWriter.writeU8(static_cast<uint8_t>(PeerMessageType::PUBLISH));
+        peerWriter.writeString(chatroomName);
+        peerWriter.writeU8(static_cast<uint8_t>(type));
+        peerWriter.writeString(body);
+        uint64_t startMicros = currentTrace != 0 ? LatencyTracer::nowMicros() : 0;
+        if (!sendToNode(chatroom.getOwnerNode())) {
+            std::cerr << "Owner of chatroom '" << chatroomName << "' is unreachable, message dropped." << std::endl;
+        }
+        if (currentTrace != 0) {
+            tracer.record(currentTrace, "forward to owner", startMicros, LatencyTracer::nowMicros());
+        }
+        return;
+    }
+
+    // Replace forbidden words
+    uint64_t censorMicros = currentTrace != 0 ? LatencyTracer::nowMicros() : 0;
+    chatroom.censorMessage(body);
+    if (body.length() > maxChatTextLength(chatroomName)) {
+        body.resize(maxChatTextLength(chatroomName)); // "****" can be longer than the word it hides
+    }
+    if (currentTrace != 0) {
+        tracer.record(currentTrace, "censor", censorMicros, LatencyTracer::nowMicros());
+    }
+    chatroom.setLastSequence(chatroom.getLastSequence() + 1);
+    deliverToChatroom(chatroom, type, body, chatroom.getLastSequence());
+
+    if (!chatroom.getSubscribedNodes().empty()) {
+        // One copy per peer node, each of them fans it out to its own members
+        peerWriter.clear();
+        peerWriter.writeU8(static_cast<uint8_t>(PeerMessageType::DELIVER));
+        peerWriter.writeString(chatroomName);
+        peerWriter.writeU64(chatroom.getLastSequence());
+        peerWriter.writeU8(static_cast<uint8_t>(type));
+        peerWriter.writeString(body);
+        for (int node : chatroom.getSubscribedNodes()) {
+            sendToNode(node);
+        }
+    }
+}
+
+
+void Server::deliverToChatroom(Chatroom& chatroom, MessageType type, const std::string& body, uint64_t sequence) {
+    // Serialize once into the room's log, the members are served from there once this
+    // batch of events is processed. Chat carries the sequence the owner node gave it.
+    if (type == MessageType::POST) {
+        Message::serializeTo(MessageType::CHAT, chatroom.getName(), sequence, body.data(), body.length(), broadcastFrame);
+    } else {
+        Message::serializeTo(type, body.data(), body.length(), broadcastFrame);
+    }
+    uint64_t traceId = currentTrace;
+    uint64_t appendMicros = traceId != 0 ? LatencyTracer::nowMicros() : 0;
+    chatroom.getLog().append(broadcastFrame, sequence + 1, traceId, appendMicros);
+    dirtyRooms.insert(chatroom.getId());
+
+    // Add to chat history
+    uint64_t historyMicros = traceId != 0 ? LatencyTracer::nowMicros() : 0;
+    chatroom.addMessage(body);
+    if (traceId != 0) {
+        tracer.record(traceId, "log append", appendMicros, historyMicros);
+        tracer.record(traceId, "history append", historyMicros, LatencyTracer::nowMicros());
+    }
+}
+
+
+void Server::serveRoomLogs() {
+    for (uint32_t id = dirtyRooms.next(0); id != RoomSet::NONE; id = dirtyRooms.next(id + 1)) {
+        serveRoomMembers(*chatroomsById[id]);
+    }
+    dirtyRooms.clear();
+}
+
+
+void Server::serveRoomMembers(Chatroom& chatroom) {
+    const std::vector<int>& members = chatroom.getClients();
+    std::vector<LogCursor>& cursors = chatroom.getCursors();
+    auto serve = [this, &chatroom, &members, &cursors](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            ClientInfo& client = *clientUsernames.find(members[i]);
+            if (cursors[i].index < chatroom.getLog().getHead() && !client.waitingForWritable &&
+                !pullRoomLog(client, chatroom, cursors[i])) {
+                // The rest goes out when the socket has room again
+                client.waitingForWritable = true;
+                updateClientEvents(client);
+            }
+        }
+    };
+    if (members.size() >= static_cast<size_t>(config.parallelFanoutMinMembers)) {
+        // Slices of a big room are served in parallel. A member is in one slice only,
+        // and nothing is appended to the log or joins the room until parallelFor returns.
+        fanoutPool.parallelFor(members.size(), FANOUT_CHUNK_SIZE, serve);
+    } else {
+        serve(0, members.size());
+    }
+}
+
+
+// Sends the member what it hasn't received from the room's log yet, without blocking.
+// Returns false if the socket couldn't take all of it. A frame that was cut off is
+// finished from 'outbound', so the cursor always stands at the start of a frame.
+// The log is only read once 'outbound' is empty, so queued replies go first.
+bool Server::pullRoomLog(ClientInfo& client, Chatroom& chatroom, LogCursor& cursor) {
+    if (!flushOutbound(client)) {
+        return false; // Another frame is still on its way, nothing can go in between
+    }
+    RoomLog& log = chatroom.getLog();
+    if (cursor.index < log.getTail()) {
+        resyncFromHistory(client, chatroom, cursor);
+        return flushOutbound(client);
+    }
+
+    struct iovec iov[LOG_IOV_BATCH];
+    while (cursor.index < log.getHead()) {
+        size_t count = log.gather(cursor.index, iov, LOG_IOV_BATCH);
+        uint64_t startMicros = tracer.isEnabled() ? LatencyTracer::nowMicros() : 0;
+        ssize_t sent = transport->sendv(client.socketNum, iov, count);
+        if (sent == -1 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return false; // Full, or broken, which reading from it will tell
+        }
+
+        uint64_t endMicros = tracer.isEnabled() ? LatencyTracer::nowMicros() : 0;
+        size_t remaining = static_cast<size_t>(sent);
+        while (remaining > 0) {
+            const std::string& frame = log.getFrame(cursor.index);
+            if (remaining < frame.length()) {
+                client.outbound.pushRest(TrafficClass::BULK, frame.data() + remaining, frame.length() - remaining);
+                remaining = 0;
+            } else {
+                remaining -= frame.length();
+            }
+            uint64_t traceId = log.getTraceId(cursor.index);
+            if (traceId != 0) {
+                tracer.record(traceId, "queued", log.getAppendedMicros(cursor.index), startMicros, client.socketNum);
+                tracer.record(traceId, "send", startMicros, endMicros, client.socketNum);
+            }
+            cursor.nextSequence = log.getNextSequence(cursor.index);
+            cursor.index++;
+        }
+        if (!client.outbound.empty()) {
+            return flushOutbound(client);
+        }
+    }
+    return true;
+}
+
+
+bool Server::pullClientRooms(ClientInfo& client) {
+    for (uint32_t id = client.chatrooms.next(0); id != RoomSet::NONE; id = client.chatrooms.next(id + 1)) {
+        Chatroom& chatroom = *chatroomsById[id];
+        LogCursor* cursor = chatroom.findCursor(client.socketNum);
+        if (cursor != nullptr && !pullRoomLog(client, chatroom, *cursor)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+// The log dropped frames the member hadn't received yet. The history still has the chat
+// messages among them, they are queued in 'outbound' and the cursor skips to the head.
+void Server::resyncFromHistory(ClientInfo& client, Chatroom& chatroom, LogCursor& cursor) {
+    lappedMembers++;
+    std::string frame; // Runs on the fanout threads too, so no shared scratch buffer
+    uint64_t first = chatroom.getFirstMessageNumber();
+    for (uint64_t number = std::max(cursor.nextSequence, first); number < chatroom.getNextMessageNumber(); number++) {
+        const std::string& body = chatroom.getMessage(static_cast<size_t>(number - first));
+        Message::serializeTo(MessageType::CHAT, chatroom.getName(), number, body.data(), body.length(), frame);
+        client.outbound.push(TrafficClass::BULK, frame);
+    }
+    cursor.index = chatroom.getLog().getHead();
+    cursor.nextSequence = chatroom.getNextMessageNumber();
+}
+
+
+// Before a handoff: whatever the members haven't received from the room logs is moved
+// to their 'outbound', which the snapshot carries to the successor.
+void Server::spoolRoomLogs() {
+    for (Chatroom* chatroom : chatroomsById) {
+        RoomLog& log = chatroom->getLog();
+        const std::vector<int>& members = chatroom->getClients();
+        std::vector<LogCursor>& cursors = chatroom->getCursors();
+        for (size_t i = 0; i < members.size(); i++) {
+            ClientInfo& client = *clientUsernames.find(members[i]); // Members always have a record
+            if (cursors[i].index < log.getTail()) {
+                resyncFromHistory(client, *chatroom, cursors[i]);
+            }
+            for (; cursors[i].index < log.getHead(); cursors[i].index++) {
+                client.outbound.push(TrafficClass::BULK, log.getFrame(cursors[i].index));
+            }
+            if (!client.outbound.empty()) {
+                // Sent by this process after all if the handoff fails
+                client.waitingForWritable = true;
+                updateClientEvents(client);
+            }
+        }
+    }
+    dirtyRooms.clear();
+}
+
+
+// Sends as much of 'outbound' as the socket takes without blocking, true once it is empty.
+// A CHUNK frame that was cut off is finished first, then the queue goes out by priority.
+bool Server::flushOutbound(ClientInfo& client) {
+    if (activeDownloads != 0 && client.download.frameRemaining > 0 &&
+        (!pumpDownload(client, client.download.frameRemaining) || client.download.frameRemaining > 0)) {
+        return false;
+    }
+    struct iovec iov[OutboundQueue::MAX_IOV];
+    while (!client.outbound.empty()) {
+        size_t count = client.outbound.gather(iov);
+        ssize_t sent = transport->sendv(client.socketNum, iov, count);
+        if (sent == -1 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return false;
+        }
+        client.outbound.consume(static_cast<size_t>(sent));
+    }
+    return true;
+}
+
+
+// EPOLLOUT is watched while a download or frames of the client's rooms wait for the socket.
+void Server::updateClientEvents(ClientInfo& client) {
+    bool wantsWritable = client.download.fd != -1 || client.waitingForWritable;
+    if (wantsWritable == client.watchingWritable) {
+        return;
+    }
+    transport->watchWritable(client.socketNum, wantsWritable);
+    client.watchingWritable = wantsWritable;
+}
+
+
+void Server::sendMessage(int client_socket, const Message& message) {
+    message.serializeTo(sendBuffer);
+    sendFrame(client_socket, message.getType(), sendBuffer);
+}
+
+
+// Sends a frame to a client without blocking. With nothing ahead of it, the frame goes
+// straight to the socket; otherwise, or for what the socket didn't take, it is queued
+// in the lane of its TrafficClass and sent once the socket has room, ahead of the room
+// traffic if it is a CONTROL frame.
+void Server::sendFrame(int client_socket, MessageType type, const std::string& frame) {
+    ClientInfo* client = clientUsernames.find(client_socket);
+    if (client == nullptr) {
+        return; // Gone already
+    }
+    size_t sent = 0;
+    if (client->outbound.empty() && client->download.frameRemaining == 0) {
+        ssize_t result = transport->send(client_socket, frame.data(), frame.length());
+        sent = result > 0 ? static_cast<size_t>(result) : 0;
+    }
+    if (sent == frame.length()) {
+        return;
+    }
+    if (sent == 0) {
+        client->outbound.push(trafficClassOf(type), frame);
+    } else {
+        client->outbound.pushRest(trafficClassOf(type), frame.data() + sent, frame.length() - sent);
+    }
+    if (!client->waitingForWritable) {
+        client->waitingForWritable = true;
+        updateClientEvents(*client);
+    }
+}
+
+
+void Server::processClientMessage(int client_socket, const MessageView& view) {
+    if (view.type == MessageType::CHUNK) {
+        // Raw file content, never copied
+        processChunkMessage(client_socket, view);
+        return;
+    }
+    // Messages aren't logged: a formatted write and a flush per POST would cost more than handling it
+
+    ClientInfo* found = clientUsernames.find(client_socket);
+    if (found == nullptr) {
+        return;
+    }
+    ClientInfo& client = *found;
+    if (view.type == MessageType::PONG) {
+        return; // Liveness was already recorded when the data arrived
+    }
+    client.lastChatActivityMillis = nowMillis;
+
+    // Until the client logged in, only LOGIN, RESUME and QUIT are accepted
+    if (!client.loggedIn && view.type != MessageType::LOGIN && view.type != MessageType::RESUME &&
+        view.type != MessageType::QUIT) {
+        return;
+    }
+
+    if (view.type == MessageType::POST) {
+        // The hot path works on the view, every other message gets its own copy
+        processPostMessage(client_socket, view);
+        return;
+    }
+
+    Message message(view);
+    switch (message.getType()) {
+        case MessageType::LOGIN:
+            if (!client.loggedIn) {
+                processLoginMessage(client_socket, message);
+            }
+            break;
+        case MessageType::RESUME:
+            if (!client.loggedIn) {
+                processResumeMessage(client_socket, message);
+            }
+            break;
+        case MessageType::JOIN:
+            processJoinMessage(client_socket, message);
+            break;
+        case MessageType::CREATE:
+            processCreateChatroomMessage(client_socket, message);
+            break;
+        case MessageType::MENU:
+            processMenuMessage(client_socket, message);
+            break;
+        case MessageType::SEARCH:
+            processSearchMessage(client_socket, message);
+            break;
+        case MessageType::PRESENCE:
+            processPresenceMessage(client_socket, message);
+            break;
+        case MessageType::ATTACH:
+            processAttachMessage(client_socket, message);
+            break;
+        case MessageType::DOWNLOAD:
+            processDownloadMessage(client_socket, message);
+            break;
+        case MessageType::PART:
+            processPartMessage(client_socket, message);
+            break;
+        case MessageType::QUIT:
+            handleClientDisconnect(client_socket, false);
+            break;
+        default:
+            // Handle unknown message type
+            break;
+    }
+}
+
+// JOIN
+void Server::processJoinMessage(int client_socket, const Message& message) {
+    std::string chatroomName = message.getBody();
+    auto it = chatrooms.find(chatroomName);
+    if (it == chatrooms.end()) {
+        Message errorMsg(MessageType::POST, "Chatroom '" + chatroomName + "' does not exist.");
+        sendMessage(client_socket, errorMsg);
+        return;
+    }
+
+    // The client keeps the rooms it is in, this one becomes the room it posts to
+    ClientInfo* found = clientUsernames.find(client_socket);
+    if (found == nullptr) {
+        return;
+    }
+    ClientInfo& client = *found;
+    if (client.chatrooms.contains(it->second.getId())) {
+        client.activeChatroom = it->second.getId();
+        sendChatroomHistory(client_socket, it->second);
+        return;
+    }
+    recordPresence(it->second, client.username.str(), true);
+    joinChatroom(client_socket, chatroomName);
+}
+
+
+void Server::processCreateChatroomMessage(int client_socket, const Message& message) {
+    std::string chatroomInfo = message.getBody();
+    std::istringstream ss(chatroomInfo);
+    std::string chatroomName;
+    std::getline(ss, chatroomName, ';');
+
+    if (chatrooms.find(chatroomName) == chatrooms.end()) {
+        std::set<std::string> forbiddenWords;
+        std::string word;
+        while (std::getline(ss, word, ',')) {
+            forbiddenWords.insert(word);
+        }
+        createChatroom(chatroomName, forbiddenWords);
+        announceChatroom(chatrooms[chatroomName], -1);
+        joinChatroom(client_socket, chatroomName); // Automatically join the creator to the chatroom
+        std::cout << "New chatroom '" << chatroomName << "' created and forbidden words set by client: " << client_socket << std::endl;
+    } else {
+        Message errorMsg(MessageType::POST, "Chatroom '" + chatroomName + "' already exists.");
+        sendMessage(client_socket, errorMsg);
+    }
+}
+
+
+
+// MENU
+void Server::processMenuMessage(int client_socket, const Message& message) {
+    std::string currentChatroom = findClientChatroom(client_socket);
+    std::cout << "Processing menu message for client " << client_socket << ". In chatroom: " << currentChatroom << std::endl; 
+    
+    if (!currentChatroom.empty()) {
+        displayMenu(client_socket);
+        leaveChatroom(client_socket, clientUsernames.find(client_socket)->activeChatroom);
+    } else {
+        Message notInChatroomMessage(MessageType::POST, "You are not currently in a chatroom.");
+        sendMessage(client_socket, notInChatroomMessage);
+    }
+}
+
+// QUIT
+// PART
+void Server::processPartMessage(int client_socket, const Message& message) {
+    ClientInfo* found = clientUsernames.find(client_socket);
+    if (found == nullptr) {
+        return;
+    }
+    ClientInfo& client = *found;
+    auto it = chatrooms.find(message.getBody());
+    if (it == chatrooms.end() || !client.chatrooms.contains(it->second.getId())) {
+        sendMessage(client_socket, Message(MessageType::POST, "You are not in chatroom '" + message.getBody() + "'."));
+        return;
+    }
+    if (it->second.getId() == client.activeChatroom) {
+        // Same as leaving it with /leave
+        displayMenu(client_socket);
+    } else {
+        sendMessage(client_socket, Message(MessageType::POST, "You left chatroom '" + message.getBody() + "'."));
+    }
+    leaveChatroom(client_socket, it->second.getId());
+}
+
+// POST
+void Server::processPostMessage(int client_socket, const MessageView& message) {
+    const std::string& chatroomName = findClientChatroom(client_socket);
+    if (!chatroomName.empty()) {
+        int ownerNode = chatrooms[chatroomName].getOwnerNode();
+        if (ownerNode != config.nodeId && nodeLinks.find(ownerNode) == nodeLinks.end()) {
+            Message unreachableMessage(MessageType::POST, "Chatroom '" + chatroomName + "' is unavailable right now, your message was dropped.");
+            sendMessage(client_socket, unreachableMessage);
+            return;
+        }
+        uint64_t traceId = tracer.sample();
+        uint64_t startMicros = 0;
+        if (traceId != 0) {
+            // "decode" covers finding and parsing the frame, and whatever frames came before it in the same read
+            startMicros = LatencyTracer::nowMicros();
+            tracer.record(traceId, "recv", recvStartMicros, recvEndMicros, client_socket);
+            tracer.record(traceId, "decode", recvEndMicros, startMicros, client_socket);
+        }
+        // The members get it as "[user]: text" in a CHAT frame, which has to stay a valid frame
+        const ClientInfo& author = *clientUsernames.find(client_socket);
+        size_t prefixLength = author.username.length() + 4;
+        size_t budget = maxChatTextLength(chatroomName);
+        if (message.bodyLength + prefixLength > budget) {
+            Message tooLongMessage(MessageType::POST, "Your message is too long, it was dropped. The limit is " +
+                                   std::to_string(budget > prefixLength ? budget - prefixLength : 0) + " bytes.");
+            sendMessage(client_socket, tooLongMessage);
+            return;
+        }
+        if (!checkPostRateLimits(client_socket, chatroomName, message.bodyLength)) {
+            return;
+        }
+        if (traceId != 0) {
+            tracer.record(traceId, "rate limit", startMicros, LatencyTracer::nowMicros(), client_socket);
+        }
+        // Format into a reused buffer instead of concatenating temporaries
+        postBuffer.clear();
+        postBuffer += "[";
+        postBuffer.append(author.username.c_str(), author.username.length());
+        postBuffer += "]: ";
+        postBuffer.append(message.body, message.bodyLength);
+        currentTrace = traceId;
+        broadcastMessage(chatroomName, MessageType::POST, postBuffer);
+        currentTrace = 0;
+        if (traceId != 0) {
+            tracer.record(traceId, "post", recvStartMicros, LatencyTracer::nowMicros(), client_socket);
+        }
+    } else {
+        Message notInChatroomMessage(MessageType::POST, "You need to join a chatroom to send messages.");
+        sendMessage(client_socket, notInChatroomMessage);
+    }
+}
+
+
+// SEARCH
+void Server::processSearchMessage(int client_socket, const Message& message) {
+    const std::string& chatroomName = findClientChatroom(client_socket);
+    if (chatroomName.empty()) {
+        sendMessage(client_socket, Message(MessageType::POST, "You need to join a chatroom to search it."));
+        return;
+    }
+    SearchIndex::tokenize(message.getBody(), searchTerms);
+    if (searchTerms.empty()) {
+        sendMessage(client_socket, Message(MessageType::POST, "Usage: /search <terms>"));
+        return;
+    }
+    // A search is heavier than a POST, it draws on the same budget
+    ClientInfo* found = clientUsernames.find(client_socket);
+    if (found == nullptr) {
+        return;
+    }
+    ClientInfo& client = *found;
+    if (!client.rateLimiter.allow(message.getBody().length(), nowMillis)) {
+        sendMessage(client_socket, Message(MessageType::POST, "You are searching too fast, try again in a moment."));
+        return;
+    }
+    if (searchTerms.size() > MAX_SEARCH_TERMS) {
+        searchTerms.resize(MAX_SEARCH_TERMS);
+    }
+
+    // Only the postings of the query terms are copied here, ranking them happens on the
+    // search thread
+    const Chatroom& chatroom = chatrooms[chatroomName];
+    SearchQuery query;
+    query.clientSocket = client_socket;
+    query.username = client.username.str();
+    query.chatroomName = chatroomName;
+    query.text = message.getBody();
+    query.limit = static_cast<size_t>(config.searchResultLimit);
+    for (const std::string& term : searchTerms) {
+        PostingList list;
+        if (chatroom.getSearchIndex().copyPostings(term, list)) {
+            query.lists.push_back(std::move(list));
+        }
+    }
+    searchWorker.submit(std::move(query));
+}
+
+
+void Server::handleSearchResults() {
+    searchWorker.collect(searchResults);
+    for (const SearchResult& result : searchResults) {
+        // The client may have left (and its socket number been reused) in the meantime
+        ClientInfo* client = clientUsernames.find(result.clientSocket);
+        auto roomIt = chatrooms.find(result.chatroomName);
+        if (client == nullptr || !(client->username == result.username) ||
+            roomIt == chatrooms.end()) {
+            continue;
+        }
+
+        const Chatroom& chatroom = roomIt->second;
+        std::stringstream reply;
+        reply << "Search results for '" << result.text << "' in chatroom '" << result.chatroomName << "' ("
+              << result.matchCount << " matching messages):\n";
+        for (uint64_t number : result.numbers) {
+            // Skip what the history evicted while the search ran
+            if (number < chatroom.getFirstMessageNumber()) {
+                continue;
+            }
+            size_t position = static_cast<size_t>(number - chatroom.getFirstMessageNumber());
+            if (position < chatroom.getMessageCount()) {
+                reply << "  #" << position + 1 << "/" << chatroom.getMessageCount() << " "
+                      << chatroom.getMessage(position) << "\n";
+            }
+        }
+        sendMessage(result.clientSocket, Message(MessageType::POST, reply.str()));
+    }
+    searchResults.clear();
+}
+
+
+bool Server::checkPostRateLimits(int client_socket, const std::string& chatroomName, size_t bytes) {
+    ClientInfo* found = clientUsernames.find(client_socket);
+    if (found == nullptr) {
+        return false;
+    }
+    ClientInfo& client = *found;
+    if (!client.rateLimiter.allow(bytes, nowMillis)) {
+        rateLimitStats.postsThrottledByClient++;
+        if (++client.throttledInARow >= config.maxThrottledMessages) {
+            std::cout << "Client " << client_socket << " keeps flooding, disconnecting." << std::endl;
+            rateLimitStats.clientsDisconnectedForFlooding++;
+            sendMessage(client_socket, Message(MessageType::QUIT, "Disconnected for flooding the chat."));
+            handleClientDisconnect(client_socket, false);
+        } else {
+            sendMessage(client_socket, Message(MessageType::POST, "You are sending messages too fast, your message was dropped."));
+        }
+        return false;
+    }
+    client.throttledInARow = 0;
+
+    // The room's budget protects the fanout when many clients post at once
+    if (!chatrooms[chatroomName].getRateLimiter().allow(bytes, nowMillis)) {
+        rateLimitStats.postsThrottledByRoom++;
+        sendMessage(client_socket, Message(MessageType::POST, "Chatroom '" + chatroomName + "' is too busy right now, your message was dropped."));
+        return false;
+    }
+
+    rateLimitStats.postsAccepted++;
+    return true;
+}
+
+
+void Server::logStats() {
+    std::cout << "Server stats:" << std::endl;
+    std::cout << "  clients connected:                  " << clientUsernames.size() << std::endl;
+    std::cout << "  chatrooms:                          " << chatrooms.size() << std::endl;
+    std::cout << "  posts accepted:                     " << rateLimitStats.postsAccepted << std::endl;
+    std::cout << "  posts throttled (client limit):     " << rateLimitStats.postsThrottledByClient << std::endl;
+    std::cout << "  posts throttled (room limit):       " << rateLimitStats.postsThrottledByRoom << std::endl;
+    std::cout << "  clients disconnected for flooding:  " << rateLimitStats.clientsDisconnectedForFlooding << std::endl;
+    std::cout << "  members resynced from the history:  " << lappedMembers << std::endl;
+    if (isFederated()) {
+        std::cout << "  peer nodes connected:               " << nodeLinks.size() << std::endl;
+    }
+    logMemoryStats();
+}
+
+
+// What the connections cost. Fixed costs (records, index, memberships, timers) are shared
+// out over all connections, an active one adds the buffers and upload state it holds.
+void Server::logMemoryStats() {
+    size_t activeConnections = 0;
+    size_t bufferBytes = 0;
+    for (ClientInfo& client : clientUsernames) {
+        size_t held = client.readBuffer.capacity() + client.outbound.capacity();
+        held += client.readBuffer.capacity() != 0 ? sizeof(std::string) : 0;
+        held += client.outbound.getHeldBuffers() * sizeof(std::string);
+        if (client.upload) {
+            held += sizeof(UploadState);
+        }
+        if (held != 0 || client.download.fd != -1) {
+            activeConnections++;
+            bufferBytes += held;
+        }
+    }
+    size_t membershipBytes = 0;
+    for (auto& pair : chatrooms) {
+        membershipBytes += pair.second.getClients().capacity() * sizeof(int) +
+                           pair.second.getCursors().capacity() * sizeof(LogCursor);
+    }
+    // Node and bucket of the hash set, the allocator's overhead is not counted
+    size_t usernameBytes = loggedInUsernames.bucket_count() * sizeof(void*) +
+                           loggedInUsernames.size() * (sizeof(std::string) + 2 * sizeof(void*));
+    size_t fixedBytes = clientUsernames.getSlabBytes() + clientUsernames.getIndexBytes() + membershipBytes +
+                        usernameBytes + timingWheel.getMemoryBytes();
+    size_t connections = std::max<size_t>(clientUsernames.size(), 1);
+
+    std::cout << "  session records:                    " << clientUsernames.size() << " of "
+              << clientUsernames.getRecordCapacity() << ", " << sizeof(ClientInfo) << " bytes each, "
+              << clientUsernames.getSlabBytes() << " bytes in slabs" << std::endl;
+    std::cout << "  connection index:                   " << clientUsernames.getIndexBytes() << " bytes" << std::endl;
+    std::cout << "  room memberships:                   " << membershipBytes << " bytes" << std::endl;
+    std::cout << "  username index:                     " << usernameBytes << " bytes" << std::endl;
+    std::cout << "  timers:                             " << timingWheel.getMemoryBytes() << " bytes" << std::endl;
+    std::cout << "  buffers held:                       " << bufferBytes << " bytes by " << activeConnections
+              << " active connections, " << PooledBuffer::sharedPool().getPooledBytes() << " bytes pooled" << std::endl;
+    std::cout << "  bytes per idle connection:          " << fixedBytes / connections << std::endl;
+    std::cout << "  bytes per active connection:        "
+              << fixedBytes / connections + bufferBytes / std::max<size_t>(activeConnections, 1) << std::endl;
+}
+
+
+void Server::exportTrace() {
+    if (!tracer.isEnabled()) {
+        std::cout << "Latency tracing is off, start the server with --trace-sample to enable it." << std::endl;
+        return;
+    }
+    if (tracer.exportChromeTrace(config.traceExportPath)) {
+        std::cout << "Latency trace written to " << config.traceExportPath << std::endl;
+    } else {
+        std::cerr << "Failed to write the latency trace to " << config.traceExportPath << std::endl;
+    }
+}
+
+
+void Server::leaveChatroom(int client_socket, uint32_t chatroomId) {
+    ClientInfo* found = clientUsernames.find(client_socket);
+    if (found == nullptr) {
+        return;
+    }
+    ClientInfo& client = *found;
+    if (client.chatrooms.contains(chatroomId)) {
+        Chatroom& chatroom = *chatroomsById[chatroomId];
+        const std::string& chatroomName = chatroom.getName();
+
+        // Remove the client from the chatroom's client list, and the room from the client's
         chatroom.removeClient(client_socket);
+        client.chatrooms.erase(chatroomId);
+        if (client.activeChatroom == chatroomId) {
+            client.activeChatroom = RoomSet::NONE;
+        }
+
+        if (chatroom.getOwnerNode() != config.nodeId && chatroom.getClients().empty()) {
+            // No local members left, stop receiving the room's traffic
+            peerWriter.clear();
+            peerWriter.writeU8(static_cast<uint8_t>(PeerMessageType::UNSUBSCRIBE));
+            peerWriter.writeString(chatroomName);
+            sendToNode(chatroom.getOwnerNode());
+            chatroom.setHistorySynced(false);
+        }
 
-        // Erase the client from the clientToChatroomMap
-        clientToChatroomMap.erase(it);
+        // The members hear about it with the other joins and leaves of this presence window
+        recordPresence(chatroom, client.username.str(), false);
 
-        // Broadcast a message that the client has left the chatroom
-        std::string leaveMsg = "[" + clientUsernames[client_socket].username + "] has left " + chatroomName;
-        Message leaveMessage(MessageType::POST, leaveMsg);
-        std::cout << "Broadcasting leave message for client " << client_socket << " in chatroom " << chatroomName << std::endl;
-        broadcastMessage(chatroomName, leaveMessage);
-        
         std::cout << "Client " << client_socket << " has left the chatroom: " << chatroomName << std::endl;
     }
 }
 
 
-void Server::handleClientDisconnect(int client_socket) {
-    std::string chatroomName = findClientChatroom(client_socket);
-    std::cout << "Handling client disconnect for client " << client_socket << ". In chatroom: " << chatroomName << std::endl;
-    if (!chatroomName.empty()) {
-        leaveChatroom(client_socket);
+void Server::leaveAllChatrooms(int client_socket) {
+    ClientInfo* client = clientUsernames.find(client_socket);
+    if (client == nullptr) {
+        return;
+    }
+    const RoomSet& joined = client->chatrooms;
+    for (uint32_t id = joined.next(0); id != RoomSet::NONE; id = joined.next(id + 1)) {
+        leaveChatroom(client_socket, id);
+    }
+}
+
+
+void Server::recordPresence(Chatroom& chatroom, const std::string& username, bool joined) {
+    PresenceDigest& digest = chatroom.getPresence();
+    bool wasEmpty = digest.empty();
+    if (joined) {
+        digest.join(username);
+    } else {
+        digest.leave(username);
+    }
+    notePresenceChange(chatroom, wasEmpty);
+}
+
+
+void Server::notePresenceChange(Chatroom& chatroom, bool wasEmpty) {
+    if (wasEmpty && !chatroom.getPresence().empty()) {
+        presenceRooms.push_back(chatroom.getName());
+    }
+    if (!presenceFlushScheduled) {
+        timingWheel.schedule(static_cast<uint64_t>(config.presenceWindowMillis), -1, PRESENCE_TIMER);
+        presenceFlushScheduled = true;
+    }
+}
+
+
+void Server::flushPresence() {
+    presenceFlushScheduled = false;
+    for (const std::string& name : presenceRooms) {
+        auto it = chatrooms.find(name);
+        if (it == chatrooms.end() || it->second.getPresence().empty()) {
+            continue; // Everyone who left came back within the window
+        }
+        Chatroom& chatroom = it->second;
+        PresenceDigest& digest = chatroom.getPresence();
+        if (chatroom.getOwnerNode() == config.nodeId) {
+            deliverPresence(chatroom, digest);
+            if (!chatroom.getSubscribedNodes().empty()) {
+                writePresence(chatroom, digest);
+                for (int node : chatroom.getSubscribedNodes()) {
+                    sendToNode(node);
+                }
+            }
+        } else {
+            // The owner merges the windows of all nodes and announces them together
+            writePresence(chatroom, digest);
+            sendToNode(chatroom.getOwnerNode());
+        }
+        digest.clear();
+    }
+    presenceRooms.clear();
+}
+
+
+void Server::deliverPresence(const Chatroom& chatroom, const PresenceDigest& digest) {
+    // Presence is not chat, it stays out of the history
+    std::string text = digest.describe(chatroom.getName());
+    Message::serializeTo(MessageType::PRESENCE, text.data(), text.length(), broadcastFrame);
+    for (int client_socket : chatroom.getClients()) {
+        if (clientUsernames.find(client_socket)->wantsPresence) { // Members always have a record
+            sendFrame(client_socket, MessageType::PRESENCE, broadcastFrame);
+        }
+    }
+}
+
+
+void Server::writePresence(const Chatroom& chatroom, const PresenceDigest& digest) {
+    uint32_t unlistedJoined = digest.getUnlistedJoined();
+    uint32_t unlistedLeft = digest.getUnlistedLeft();
+    size_t listed = std::min(digest.getChanges().size(), MAX_PEER_PRESENCE_NAMES);
+    auto it = digest.getChanges().begin();
+    std::advance(it, listed);
+    for (; it != digest.getChanges().end(); ++it) {
+        (it->second > 0 ? unlistedJoined : unlistedLeft)++;
+    }
+
+    peerWriter.clear();
+    peerWriter.writeU8(static_cast<uint8_t>(PeerMessageType::PRESENCE));
+    peerWriter.writeString(chatroom.getName());
+    peerWriter.writeU32(unlistedJoined);
+    peerWriter.writeU32(unlistedLeft);
+    peerWriter.writeU32(static_cast<uint32_t>(listed));
+    it = digest.getChanges().begin();
+    for (size_t i = 0; i < listed; i++, ++it) {
+        peerWriter.writeString(it->first);
+        peerWriter.writeU8(it->second > 0 ? 1 : 0);
+    }
+}
+
+
+void Server::processPeerPresence(int fd, SnapshotReader& reader) {
+    std::string name;
+    uint32_t unlistedJoined, unlistedLeft, count;
+    if (!reader.readString(name) || !reader.readU32(unlistedJoined) || !reader.readU32(unlistedLeft) ||
+        !reader.readU32(count)) {
+        return;
+    }
+    auto roomIt = chatrooms.find(name);
+    if (roomIt == chatrooms.end()) {
+        return;
+    }
+    Chatroom& chatroom = roomIt->second;
+
+    PresenceDigest received;
+    received.addUnlisted(unlistedJoined, unlistedLeft);
+    for (uint32_t i = 0; i < count; i++) {
+        std::string username;
+        uint8_t joined;
+        if (!reader.readString(username) || !reader.readU8(joined)) {
+            return;
+        }
+        if (joined) {
+            received.join(username);
+        } else {
+            received.leave(username);
+        }
+    }
+
+    if (chatroom.getOwnerNode() == config.nodeId) {
+        // Another node's window, it goes out with ours
+        PresenceDigest& digest = chatroom.getPresence();
+        bool wasEmpty = digest.empty();
+        for (const auto& pair : received.getChanges()) {
+            if (pair.second > 0) {
+                digest.join(pair.first);
+            } else {
+                digest.leave(pair.first);
+            }
+        }
+        digest.addUnlisted(unlistedJoined, unlistedLeft);
+        notePresenceChange(chatroom, wasEmpty);
+    } else if (chatroom.getOwnerNode() == peerLinks[fd].nodeId) {
+        deliverPresence(chatroom, received);
+    }
+}
+
+
+// PRESENCE
+void Server::processPresenceMessage(int client_socket, const Message& message) {
+    ClientInfo* client = clientUsernames.find(client_socket);
+    if (client == nullptr) {
+        return;
+    }
+    bool enable = message.getBody() != "off";
+    client->wantsPresence = enable;
+    Message reply(MessageType::POST, enable ? "Presence updates turned on." : "Presence updates turned off.");
+    sendMessage(client_socket, reply);
+}
+
+
+// ATTACH
+void Server::processAttachMessage(int client_socket, const Message& message) {
+    const std::string& chatroomName = findClientChatroom(client_socket);
+    if (chatroomName.empty()) {
+        sendMessage(client_socket, Message(MessageType::POST, "You need to join a chatroom to share a file."));
+        return;
+    }
+    ClientInfo* found = clientUsernames.find(client_socket);
+    if (found == nullptr) {
+        return;
+    }
+    ClientInfo& client = *found;
+    if (client.upload) {
+        sendMessage(client_socket, Message(MessageType::POST, "Wait for your current upload to finish."));
+        return;
+    }
+
+    size_t separator = message.getBody().rfind(';');
+    std::string name = message.getBody().substr(0, separator);
+    uint64_t size = separator != std::string::npos ? strtoull(message.getBody().c_str() + separator + 1, nullptr, 10) : 0;
+    name = name.substr(name.rfind('/') + 1); // Only the file name, never a path
+    if (name.empty() || name.length() > 100 || size == 0) {
+        sendMessage(client_socket, Message(MessageType::POST, "Usage: /attach <file>"));
+        return;
+    }
+    if (size > config.maxAttachmentBytes) {
+        sendMessage(client_socket, Message(MessageType::POST, "Attachments can be at most " +
+                                           std::to_string(config.maxAttachmentBytes) + " bytes."));
+        return;
+    }
+
+    // The CHUNKs of a refused upload are dropped as they arrive
+    client.upload.reset(new UploadState());
+    UploadState& upload = *client.upload;
+    upload.attachment.name = name;
+    upload.attachment.size = size;
+    upload.attachment.chatroomName = chatroomName;
+    upload.fd = attachments.createSpoolFile(upload.attachment);
+    if (upload.fd == -1) {
+        client.upload.reset();
+        sendMessage(client_socket, Message(MessageType::POST, "The server can't store attachments right now."));
+    }
+}
+
+
+// CHUNK
+void Server::processChunkMessage(int client_socket, const MessageView& view) {
+    ClientInfo* found = clientUsernames.find(client_socket);
+    if (found == nullptr) {
+        return;
+    }
+    ClientInfo& client = *found;
+    if (!client.upload) {
+        return;
+    }
+    UploadState& upload = *client.upload;
+    client.lastChatActivityMillis = nowMillis;
+    if (upload.received + view.bodyLength > upload.attachment.size) {
+        abortUpload(client);
+        sendMessage(client_socket, Message(MessageType::POST, "The upload was longer than announced and was dropped."));
+        return;
+    }
+
+    // Straight from the receive buffer to the page cache of the spool file
+    size_t written = 0;
+    while (written < view.bodyLength) {
+        ssize_t result = write(upload.fd, view.body + written, view.bodyLength - written);
+        if (result == -1 && errno == EINTR) {
+            continue;
+        }
+        if (result <= 0) {
+            std::cerr << "Error writing spool file: " << strerror(errno) << std::endl;
+            abortUpload(client);
+            sendMessage(client_socket, Message(MessageType::POST, "Storing the attachment failed."));
+            return;
+        }
+        written += static_cast<size_t>(result);
+    }
+    upload.received += view.bodyLength;
+    if (upload.received == upload.attachment.size) {
+        finishUpload(client);
+    }
+}
+
+
+void Server::finishUpload(ClientInfo& client) {
+    close(client.upload->fd);
+    std::unique_ptr<UploadState> upload(std::move(client.upload));
+    const Attachment& attachment = upload->attachment;
+    attachments.add(attachment);
+    std::cout << "Attachment #" << attachment.id << " '" << attachment.name << "' (" << attachment.size
+              << " bytes) stored for chatroom " << attachment.chatroomName << std::endl;
+
+    if (chatrooms.find(attachment.chatroomName) != chatrooms.end()) {
+        std::string announcement = "[" + client.username.str() + "] shared '" + attachment.name + "' (" +
+                                   std::to_string(attachment.size) + " bytes), type /download " +
+                                   std::to_string(attachment.id) + " to get it.";
+        broadcastMessage(attachment.chatroomName, MessageType::POST, announcement);
+    }
+}
+
+
+void Server::abortUpload(ClientInfo& client) {
+    close(client.upload->fd);
+    attachments.discard(client.upload->attachment.path);
+    client.upload.reset();
+}
+
+
+// DOWNLOAD
+void Server::processDownloadMessage(int client_socket, const Message& message) {
+    ClientInfo* found = clientUsernames.find(client_socket);
+    if (found == nullptr) {
+        return;
+    }
+    ClientInfo& client = *found;
+    uint64_t id = strtoull(message.getBody().c_str(), nullptr, 10);
+    const Attachment* attachment = attachments.find(id);
+    int file = -1;
+    auto room = attachment != nullptr ? chatrooms.find(attachment->chatroomName) : chatrooms.end();
+    if (room != chatrooms.end() && client.chatrooms.contains(room->second.getId())) {
+        file = open(attachment->path.c_str(), O_RDONLY | O_CLOEXEC);
+    }
+    if (file == -1) {
+        sendMessage(client_socket, Message(MessageType::POST, "Attachment #" + message.getBody() + " is not available in this chatroom."));
+        return;
+    }
+    if (client.download.fd != -1) {
+        close(file);
+        sendMessage(client_socket, Message(MessageType::POST, "Wait for your current download to finish."));
+        return;
+    }
+
+    sendMessage(client_socket, Message(MessageType::DOWNLOAD, std::to_string(attachment->id) + ";" + attachment->name +
+                                       ";" + std::to_string(attachment->size)));
+    client.download.fd = file;
+    client.download.id = attachment->id;
+    client.download.offset = 0;
+    client.download.size = attachment->size;
+    client.download.frameRemaining = 0;
+    activeDownloads++;
+
+    // The content goes out whenever the socket has room, between everyone else's events
+    updateClientEvents(client);
+}
+
+
+void Server::handleClientWritable(int client_socket) {
+    ClientInfo* found = clientUsernames.find(client_socket);
+    if (found == nullptr) {
+        return;
+    }
+    ClientInfo& client = *found;
+
+    // The queued frames first, then the chatrooms, then the download
+    if (client.waitingForWritable || !client.outbound.empty()) {
+        client.waitingForWritable = !(flushOutbound(client) && client.download.frameRemaining == 0 && pullClientRooms(client));
+    }
+    if (client.download.fd != -1 && client.outbound.empty()) {
+        if (!pumpDownload(client, DOWNLOAD_BYTES_PER_EVENT)) {
+            // The connection is broken, reading from it will tell
+            std::cerr << "Download to client " << client_socket << " failed: " << strerror(errno) << std::endl;
+            endDownload(client);
+        } else if (client.download.offset == client.download.size && client.download.frameRemaining == 0) {
+            std::cout << "Attachment #" << client.download.id << " sent to client " << client_socket << std::endl;
+            endDownload(client);
+        }
+    }
+    updateClientEvents(client);
+}
+
+
+bool Server::pumpDownload(ClientInfo& client, uint64_t budget) {
+    DownloadState& download = client.download;
+    bool ok = true;
+    while (budget > 0 && (download.frameRemaining > 0 || download.offset < download.size)) {
+        if (download.frameRemaining == 0 || download.headerRemaining > 0) {
+            // Frame header and type go through send(), the content follows straight from the file.
+            // The frame is under way once the first byte of its header went out.
+            uint64_t length = download.frameRemaining != 0 ? download.frameRemaining
+                                                           : std::min(DOWNLOAD_CHUNK_SIZE, download.size - download.offset);
+            char header[CHUNK_HEADER_CAPACITY];
+            size_t headerLength = writeChunkHeader(length, header);
+            size_t headerSent = download.frameRemaining != 0 ? headerLength - download.headerRemaining : 0;
+            ssize_t sent = transport->send(client.socketNum, header + headerSent, headerLength - headerSent);
+            if (sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
+            }
+            if (sent == -1) {
+                ok = false;
+                break;
+            }
+            download.frameRemaining = length;
+            download.headerRemaining = static_cast<uint8_t>(headerLength - headerSent - static_cast<size_t>(sent));
+            if (download.headerRemaining > 0) {
+                break; // The rest of the header goes first when the socket has room again
+            }
+        }
+
+        off_t offset = static_cast<off_t>(download.offset);
+        ssize_t sent = transport->sendFile(client.socketNum, download.fd, &offset,
+                                           static_cast<size_t>(std::min(download.frameRemaining, budget)));
+        if (sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        if (sent <= 0) {
+            ok = false;
+            break;
+        }
+        download.offset += static_cast<uint64_t>(sent);
+        download.frameRemaining -= static_cast<uint64_t>(sent);
+        budget -= std::min(budget, static_cast<uint64_t>(sent));
+    }
+    return ok;
+}
+
+
+// Writes the frame header and "type;" of a CHUNK frame with 'length' bytes of content into
+// 'header' (CHUNK_HEADER_CAPACITY bytes), returns how long they are. No shared buffer, the
+// fanout threads finish CHUNK frames too.
+size_t Server::writeChunkHeader(uint64_t length, char* header) {
+    char prefix[CHUNK_HEADER_CAPACITY - Message::FRAME_HEADER_SIZE];
+    int prefixLength = snprintf(prefix, sizeof(prefix), "%d;", static_cast<int>(MessageType::CHUNK));
+    uint32_t payloadLength = static_cast<uint32_t>(prefixLength + length);
+    header[0] = static_cast<char>((payloadLength >> 24) & 0xFF);
+    header[1] = static_cast<char>((payloadLength >> 16) & 0xFF);
+    header[2] = static_cast<char>((payloadLength >> 8) & 0xFF);
+    header[3] = static_cast<char>(payloadLength & 0xFF);
+    memcpy(header + Message::FRAME_HEADER_SIZE, prefix, static_cast<size_t>(prefixLength));
+    return Message::FRAME_HEADER_SIZE + static_cast<size_t>(prefixLength);
+}
+
+
+// Before a handoff: the rest of a CHUNK frame that is partly sent is read from the file
+// into 'outbound', ahead of everything queued, so the snapshot carries it to the successor
+// and the client's stream stays whole. False if the file couldn't be read.
+bool Server::spoolChunkFrame(ClientInfo& client) {
+    DownloadState& download = client.download;
+    char header[CHUNK_HEADER_CAPACITY];
+    size_t headerLength = writeChunkHeader(download.frameRemaining, header);
+    std::string rest(header + headerLength - download.headerRemaining, download.headerRemaining);
+    size_t contentStart = rest.length();
+    rest.resize(contentStart + static_cast<size_t>(download.frameRemaining));
+    size_t done = 0;
+    while (done < download.frameRemaining) {
+        ssize_t bytesRead = pread(download.fd, &rest[contentStart + done], static_cast<size_t>(download.frameRemaining) - done,
+                                  static_cast<off_t>(download.offset + done));
+        if (bytesRead == -1 && errno == EINTR) {
+            continue;
+        }
+        if (bytesRead <= 0) {
+            return false;
+        }
+        done += static_cast<size_t>(bytesRead);
+    }
+    client.outbound.pushRest(TrafficClass::BULK, rest.data(), rest.length());
+    download.offset += download.frameRemaining;
+    download.frameRemaining = 0;
+    download.headerRemaining = 0;
+    return true;
+}
+
+
+void Server::endDownload(ClientInfo& client) {
+    close(client.download.fd);
+    client.download = DownloadState();
+    activeDownloads--;
+    updateClientEvents(client);
+}
+
+
+void Server::interruptTransfers() {
+    std::vector<int> broken;
+    for (ClientInfo& client : clientUsernames) {
+        if (client.download.fd != -1) {
+            if (client.download.frameRemaining > 0 && !spoolChunkFrame(client)) {
+                std::cerr << "Reading attachment #" << client.download.id << " failed: " << strerror(errno) << std::endl;
+                broken.push_back(client.socketNum); // Its stream can't be completed any more
+                continue;
+            }
+            uint64_t id = client.download.id;
+            endDownload(client);
+            sendMessage(client.socketNum, Message(MessageType::POST, "The download of #" + std::to_string(id) +
+                                                  " was interrupted, please request it again."));
+        }
+        if (client.upload) {
+            abortUpload(client);
+            sendMessage(client.socketNum, Message(MessageType::POST, "Your upload was interrupted, please share the file again."));
+        }
+    }
+    for (int client_socket : broken) {
+        handleClientDisconnect(client_socket, true);
+    }
+}
+
+
+void Server::handleClientDisconnect(int client_socket, bool keepSession) {
+    std::cout << "Handling client disconnect for client " << client_socket << ". In chatroom: "
+              << findClientChatroom(client_socket) << std::endl;
+    ClientInfo* client = clientUsernames.find(client_socket);
+    if (keepSession && client != nullptr) {
+        detachSession(*client);
     }
+    leaveAllChatrooms(client_socket);
     closeClientConnection(client_socket);
 }
 
 
 void Server::closeClientConnection(int client_socket) {
+    ClientInfo* client = clientUsernames.find(client_socket);
+    if (client == nullptr) {
+        return;
+    }
     std::cout << "Closing Socket FD " << client_socket << std::endl;
-    close(client_socket);
+    timingWheel.cancel(client->timer);
+    if (capture.isOpen()) {
+        capture.record(TraceRecordKind::CLOSE, client->connectionId);
+    }
+    if (client->upload) {
+        abortUpload(*client);
+    }
+    if (client->download.fd != -1) {
+        close(client->download.fd);
+        activeDownloads--;
+    }
+    transport->close(client_socket);
+    if (client->loggedIn) {
+        loggedInUsernames.erase(client->username.str());
+    }
     clientUsernames.erase(client_socket);
 }
 
 
-std::string Server::findClientChatroom(int client_socket) {
-    // Iterate through all chatrooms
-    for (const auto& pair : chatrooms) {
-        const std::string& chatroomName = pair.first;
-        const Chatroom& chatroom = pair.second;
+// The room the client posts to.
+const std::string& Server::findClientChatroom(int client_socket) {
+    static const std::string noChatroom;
+    ClientInfo* client = clientUsernames.find(client_socket);
 
-        // Check if the client is in the current chatroom
-        if (chatroom.getClients().find(client_socket) != chatroom.getClients().end()) {
-            return chatroomName;
-        }
-    }
-    
     // Return an empty string if the client is not in any chatroom
-    return "";
+    if (client == nullptr || client->activeChatroom == RoomSet::NONE) {
+        return noChatroom;
+    }
+    return chatroomsById[client->activeChatroom]->getName();
 }
 
 
 bool Server::isUsernameAvailable(const std::string& username) {
-    // Check if username is already taken
-    for (const auto& pair : clientUsernames) {
-        if (pair.second.username == username) {
-            return false;
-        }
+    // A dropped session keeps its name until it expires
+    if (detachedUsernames.find(username) != detachedUsernames.end()) {
+        return false;
     }
 
-    return true;
+    // Check if username is already taken
+    return loggedInUsernames.find(username) == loggedInUsernames.end();
 }
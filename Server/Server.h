@@ -4,58 +4,275 @@
 #include <string>
 #include <vector>
 #include <unordered_map>
+#include <unordered_set>
 #include <set>
+#include <deque>
+#include <cstdint>
+#include <atomic>
 #include "Chatroom/Chatroom.h"
+#include "Chatroom/RoomSet.h"
+#include "TimingWheel/TimingWheel.h"
+#include "RateLimiter/RateLimiter.h"
+#include "ThreadPool/ThreadPool.h"
+#include "Search/SearchWorker.h"
+#include "Attachments/AttachmentStore.h"
+#include "Tracing/LatencyTracer.h"
+#include "Handoff/Handoff.h"
+#include "Federation/PeerLink.h"
+#include "Transport/TcpTransport.h"
+#include "ClientTable/ClientTable.h"
+#include "ServerConfig.h"
 #include "../common/Message.h" 
+#include "../common/BufferPool.h"
+#include "../common/Trace.h"
 
 
-class ClientInfo {
-public:
+// A logged-in session whose connection dropped, kept until it is resumed or expires.
+struct DetachedSession {
     std::string username;
-    int socketNum;
+    std::vector<std::string> chatroomNames; // The room the client posted to comes last
+    uint64_t expiresMillis;
+};
+
+// Counters of the rate limiter, printed when the server receives SIGUSR1.
+struct RateLimitStats {
+    uint64_t postsAccepted = 0;
+    uint64_t postsThrottledByClient = 0;
+    uint64_t postsThrottledByRoom = 0;
+    uint64_t clientsDisconnectedForFlooding = 0;
 };
 
 class Server {
 public:
-    Server(const std::string& ip, int port);
+    // Clients connect over TCP unless another transport is given, which must outlive the server
+    Server(const std::string& ip, int port, const ServerConfig& config = ServerConfig(),
+           Transport* transport = nullptr);
     virtual ~Server();
     bool init();
     void run();
+    void stop();
     
 
 private:
+    enum TimerKind {
+        LOGIN_TIMER,     // Fires if the client didn't log in in time
+        HEARTBEAT_TIMER, // Fires when the client may have gone quiet or idle
+        PONG_TIMER,      // Fires when the answer to a PING is due
+        PEER_RECONNECT_TIMER, // Fires when a failed peer link should be dialed again
+        PEER_HEARTBEAT_TIMER, // Fires when a peer link may need a heartbeat or went quiet
+        PRESENCE_TIMER   // Fires when the presence window closes
+    };
+
+    static const size_t READ_CHUNK_SIZE = 4096;
+
+    // Members one fanout thread sends to before it claims the next slice of a room
+    static const size_t FANOUT_CHUNK_SIZE = 512;
+
+    // Terms of a /search beyond this many are ignored
+    static const size_t MAX_SEARCH_TERMS = 8;
+
+    // Usernames one PRESENCE peer message lists, the rest travel as counts
+    static const size_t MAX_PEER_PRESENCE_NAMES = 1000;
+
+    // A peer link with this many bytes waiting to be sent is given up and dialed again
+    static const size_t MAX_PEER_BACKLOG = 64 * 1024 * 1024;
+
+    // joinChatroom sends the whole history unless it is given the next sequence the client expects
+    static const uint64_t FULL_HISTORY = UINT64_MAX;
+
+    // Payload bytes of a CHAT or JOIN frame besides the room name and the text: the type,
+    // a sequence of up to 20 digits and the separators
+    static const size_t CHAT_FRAME_OVERHEAD = 32;
+
+    // Content bytes per CHUNK frame of a download, and how much of a download is sent
+    // each time the socket becomes writable before other connections get their turn
+    static const uint64_t DOWNLOAD_CHUNK_SIZE = 256 * 1024;
+    static const size_t CHUNK_HEADER_CAPACITY = 16; // Frame header and "type;" of a CHUNK frame
+    static const uint64_t DOWNLOAD_BYTES_PER_EVENT = 1024 * 1024;
+
+    // Frames of a room log handed to one sendmsg() call
+    static const size_t LOG_IOV_BATCH = 64;
+
+    // Connection events taken from the transport per wakeup
+    static const size_t MAX_TRANSPORT_EVENTS = 64;
+
+    // Bumped whenever the layout of the handoff snapshot changes
+    static const uint32_t SNAPSHOT_VERSION = 8;
+
+    // How long a handoff waits for the successor to take the state and to answer
+    // before this process takes its connections back
+    static const int HANDOFF_TIMEOUT_SECONDS = 10;
+
     std::string ip;
     int port;
-    int server_fd;
+    ServerConfig config;
+    TcpTransport tcpTransport; // Also holds the listening socket that travels with a handoff
+    Transport* transport;      // Carries the client connections, &tcpTransport by default
     int epoll_fd;
-    std::unordered_map<int, ClientInfo> clientUsernames; // Map socket FD to ClientInfo
+    int timer_fd;
+    int handoff_fd;
+    int federation_fd;
+    bool handedOff;
+    uint64_t nowMillis; // Monotonic time, refreshed once per event loop iteration
+    TimingWheel timingWheel;
+    std::vector<TimingWheel::Expired> expiredTimers;
+    RateLimitStats rateLimitStats;
+
+    // Scratch buffers of the message hot path, reused so a POST doesn't allocate once they are warm
+    std::string postBuffer;
+    std::string broadcastFrame;
+    std::string sendBuffer;
+
+    // Helps the event loop send a broadcast to the members of big rooms
+    ThreadPool fanoutPool;
+
+    // Rooms with frames appended to their log since their members were last served
+    RoomSet dirtyRooms;
+    std::atomic<uint64_t> lappedMembers; // Members that caught up from the history instead
+
+    // Sessions that can be resumed, by token, and the order in which they expire
+    std::unordered_map<std::string, DetachedSession> detachedSessions;
+    std::unordered_map<std::string, std::string> detachedUsernames; // Username -> token
+    std::deque<std::pair<uint64_t, std::string>> detachedExpiry;
+
+    // Chatrooms with joins or leaves in the current presence window
+    std::vector<std::string> presenceRooms;
+    bool presenceFlushScheduled = false;
+
+    AttachmentStore attachments;
+    int activeDownloads = 0; // While 0, flushOutbound needn't care about half-sent CHUNK frames
+
+    // Traffic capture, see --capture
+    TraceWriter capture;
+    uint32_t nextConnectionId = 1;
+
+    // Sampled latency tracing, see --trace-sample. The receive timestamps are only
+    // taken while it is enabled.
+    LatencyTracer tracer;
+    uint64_t currentTrace = 0; // Trace id of the message being processed, 0 = not sampled
+    uint64_t recvStartMicros = 0;
+    uint64_t recvEndMicros = 0;
+
+    SearchWorker searchWorker;
+    std::vector<std::string> searchTerms;
+    std::vector<SearchResult> searchResults;
+    ClientTable clientUsernames;                         // Map socket FD to ClientInfo
+    std::unordered_set<std::string> loggedInUsernames;   // Usernames of the logged-in clients
     std::unordered_map<std::string, Chatroom> chatrooms; // Map chatroom name to Chatroom
-    std::unordered_map<int, std::string> clientToChatroomMap; // Maps client socket to chatroom name
+    std::vector<Chatroom*> chatroomsById;                // Rooms are never removed, their ids stay dense
+
+    // Federation with other server nodes
+    std::unordered_map<int, PeerLink> peerLinks; // Map link socket FD to PeerLink
+    std::unordered_map<int, int> nodeLinks;      // Map node id to the socket FD of its link
+    SnapshotWriter peerWriter;                   // Payload of the peer message being built
+    std::string peerFrame;
 
-    bool createServerSocket();
     bool initEpoll();
+    bool initTimer();
+    void handleTimerTick();
+    void handleExpiredTimer(const TimingWheel::Expired& timer);
+    void scheduleTimer(ClientInfo& client, uint64_t delayMillis, TimerKind kind);
+    void scheduleHeartbeat(ClientInfo& client);
+    void checkHeartbeat(ClientInfo& client);
+    bool initSearch();
+    static uint64_t monotonicMillis();
+    static size_t fanoutThreadCount(int configured);
+    bool initHandoff();
+    void handleHandoffRequest();
+    bool takeOver(int& channel);
+    std::string buildSnapshot(std::vector<int>& fds);
+    bool restoreSnapshot(const std::string& snapshot, const std::vector<int>& fds);
+    bool registerRestoredClients();
+    bool checkPostRateLimits(int client_socket, const std::string& chatroomName, size_t bytes);
+    void logStats();
+    void logMemoryStats();
+    void exportTrace();
+    bool isFederated() const;
+    bool initFederation();
+    void connectToPeer(int peerIndex);
+    void registerPeerLink(int fd, int peerIndex, bool connecting);
+    void handleNewPeer();
+    void startPeerLink(PeerLink& link);
+    void handlePeerEvent(int fd, uint32_t events);
+    void handlePeerData(int fd);
+    void flushPeerLink(PeerLink& link);
+    void updatePeerEvents(PeerLink& link);
+    void breakPeerLink(PeerLink& link);
+    void checkPeerLink(PeerLink& link);
+    void processPeerMessage(int fd, const char* payload, size_t length);
+    void processPeerHello(int fd, int nodeId);
+    void processRoomAnnouncement(const std::string& name, int ownerNode, const std::set<std::string>& forbiddenWords);
+    void sendPeerHistory(int fd, const Chatroom& chatroom, bool hasCopy, uint64_t after);
+    void processPeerHistory(int fd, SnapshotReader& reader);
+    void announceChatroom(const Chatroom& chatroom, int node);
+    void subscribeToOwner(Chatroom& chatroom);
+    void closePeerLink(int fd, bool reconnect);
+    bool sendToNode(int node);
+    bool sendPeerMessage(int fd);
     void handleClientData(int client_socket);
-    void processClientMessage(int client_socket, const std::string& serializedMessage);
+    bool processFrames(int client_socket, const char* data, size_t length, size_t& consumed);
+    void processClientMessage(int client_socket, const MessageView& view);
     void sendWelcomeMessage(int client_socket);
     void createChatroom(const std::string& name, const std::set<std::string>& forbiddenWords = {});
-    void handleUsernameRequest(int client_socket);
+    Chatroom& addChatroom(const std::string& name, const std::set<std::string>& forbiddenWords);
+    void processLoginMessage(int client_socket, const Message& message);
+    void completeLogin(int client_socket, const std::string& username);
+    void processResumeMessage(int client_socket, const Message& message);
+    void detachSession(ClientInfo& client);
+    void expireDetachedSessions();
+    static std::string newResumeToken();
     void displayMenu(int client_socket);
-    void joinChatroom(int client_socket, const std::string& chatroomName);
-    void broadcastMessage(const std::string& chatroomName, const Message& message);
-    void handleClientDisconnect(int client_socket);
+    void joinChatroom(int client_socket, const std::string& chatroomName, uint64_t nextSequence = FULL_HISTORY);
+    void sendMissedMessages(int client_socket, const Chatroom& chatroom, uint64_t nextSequence);
+    void sendChatroomHistory(int client_socket, const Chatroom& chatroom);
+    static size_t maxChatTextLength(const std::string& chatroomName);
+    void broadcastMessage(const std::string& chatroomName, MessageType type, std::string& body);
+    void deliverToChatroom(Chatroom& chatroom, MessageType type, const std::string& body, uint64_t sequence);
+    void serveRoomLogs();
+    void serveRoomMembers(Chatroom& chatroom);
+    bool pullRoomLog(ClientInfo& client, Chatroom& chatroom, LogCursor& cursor);
+    bool pullClientRooms(ClientInfo& client);
+    void resyncFromHistory(ClientInfo& client, Chatroom& chatroom, LogCursor& cursor);
+    void spoolRoomLogs();
+    bool flushOutbound(ClientInfo& client);
+    void updateClientEvents(ClientInfo& client);
+    void recordPresence(Chatroom& chatroom, const std::string& username, bool joined);
+    void notePresenceChange(Chatroom& chatroom, bool wasEmpty);
+    void flushPresence();
+    void deliverPresence(const Chatroom& chatroom, const PresenceDigest& digest);
+    void writePresence(const Chatroom& chatroom, const PresenceDigest& digest);
+    void processPeerPresence(int fd, SnapshotReader& reader);
+    void processPresenceMessage(int client_socket, const Message& message);
+    void processAttachMessage(int client_socket, const Message& message);
+    void processChunkMessage(int client_socket, const MessageView& view);
+    void finishUpload(ClientInfo& client);
+    void abortUpload(ClientInfo& client);
+    void processDownloadMessage(int client_socket, const Message& message);
+    void handleClientWritable(int client_socket);
+    bool pumpDownload(ClientInfo& client, uint64_t budget);
+    static size_t writeChunkHeader(uint64_t length, char* header);
+    bool spoolChunkFrame(ClientInfo& client);
+    void endDownload(ClientInfo& client);
+    void interruptTransfers();
+    void handleClientDisconnect(int client_socket, bool keepSession);
     void closeClientConnection(int client_socket);
-    void leaveChatroom(int client_socket);
+    void leaveChatroom(int client_socket, uint32_t chatroomId);
+    void leaveAllChatrooms(int client_socket);
+    void processPartMessage(int client_socket, const Message& message);
     bool containsForbiddenWords(const std::string& chatroomName, const std::string& message);
-    void handleNewConnection();
+    void handleTransportEvents();
+    void handleNewConnection(int client_socket);
     void closeAllConnections();
     void processJoinMessage(int client_socket, const Message& message);
     void processCreateChatroomMessage(int client_socket, const Message &message);
-    std::string findClientChatroom(int client_socket);
+    const std::string& findClientChatroom(int client_socket);
     bool isUsernameAvailable(const std::string &username);
     void processMenuMessage(int client_socket, const Message &message);
-    void processQuitMessage(int client_socket, const Message& message);
-    void processPostMessage(int client_socket, const Message& message);
+    void processPostMessage(int client_socket, const MessageView& message);
+    void processSearchMessage(int client_socket, const Message& message);
+    void handleSearchResults();
     void sendMessage(int client_socket, const Message& message);
+    void sendFrame(int client_socket, MessageType type, const std::string& frame);
 
 };
 
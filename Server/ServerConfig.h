@@ -0,0 +1,104 @@
+#ifndef SERVERCONFIG_H
+#define SERVERCONFIG_H
+
+#include <string>
+#include <vector>
+
+// Tunables of the server. The defaults are used unless overridden on the command line.
+struct ServerConfig {
+    // Connections that don't send a LOGIN within this time are closed.
+    int loginTimeoutSeconds = 30;
+
+    // A client that was quiet for this long receives a PING.
+    int heartbeatIntervalSeconds = 30;
+
+    // A client that doesn't answer a PING within this time is considered dead.
+    int heartbeatTimeoutSeconds = 10;
+
+    // Clients that send no chat traffic (anything but PONG) for this long are
+    // disconnected. 0 disables the idle timeout.
+    int idleTimeoutSeconds = 0;
+
+    // Resolution of the timing wheel and number of slots in it.
+    int timerTickMillis = 100;
+    int timerSlots = 4096;
+
+    // Token bucket limits on POSTs, per client and per chatroom. Rates are per second,
+    // bursts are the bucket sizes. A rate of 0 disables that limit.
+    double clientMessagesPerSecond = 5;
+    double clientMessageBurst = 10;
+    double clientBytesPerSecond = 4096;
+    double clientByteBurst = 16384;
+    double roomMessagesPerSecond = 200;
+    double roomMessageBurst = 400;
+    double roomBytesPerSecond = 262144;
+    double roomByteBurst = 1048576;
+
+    // Number of messages each chatroom keeps in its history.
+    int historyLimit = 1000;
+
+    // Bytes of recent broadcasts each chatroom keeps for members whose sockets fell
+    // behind. A member that falls further behind catches up from the history.
+    uint64_t roomLogBytes = 4 * 1024 * 1024;
+
+    // Broadcasts to rooms with at least this many local members are split across the
+    // fanout threads. -1 threads means one less than the number of cores, 0 keeps
+    // every broadcast on the event loop thread.
+    int fanoutThreads = -1;
+    int parallelFanoutMinMembers = 2048;
+
+    // Joins and leaves are collected for this long and then announced in one message.
+    int presenceWindowMillis = 1000;
+
+    // A session whose connection dropped can be resumed with its token for this long.
+    // 0 disables resuming.
+    int resumeGraceSeconds = 120;
+
+    // Attachments are spooled to files in this directory. Uploads larger than
+    // maxAttachmentBytes are refused, beyond maxAttachments the oldest one is deleted.
+    // Several servers can share the directory.
+    std::string attachmentDirectory = "/tmp/chatroom-attachments";
+    uint64_t maxAttachmentBytes = 64ULL * 1024 * 1024;
+    int maxAttachments = 100;
+
+    // Matches a /search returns at most.
+    int searchResultLimit = 10;
+
+    // A client whose POSTs are throttled this many times in a row is disconnected.
+    int maxThrottledMessages = 20;
+
+    // UNIX socket on which the server waits for a successor process to hand its
+    // listening socket, connections and state to. Empty disables handoff.
+    std::string handoffSocketPath;
+
+    // Start by taking over from the server listening on handoffSocketPath instead
+    // of opening a new listening socket.
+    bool takeover = false;
+
+    // Federation: the id of this node (unique among the nodes), the port on which it
+    // accepts links from other nodes (0 = none) and the "host:port" of the nodes it dials.
+    int nodeId = 0;
+    int federationPort = 0;
+    std::vector<std::string> peers;
+
+    // Delay before a failed link to a peer is dialed again.
+    int peerReconnectSeconds = 2;
+
+    // A link that carried nothing else for this long sends a heartbeat. A link on which
+    // nothing arrived for peerTimeoutSeconds (or that didn't connect in that time) is
+    // closed, and dialed again if we dialed it.
+    int peerHeartbeatSeconds = 5;
+    int peerTimeoutSeconds = 15;
+
+    // Records every frame the clients send to this trace file, for the Replay tool.
+    // Empty disables capturing.
+    std::string capturePath;
+
+    // Latency tracing: one POST in traceSampleInterval is followed through the server
+    // stage by stage (0 = off). SIGUSR2 writes the recent spans to traceExportPath as
+    // Chrome trace-event JSON, so does shutting down.
+    int traceSampleInterval = 0;
+    std::string traceExportPath = "/tmp/chatroom-trace.json";
+};
+
+#endif // SERVERCONFIG_H
@@ -0,0 +1,81 @@
+#include "ThreadPool.h"
+#include <algorithm>
+
+ThreadPool::ThreadPool(size_t threadCount) : nextIndex(0) {
+    for (size_t i = 0; i < threadCount; i++) {
+        workers.emplace_back(&ThreadPool::workerLoop, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    workReady.notify_all();
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+size_t ThreadPool::size() const {
+    return workers.size();
+}
+
+void ThreadPool::parallelFor(size_t count, size_t chunkSize, const Task& job) {
+    if (chunkSize == 0) {
+        chunkSize = 1;
+    }
+    if (workers.empty() || count <= chunkSize) {
+        job(0, count);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        task = &job;
+        taskCount = count;
+        taskChunkSize = chunkSize;
+        nextIndex = 0;
+        busyWorkers = workers.size();
+        generation++;
+    }
+    workReady.notify_all();
+
+    runChunks();
+
+    // 'job' lives on the caller's stack, no worker may still be looking at it
+    std::unique_lock<std::mutex> lock(mutex);
+    workDone.wait(lock, [this] { return busyWorkers == 0; });
+    task = nullptr;
+}
+
+void ThreadPool::workerLoop() {
+    uint64_t seenGeneration = 0;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        workReady.wait(lock, [this, seenGeneration] { return stopping || generation != seenGeneration; });
+        if (stopping) {
+            return;
+        }
+        seenGeneration = generation;
+
+        lock.unlock();
+        runChunks();
+        lock.lock();
+
+        if (--busyWorkers == 0) {
+            workDone.notify_one();
+        }
+    }
+}
+
+void ThreadPool::runChunks() {
+    while (true) {
+        size_t begin = nextIndex.fetch_add(taskChunkSize);
+        if (begin >= taskCount) {
+            return;
+        }
+        (*task)(begin, std::min(begin + taskChunkSize, taskCount));
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <cstddef>
+#include <cstdint>
+
+// Fixed set of worker threads that split a range of indices between them. The
+// calling thread works along, so a pool of N threads runs a job on N + 1 cores.
+class ThreadPool {
+public:
+    typedef std::function<void(size_t begin, size_t end)> Task;
+
+    explicit ThreadPool(size_t threadCount);
+    ~ThreadPool();
+
+    size_t size() const;
+
+    // Runs 'task' over [0, count) in chunks of 'chunkSize' indices and returns once
+    // every chunk is done. Chunks are claimed one at a time, so a chunk that is slow
+    // (say, a member whose socket buffer is full) doesn't hold the others back.
+    void parallelFor(size_t count, size_t chunkSize, const Task& task);
+
+private:
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable workReady;
+    std::condition_variable workDone;
+    bool stopping = false;
+
+    // The job being run, published under 'mutex' by bumping 'generation'
+    uint64_t generation = 0;
+    const Task* task = nullptr;
+    size_t taskCount = 0;
+    size_t taskChunkSize = 0;
+    std::atomic<size_t> nextIndex;
+    size_t busyWorkers = 0;
+
+    void workerLoop();
+    void runChunks();
+};
+
+#endif // THREADPOOL_H
@@ -0,0 +1,120 @@
+#include "TimingWheel.h"
+
+const TimingWheel::TimerId TimingWheel::NO_TIMER;
+const uint32_t TimingWheel::NIL;
+
+TimingWheel::TimingWheel(size_t slotCount, uint32_t tickMillis)
+    : tickMillis(tickMillis == 0 ? 1 : tickMillis), currentSlot(0), activeCount(0), freeList(NIL),
+      slots(slotCount == 0 ? 1 : slotCount, NIL) {}
+
+TimingWheel::TimerId TimingWheel::schedule(uint64_t delayMillis, int fd, int kind) {
+    // Round up so a timer never fires early, and always land at least one tick ahead
+    uint64_t ticks = (delayMillis + tickMillis - 1) / tickMillis;
+    if (ticks == 0) {
+        ticks = 1;
+    }
+
+    uint32_t index = allocateNode();
+    Node& node = nodes[index];
+    node.slot = static_cast<uint32_t>((currentSlot + ticks) % slots.size());
+    node.rounds = (ticks - 1) / slots.size();
+    node.fd = fd;
+    node.kind = kind;
+    node.active = true;
+
+    // Push at the head of the slot's list
+    node.prev = NIL;
+    node.next = slots[node.slot];
+    if (node.next != NIL) {
+        nodes[node.next].prev = index;
+    }
+    slots[node.slot] = index;
+    activeCount++;
+
+    return (static_cast<uint64_t>(node.generation) << 32) | index;
+}
+
+void TimingWheel::cancel(TimerId id) {
+    if (id == NO_TIMER) {
+        return;
+    }
+    uint32_t index = static_cast<uint32_t>(id & 0xFFFFFFFF);
+    uint32_t generation = static_cast<uint32_t>(id >> 32);
+    if (index >= nodes.size() || !nodes[index].active || nodes[index].generation != generation) {
+        return; // Already fired or cancelled
+    }
+    unlink(index);
+    release(index);
+}
+
+void TimingWheel::tick(std::vector<Expired>& expired) {
+    currentSlot = (currentSlot + 1) % slots.size();
+
+    uint32_t index = slots[currentSlot];
+    while (index != NIL) {
+        uint32_t next = nodes[index].next;
+        Node& node = nodes[index];
+        if (node.rounds > 0) {
+            node.rounds--;
+        } else {
+            Expired timer;
+            timer.id = (static_cast<uint64_t>(node.generation) << 32) | index;
+            timer.fd = node.fd;
+            timer.kind = node.kind;
+            expired.push_back(timer);
+            unlink(index);
+            release(index);
+        }
+        index = next;
+    }
+}
+
+uint32_t TimingWheel::getTickMillis() const {
+    return tickMillis;
+}
+
+size_t TimingWheel::size() const {
+    return activeCount;
+}
+
+size_t TimingWheel::getMemoryBytes() const {
+    return slots.capacity() * sizeof(uint32_t) + nodes.capacity() * sizeof(Node);
+}
+
+uint32_t TimingWheel::allocateNode() {
+    if (freeList != NIL) {
+        uint32_t index = freeList;
+        freeList = nodes[index].next;
+        return index;
+    }
+    Node node;
+    node.generation = 1;
+    node.active = false;
+    nodes.push_back(node);
+    return static_cast<uint32_t>(nodes.size() - 1);
+}
+
+void TimingWheel::unlink(uint32_t index) {
+    Node& node = nodes[index];
+    if (node.prev != NIL) {
+        nodes[node.prev].next = node.next;
+    } else {
+        slots[node.slot] = node.next;
+    }
+    if (node.next != NIL) {
+        nodes[node.next].prev = node.prev;
+    }
+}
+
+void TimingWheel::release(uint32_t index) {
+    Node& node = nodes[index];
+    node.active = false;
+    // Bump the generation so stale TimerIds pointing at this node are ignored
+    node.generation++;
+    if (node.generation == 0) {
+        node.generation = 1;
+    }
+    node.next = freeList;
+    freeList = index;
+    activeCount--;
+}
@@ -0,0 +1,64 @@
+#ifndef TIMINGWHEEL_H
+#define TIMINGWHEEL_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// Hashed timing wheel. Every slot holds an intrusive doubly-linked list of timers,
+// timers further away than one revolution carry a 'rounds' counter.
+// schedule() and cancel() are O(1), tick() only touches the timers of one slot.
+// Timer nodes live in one vector and are recycled through a free list, so the
+// wheel doesn't allocate once it has grown to the number of live connections.
+class TimingWheel {
+public:
+    // A TimerId packs the node index with a generation counter, so cancelling a
+    // timer that already fired (and whose node was reused) is a harmless no-op.
+    typedef uint64_t TimerId;
+    static const TimerId NO_TIMER = 0;
+
+    struct Expired {
+        TimerId id;
+        int fd;
+        int kind;
+    };
+
+    TimingWheel(size_t slotCount, uint32_t tickMillis);
+
+    TimerId schedule(uint64_t delayMillis, int fd, int kind);
+    void cancel(TimerId id);
+
+    // Advances the wheel by one tick and appends the timers that fired to 'expired'.
+    void tick(std::vector<Expired>& expired);
+
+    uint32_t getTickMillis() const;
+    size_t size() const;
+    size_t getMemoryBytes() const; // Slots and timer nodes
+
+private:
+    static const uint32_t NIL = 0xFFFFFFFF;
+
+    struct Node {
+        uint32_t generation;
+        uint32_t slot;
+        uint32_t prev;
+        uint32_t next;
+        uint64_t rounds;
+        int fd;
+        int kind;
+        bool active;
+    };
+
+    uint32_t tickMillis;
+    size_t currentSlot;
+    size_t activeCount;
+    uint32_t freeList;
+    std::vector<uint32_t> slots; // Head node index of each slot's list
+    std::vector<Node> nodes;
+
+    uint32_t allocateNode();
+    void unlink(uint32_t index);
+    void release(uint32_t index);
+};
+
+#endif // TIMINGWHEEL_H
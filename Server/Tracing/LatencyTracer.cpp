@@ -0,0 +1,84 @@
+#include "LatencyTracer.h"
+#include <fstream>
+#include <algorithm>
+#include <chrono>
+
+const size_t LatencyTracer::DEFAULT_CAPACITY;
+
+LatencyTracer::LatencyTracer(size_t capacity)
+    : ring(capacity), nextSpan(0), sampleInterval(0), untilSample(0), nextTraceId(1), nextWorkerThread(1) {}
+
+void LatencyTracer::setSampleInterval(uint32_t interval) {
+    sampleInterval = interval;
+    untilSample = interval;
+    loopThread = std::this_thread::get_id();
+}
+
+bool LatencyTracer::isEnabled() const {
+    return sampleInterval != 0;
+}
+
+uint64_t LatencyTracer::sample() {
+    if (sampleInterval == 0 || --untilSample != 0) {
+        return 0;
+    }
+    untilSample = sampleInterval;
+    return nextTraceId++;
+}
+
+void LatencyTracer::record(uint64_t traceId, const char* name, uint64_t startMicros, uint64_t endMicros, int64_t socket) {
+    // Concurrent writers claim different slots, the oldest spans are overwritten
+    TraceSpan& span = ring[nextSpan.fetch_add(1, std::memory_order_relaxed) % ring.size()];
+    span.traceId = traceId;
+    span.name = name;
+    span.startMicros = startMicros;
+    span.durationMicros = endMicros > startMicros ? endMicros - startMicros : 0;
+    span.thread = threadNumber();
+    span.socket = socket;
+}
+
+uint32_t LatencyTracer::threadNumber() {
+    if (std::this_thread::get_id() == loopThread) {
+        return 0;
+    }
+    static thread_local uint32_t number = 0;
+    if (number == 0) {
+        number = nextWorkerThread.fetch_add(1);
+    }
+    return number;
+}
+
+bool LatencyTracer::exportChromeTrace(const std::string& path) const {
+    std::ofstream out(path, std::ios::trunc);
+    if (!out) {
+        return false;
+    }
+    uint64_t total = nextSpan.load();
+    size_t count = static_cast<size_t>(std::min<uint64_t>(total, ring.size()));
+    uint32_t threads = nextWorkerThread.load();
+
+    // Complete ("X") events, one per span, plus the thread names
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"event loop\"}}";
+    for (uint32_t thread = 1; thread < threads; thread++) {
+        out << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread
+            << ",\"args\":{\"name\":\"fanout worker " << thread << "\"}}";
+    }
+    for (size_t i = 0; i < count; i++) {
+        const TraceSpan& span = ring[(total - count + i) % ring.size()];
+        out << ",\n{\"name\":\"" << span.name << "\",\"cat\":\"message\",\"ph\":\"X\",\"pid\":1,\"tid\":" << span.thread
+            << ",\"ts\":" << span.startMicros << ",\"dur\":" << span.durationMicros
+            << ",\"args\":{\"trace\":" << span.traceId;
+        if (span.socket >= 0) {
+            out << ",\"socket\":" << span.socket;
+        }
+        out << "}}";
+    }
+    out << "\n]}\n";
+    return static_cast<bool>(out);
+}
+
+uint64_t LatencyTracer::nowMicros() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
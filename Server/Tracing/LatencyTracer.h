@@ -0,0 +1,60 @@
+#ifndef LATENCYTRACER_H
+#define LATENCYTRACER_H
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <cstdint>
+#include <cstddef>
+
+// One stage of a traced message: where it was, from when and for how long.
+struct TraceSpan {
+    uint64_t traceId;
+    const char* name;      // A string literal naming the stage
+    uint64_t startMicros;
+    uint64_t durationMicros;
+    uint32_t thread;       // 0 for the event loop, fanout workers count up from 1
+    int64_t socket;        // The client the stage concerns, -1 if none
+};
+
+// Sampled latency tracing of the message pipeline. One message in 'sampleInterval'
+// gets a trace id, and each stage it goes through is recorded as a span into a
+// fixed ring of the most recent spans, so tracing never allocates and a message
+// that isn't sampled costs one counter increment. The ring can be exported as
+// Chrome trace-event JSON (chrome://tracing, Perfetto).
+//
+// record() may be called from the fanout threads, export only while they are idle.
+class LatencyTracer {
+public:
+    explicit LatencyTracer(size_t capacity = DEFAULT_CAPACITY);
+
+    // Traces one message in 'interval', 0 turns tracing off. The calling thread
+    // becomes thread 0 of the exported trace.
+    void setSampleInterval(uint32_t interval);
+    bool isEnabled() const;
+
+    // Returns the trace id of the next message, 0 if it isn't sampled.
+    uint64_t sample();
+
+    void record(uint64_t traceId, const char* name, uint64_t startMicros, uint64_t endMicros, int64_t socket = -1);
+
+    bool exportChromeTrace(const std::string& path) const;
+
+    static uint64_t nowMicros();
+
+private:
+    static const size_t DEFAULT_CAPACITY = 64 * 1024;
+
+    std::vector<TraceSpan> ring;
+    std::atomic<uint64_t> nextSpan;
+    uint32_t sampleInterval;
+    uint32_t untilSample;
+    uint64_t nextTraceId;
+    std::thread::id loopThread;
+    std::atomic<uint32_t> nextWorkerThread;
+
+    uint32_t threadNumber();
+};
+
+#endif // LATENCYTRACER_H
@@ -0,0 +1,310 @@
+#include "LoopbackTransport.h"
+#include <algorithm>
+#include <thread>
+#include <cerrno>
+#include <cstdint>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+const size_t LoopbackTransport::DEFAULT_QUEUE_CAPACITY;
+const int LoopbackTransport::FIRST_CONNECTION;
+
+LoopbackTransport::LoopbackTransport(size_t queueCapacity)
+    : toServer(queueCapacity), toDriver(queueCapacity), eventFd(-1), listening(false),
+      nextConnection(FIRST_CONNECTION), wantsRoom(false) {
+    eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+}
+
+LoopbackTransport::~LoopbackTransport() {
+    if (eventFd != -1) {
+        ::close(eventFd);
+    }
+}
+
+int LoopbackTransport::connect() {
+    int connection = nextConnection++;
+    LoopbackChunk chunk;
+    chunk.connection = connection;
+    chunk.kind = LoopbackChunk::OPEN;
+    while (!toServer.push(std::move(chunk))) {
+        flush();
+        std::this_thread::yield();
+    }
+    return connection;
+}
+
+bool LoopbackTransport::write(int connection, const std::string& data) {
+    LoopbackChunk chunk;
+    chunk.connection = connection;
+    chunk.data = data;
+    return toServer.push(std::move(chunk));
+}
+
+void LoopbackTransport::disconnect(int connection) {
+    LoopbackChunk chunk;
+    chunk.connection = connection;
+    chunk.kind = LoopbackChunk::CLOSE;
+    while (!toServer.push(std::move(chunk))) {
+        flush();
+        std::this_thread::yield();
+    }
+}
+
+bool LoopbackTransport::read(LoopbackChunk& chunk) {
+    if (!toDriver.pop(chunk)) {
+        return false;
+    }
+    if (wantsRoom.load(std::memory_order_relaxed) && wantsRoom.exchange(false)) {
+        signal(); // The server has writes waiting for this room
+    }
+    return true;
+}
+
+void LoopbackTransport::flush() {
+    signal();
+}
+
+void LoopbackTransport::signal() {
+    uint64_t one = 1;
+    ssize_t result = ::write(eventFd, &one, sizeof(one));
+    (void)result; // A full counter means a wakeup is pending anyway
+}
+
+// The driver wakes the server up once it read something. If it emptied the queue
+// before it could see the flag, the server wakes itself up.
+void LoopbackTransport::waitForRoom() {
+    wantsRoom = true;
+    if (!toDriver.full()) {
+        signal();
+    }
+}
+
+bool LoopbackTransport::listen(const std::string&, int) {
+    listening = eventFd != -1;
+    return listening;
+}
+
+void LoopbackTransport::stopListening() {
+    listening = false;
+}
+
+bool LoopbackTransport::attach(int epollFd) {
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = eventFd;
+    return epoll_ctl(epollFd, EPOLL_CTL_ADD, eventFd, &event) == 0;
+}
+
+int LoopbackTransport::getEventFd() const {
+    return eventFd;
+}
+
+size_t LoopbackTransport::poll(TransportEvent* events, size_t maxEvents) {
+    uint64_t counter;
+    ssize_t result = ::read(eventFd, &counter, sizeof(counter));
+    (void)result;
+
+    size_t count = 0;
+    // Connections that still hold data from an earlier round come first
+    pollBacklog.swap(readBacklog);
+    for (int connection : pollBacklog) {
+        if (count == maxEvents) {
+            readBacklog.push_back(connection);
+            continue;
+        }
+        events[count].kind = TransportEventKind::READABLE;
+        events[count++].connection = connection;
+    }
+    pollBacklog.clear();
+
+    while (count < maxEvents && toServer.pop(incoming)) {
+        int connection = incoming.connection;
+        if (incoming.kind == LoopbackChunk::OPEN) {
+            if (!listening) {
+                LoopbackChunk refused;
+                refused.connection = connection;
+                refused.kind = LoopbackChunk::CLOSE;
+                pushToDriver(refused, true);
+                continue;
+            }
+            connections[connection];
+            events[count].kind = TransportEventKind::ACCEPTED;
+            events[count++].connection = connection;
+            continue;
+        }
+
+        auto it = connections.find(connection);
+        if (it == connections.end()) {
+            continue; // The server closed it already
+        }
+        Connection& state = it->second;
+        if (incoming.kind == LoopbackChunk::CLOSE) {
+            state.closed = true;
+        } else if (state.inboundOffset == state.inbound.length()) {
+            state.inbound.swap(incoming.data);
+            state.inboundOffset = 0;
+        } else {
+            state.inbound.append(incoming.data);
+        }
+        if (!state.readPending) {
+            state.readPending = true;
+            events[count].kind = TransportEventKind::READABLE;
+            events[count++].connection = connection;
+        }
+    }
+
+    // Like a level-triggered epoll, watched connections are reported for as long as the
+    // queue has room and they stay watched
+    std::lock_guard<std::mutex> lock(watchMutex);
+    if (!watched.empty()) {
+        if (toDriver.full()) {
+            waitForRoom();
+        } else {
+            bool reported = false;
+            for (int connection : watched) {
+                if (count == maxEvents) {
+                    break;
+                }
+                events[count].kind = TransportEventKind::WRITABLE;
+                events[count++].connection = connection;
+                reported = true;
+            }
+            if (reported) {
+                signal();
+            }
+        }
+    }
+
+    if (!readBacklog.empty() || !toServer.empty()) {
+        signal(); // More than fit into this round
+    }
+    return count;
+}
+
+bool LoopbackTransport::add(int connection) {
+    connections[connection];
+    return true;
+}
+
+void LoopbackTransport::watchWritable(int connection, bool watch) {
+    std::lock_guard<std::mutex> lock(watchMutex);
+    if (watch) {
+        watched.insert(connection);
+        signal();
+    } else {
+        watched.erase(connection);
+    }
+}
+
+void LoopbackTransport::close(int connection) {
+    auto it = connections.find(connection);
+    if (it == connections.end()) {
+        return;
+    }
+    bool driverClosed = it->second.closed;
+    connections.erase(it);
+    {
+        std::lock_guard<std::mutex> lock(watchMutex);
+        watched.erase(connection);
+    }
+    readBacklog.erase(std::remove(readBacklog.begin(), readBacklog.end(), connection), readBacklog.end());
+    if (!driverClosed) {
+        LoopbackChunk chunk;
+        chunk.connection = connection;
+        chunk.kind = LoopbackChunk::CLOSE;
+        pushToDriver(chunk, true);
+    }
+}
+
+ssize_t LoopbackTransport::receive(int connection, char* buffer, size_t length) {
+    auto it = connections.find(connection);
+    if (it == connections.end()) {
+        return 0;
+    }
+    Connection& state = it->second;
+    size_t available = state.inbound.length() - state.inboundOffset;
+    if (available == 0) {
+        state.readPending = false;
+        if (state.closed) {
+            return 0;
+        }
+        errno = EAGAIN;
+        return -1;
+    }
+    size_t taken = std::min(available, length);
+    state.inbound.copy(buffer, taken, state.inboundOffset);
+    state.inboundOffset += taken;
+    if (state.inboundOffset < state.inbound.length() || state.closed) {
+        // The server reads one buffer per event, it hears about the rest (or the end) next round
+        readBacklog.push_back(connection);
+        signal();
+    } else {
+        state.readPending = false;
+        std::string().swap(state.inbound); // Idle connections hold no buffer
+        state.inboundOffset = 0;
+    }
+    return static_cast<ssize_t>(taken);
+}
+
+bool LoopbackTransport::pushToDriver(LoopbackChunk& chunk, bool blocking) {
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(sendMutex);
+            if (toDriver.push(std::move(chunk))) {
+                return true;
+            }
+        }
+        if (!blocking) {
+            waitForRoom();
+            return false;
+        }
+        std::this_thread::yield();
+    }
+}
+
+ssize_t LoopbackTransport::send(int connection, const char* data, size_t length) {
+    LoopbackChunk chunk;
+    chunk.connection = connection;
+    chunk.data.assign(data, length);
+    if (!pushToDriver(chunk, false)) {
+        errno = EAGAIN;
+        return -1;
+    }
+    return static_cast<ssize_t>(length);
+}
+
+ssize_t LoopbackTransport::sendv(int connection, const struct iovec* iov, size_t count) {
+    LoopbackChunk chunk;
+    chunk.connection = connection;
+    size_t length = 0;
+    for (size_t i = 0; i < count; i++) {
+        length += iov[i].iov_len;
+    }
+    chunk.data.reserve(length);
+    for (size_t i = 0; i < count; i++) {
+        chunk.data.append(static_cast<const char*>(iov[i].iov_base), iov[i].iov_len);
+    }
+    if (!pushToDriver(chunk, false)) {
+        errno = EAGAIN;
+        return -1;
+    }
+    return static_cast<ssize_t>(length);
+}
+
+ssize_t LoopbackTransport::sendFile(int connection, int fileFd, off_t* offset, size_t count) {
+    LoopbackChunk chunk;
+    chunk.connection = connection;
+    chunk.data.resize(count);
+    ssize_t bytesRead = pread(fileFd, &chunk.data[0], count, *offset);
+    if (bytesRead <= 0) {
+        return bytesRead;
+    }
+    chunk.data.resize(static_cast<size_t>(bytesRead));
+    if (!pushToDriver(chunk, false)) {
+        errno = EAGAIN;
+        return -1;
+    }
+    *offset += bytesRead;
+    return bytesRead;
+}
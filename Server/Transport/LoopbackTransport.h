@@ -0,0 +1,93 @@
+#ifndef LOOPBACKTRANSPORT_H
+#define LOOPBACKTRANSPORT_H
+
+#include "Transport.h"
+#include "SpscQueue.h"
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+
+// A piece of traffic between the driver and the server.
+struct LoopbackChunk {
+    enum Kind { OPEN, DATA, CLOSE };
+    int connection = 0;
+    Kind kind = DATA;
+    std::string data;
+};
+
+// Clients that live in the same process as the server. A driver thread (a benchmark or
+// a test) opens connections and writes frames into one lock-free queue, the server
+// answers through another one. No socket is involved, so what is measured is the server
+// and not the network stack. The server thread is woken through an eventfd in its epoll
+// instance: the driver calls flush() once it has written a batch.
+//
+// The driver side is connect(), write(), disconnect(), read() and flush(), and must be
+// used by a single thread. Everything else is the server's side. The fanout threads of
+// the server send and change the writable interest too, so pushing to the driver's queue
+// takes a lock (the queue itself is lock-free, but has room for one producer only), and
+// so does the set of watched connections. The driver never takes either lock.
+class LoopbackTransport : public Transport {
+public:
+    explicit LoopbackTransport(size_t queueCapacity = DEFAULT_QUEUE_CAPACITY);
+    ~LoopbackTransport();
+
+    // Driver side
+    int connect();
+    bool write(int connection, const std::string& data); // False while the server is behind
+    void disconnect(int connection);
+    bool read(LoopbackChunk& chunk);                     // What the server sent, in order
+    void flush();
+
+    // Server side
+    bool listen(const std::string& ip, int port) override;
+    void stopListening() override;
+    bool attach(int epollFd) override;
+    int getEventFd() const override;
+    size_t poll(TransportEvent* events, size_t maxEvents) override;
+
+    bool add(int connection) override;
+    void watchWritable(int connection, bool watch) override;
+    void close(int connection) override;
+
+    ssize_t receive(int connection, char* buffer, size_t length) override;
+    ssize_t send(int connection, const char* data, size_t length) override;
+    ssize_t sendv(int connection, const struct iovec* iov, size_t count) override;
+    ssize_t sendFile(int connection, int fileFd, off_t* offset, size_t count) override;
+
+    static const size_t DEFAULT_QUEUE_CAPACITY = 1 << 16;
+
+    // Connection numbers start above any FD the server could hold, so they can't be
+    // mistaken for its timer or listening sockets
+    static const int FIRST_CONNECTION = 1 << 24;
+
+private:
+    struct Connection {
+        std::string inbound;       // Written by the driver, not received by the server yet
+        size_t inboundOffset = 0;
+        bool closed = false;       // The driver disconnected, receive() ends the stream once drained
+        bool readPending = false;  // A READABLE event was reported and not fully received
+    };
+
+    SpscQueue<LoopbackChunk> toServer;
+    SpscQueue<LoopbackChunk> toDriver;
+    int eventFd;
+    bool listening;
+    int nextConnection;                        // Driver side
+    std::atomic<bool> wantsRoom;               // The server waits for the driver to read
+    std::mutex sendMutex;                      // Producer side of toDriver
+    std::unordered_map<int, Connection> connections;
+    std::vector<int> readBacklog;              // Received only partly, reported again
+    std::vector<int> pollBacklog;              // readBacklog while poll() reports it
+    std::mutex watchMutex;                     // Guards 'watched'
+    std::unordered_set<int> watched;
+    LoopbackChunk incoming;
+
+    void signal();
+    void waitForRoom();
+    bool pushToDriver(LoopbackChunk& chunk, bool blocking);
+};
+
+#endif // LOOPBACKTRANSPORT_H
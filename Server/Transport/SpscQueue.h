@@ -0,0 +1,62 @@
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+#include <utility>
+
+// Bounded lock-free queue between exactly one producer thread and one consumer thread.
+// The capacity is rounded up to a power of two. Head and tail live on their own cache
+// lines so the two threads don't bounce one between them.
+template <typename T>
+class SpscQueue {
+public:
+    explicit SpscQueue(size_t capacity) : head(0), tail(0) {
+        size_t size = 2;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        slots.resize(size);
+        mask = size - 1;
+    }
+
+    // Producer side, false if the queue is full
+    bool push(T&& value) {
+        size_t position = tail.load(std::memory_order_relaxed);
+        if (position - head.load(std::memory_order_acquire) > mask) {
+            return false;
+        }
+        slots[position & mask] = std::move(value);
+        tail.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side, false if the queue is empty
+    bool pop(T& value) {
+        size_t position = head.load(std::memory_order_relaxed);
+        if (position == tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        value = std::move(slots[position & mask]);
+        head.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Either side, a snapshot that may be stale by the time it is used
+    bool empty() const {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+
+    bool full() const {
+        return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire) > mask;
+    }
+
+private:
+    std::vector<T> slots;
+    size_t mask;
+    alignas(64) std::atomic<size_t> head; // Next slot to pop, written by the consumer
+    alignas(64) std::atomic<size_t> tail; // Next slot to push, written by the producer
+};
+
+#endif // SPSCQUEUE_H
@@ -0,0 +1,146 @@
+#include "TcpTransport.h"
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+TcpTransport::TcpTransport() : listenFd(-1), epollFd(-1) {}
+
+TcpTransport::~TcpTransport() {
+    stopListening();
+}
+
+bool TcpTransport::listen(const std::string& ip, int port) {
+    std::cout << "Creating server socket..." << std::endl;
+    listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listenFd == -1) {
+        std::cerr << "Error creating a socket" << std::endl;
+        return false;
+    }
+
+    // Set SO_REUSEADDR to ensure the port is freed immediately after server shutdown
+    int opt = 1;
+    if (setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1) {
+        std::cerr << "Error setting SO_REUSEADDR" << std::endl;
+        return false;
+    }
+
+    sockaddr_in server_address;
+    server_address.sin_family = AF_INET;
+    server_address.sin_port = htons(port);
+    inet_pton(AF_INET, ip.c_str(), &server_address.sin_addr);
+
+    if (bind(listenFd, (sockaddr*)&server_address, sizeof(server_address)) == -1) {
+        std::cerr << "Error binding to IP/port" << std::endl;
+        return false;
+    }
+
+    if (::listen(listenFd, SOMAXCONN) == -1) {
+        std::cerr << "Error listening" << std::endl;
+        return false;
+    }
+    std::cout << "Socket created and listening on IP: " << ip << ", Port: " << port << std::endl;
+    return true;
+}
+
+void TcpTransport::stopListening() {
+    if (listenFd != -1) {
+        ::close(listenFd);
+        listenFd = -1;
+    }
+}
+
+bool TcpTransport::attach(int epoll) {
+    epollFd = epoll;
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = listenFd;
+    return epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &event) == 0;
+}
+
+int TcpTransport::getEventFd() const {
+    return listenFd;
+}
+
+size_t TcpTransport::poll(TransportEvent* events, size_t maxEvents) {
+    sockaddr_in client_addr;
+    socklen_t client_len = sizeof(client_addr);
+    int client_socket = accept(listenFd, (sockaddr*)&client_addr, &client_len);
+    if (client_socket == -1) {
+        std::cerr << "Error accepting new connection: " << strerror(errno) << std::endl;
+        return 0;
+    }
+
+    // Broadcasts are already batched per member, Nagle would only hold back the last frame
+    int noDelay = 1;
+    setsockopt(client_socket, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+    if (maxEvents == 0 || !add(client_socket)) {
+        std::cerr << "Error adding client socket to epoll: " << strerror(errno) << std::endl;
+        ::close(client_socket); // Ensure the socket is closed on error
+        return 0;
+    }
+    events[0].kind = TransportEventKind::ACCEPTED;
+    events[0].connection = client_socket;
+    return 1;
+}
+
+bool TcpTransport::add(int connection) {
+    // Client sockets are non-blocking for their whole life, sendfile() has no MSG_DONTWAIT
+    int flags = fcntl(connection, F_GETFL, 0);
+    if (flags == -1 || ((flags & O_NONBLOCK) == 0 && fcntl(connection, F_SETFL, flags | O_NONBLOCK) == -1)) {
+        return false;
+    }
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = connection;
+    return epoll_ctl(epollFd, EPOLL_CTL_ADD, connection, &event) == 0;
+}
+
+void TcpTransport::watchWritable(int connection, bool watch) {
+    struct epoll_event event;
+    event.events = watch ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+    event.data.fd = connection;
+    epoll_ctl(epollFd, EPOLL_CTL_MOD, connection, &event);
+}
+
+void TcpTransport::close(int connection) {
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, connection, nullptr);
+    ::close(connection);
+}
+
+ssize_t TcpTransport::receive(int connection, char* buffer, size_t length) {
+    return recv(connection, buffer, length, 0);
+}
+
+// MSG_NOSIGNAL: a peer that already went away must not kill the server with SIGPIPE
+ssize_t TcpTransport::send(int connection, const char* data, size_t length) {
+    return ::send(connection, data, length, MSG_DONTWAIT | MSG_NOSIGNAL);
+}
+
+ssize_t TcpTransport::sendv(int connection, const struct iovec* iov, size_t count) {
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = const_cast<struct iovec*>(iov);
+    msg.msg_iovlen = count;
+    return sendmsg(connection, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+}
+
+ssize_t TcpTransport::sendFile(int connection, int fileFd, off_t* offset, size_t count) {
+    return sendfile(connection, fileFd, offset, count);
+}
+
+int TcpTransport::getListenFd() const {
+    return listenFd;
+}
+
+void TcpTransport::adoptListener(int fd) {
+    listenFd = fd;
+}
@@ -0,0 +1,37 @@
+#ifndef TCPTRANSPORT_H
+#define TCPTRANSPORT_H
+
+#include "Transport.h"
+
+// Clients over TCP. Connections are the sockets themselves and are registered with the
+// server's epoll instance, the listening socket is the event FD: poll() accepts from it.
+class TcpTransport : public Transport {
+public:
+    TcpTransport();
+    ~TcpTransport();
+
+    bool listen(const std::string& ip, int port) override;
+    void stopListening() override;
+    bool attach(int epollFd) override;
+    int getEventFd() const override;
+    size_t poll(TransportEvent* events, size_t maxEvents) override;
+
+    bool add(int connection) override;
+    void watchWritable(int connection, bool watch) override;
+    void close(int connection) override;
+
+    ssize_t receive(int connection, char* buffer, size_t length) override;
+    ssize_t send(int connection, const char* data, size_t length) override;
+    ssize_t sendv(int connection, const struct iovec* iov, size_t count) override;
+    ssize_t sendFile(int connection, int fileFd, off_t* offset, size_t count) override;
+
+    // The listening socket travels with a handoff
+    int getListenFd() const;
+    void adoptListener(int fd);
+
+private:
+    int listenFd;
+    int epollFd;
+};
+
+#endif // TCPTRANSPORT_H
@@ -0,0 +1,53 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <string>
+#include <cstddef>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+// What happened to a connection, reported by Transport::poll().
+enum class TransportEventKind {
+    ACCEPTED, // a new connection
+    READABLE, // data (or the end of the stream) can be received
+    WRITABLE  // a watched connection can take more data
+};
+
+struct TransportEvent {
+    TransportEventKind kind;
+    int connection;
+};
+
+// The client connections of the server. A connection is an int, the socket FD for TCP.
+// The transport is driven by the server's epoll instance: whenever getEventFd() becomes
+// readable the server calls poll() for what happened. A transport may also register
+// connections with the epoll instance itself, the server then sees their events under
+// the connection number and handles them as READABLE/WRITABLE.
+//
+// Nothing blocks: send(), sendv() and sendFile() return the bytes sent, or -1 with errno
+// EAGAIN when the connection couldn't take anything, and receive() returns -1 with EAGAIN
+// when there is nothing to read. receive() returns 0 at the end of the stream.
+class Transport {
+public:
+    virtual ~Transport() {}
+
+    virtual bool listen(const std::string& ip, int port) = 0;
+    virtual void stopListening() = 0;
+    virtual bool attach(int epollFd) = 0;
+    virtual int getEventFd() const = 0;
+    virtual size_t poll(TransportEvent* events, size_t maxEvents) = 0;
+
+    // Takes a connection the server already knows (restored after a handoff) under watch
+    virtual bool add(int connection) = 0;
+    virtual void watchWritable(int connection, bool watch) = 0;
+    virtual void close(int connection) = 0;
+
+    virtual ssize_t receive(int connection, char* buffer, size_t length) = 0;
+    virtual ssize_t send(int connection, const char* data, size_t length) = 0;
+    virtual ssize_t sendv(int connection, const struct iovec* iov, size_t count) = 0;
+
+    // Sends 'count' bytes of 'fileFd' from '*offset' on and advances it
+    virtual ssize_t sendFile(int connection, int fileFd, off_t* offset, size_t count) = 0;
+};
+
+#endif // TRANSPORT_H
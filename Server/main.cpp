@@ -1,19 +1,133 @@
 #include <iostream>
 #include <string>
+#include <cstdlib>
+#include <cstdio>
 #include "Server.h"
+#include "ServerConfig.h"
 
 using namespace std;
 
+static void printUsage(const char* program) {
+    cerr << "Usage: " << program << " <server_ip> <server_port> [options]" << endl;
+    cerr << "Options:" << endl;
+    cerr << "  --login-timeout <seconds>           close connections that don't log in in time" << endl;
+    cerr << "  --heartbeat-interval <seconds>      PING clients that were quiet for this long" << endl;
+    cerr << "  --heartbeat-timeout <seconds>       reap clients that don't answer a PING in time" << endl;
+    cerr << "  --idle-timeout <seconds>            disconnect clients without chat traffic (0 = never)" << endl;
+    cerr << "  --history-limit <messages>          messages kept in the history of each chatroom" << endl;
+    cerr << "  --room-log-bytes <bytes>            broadcasts kept per chatroom for members that fall behind" << endl;
+    cerr << "  --attachment-dir <path>             directory attachments are spooled to" << endl;
+    cerr << "  --max-attachment <bytes>            largest file a client may upload" << endl;
+    cerr << "  --max-attachments <count>           attachments kept for download" << endl;
+    cerr << "  --resume-grace <seconds>            how long a dropped session can be resumed (0 = never)" << endl;
+    cerr << "  --presence-window <millis>          joins and leaves are announced together per window" << endl;
+    cerr << "  --search-results <count>            matches a /search returns at most" << endl;
+    cerr << "  --client-msg-limit <rate[:burst]>   POSTs per second a client may send" << endl;
+    cerr << "  --client-byte-limit <rate[:burst]>  POST bytes per second a client may send" << endl;
+    cerr << "  --room-msg-limit <rate[:burst]>     POSTs per second a chatroom accepts" << endl;
+    cerr << "  --room-byte-limit <rate[:burst]>    POST bytes per second a chatroom accepts" << endl;
+    cerr << "  --fanout-threads <count>            threads that help broadcasting to big chatrooms" << endl;
+    cerr << "  --parallel-fanout-min <members>     chatroom size from which broadcasts use them" << endl;
+    cerr << "  --handoff-socket <path>             accept a successor process on this UNIX socket" << endl;
+    cerr << "  --takeover <path>                   take over connections from the server on this socket" << endl;
+    cerr << "  --node-id <id>                      unique id of this node in a federation" << endl;
+    cerr << "  --federation-port <port>            accept links from other nodes on this port" << endl;
+    cerr << "  --peer <host:port>                  federation port of another node (repeatable)" << endl;
+    cerr << "  --peer-heartbeat <seconds>          send a heartbeat on peer links quiet for this long" << endl;
+    cerr << "  --peer-timeout <seconds>            close peer links on which nothing arrived for this long" << endl;
+    cerr << "  --capture <path>                    record the traffic of the clients to a trace file" << endl;
+    cerr << "  --trace-sample <n>                  trace the latency of one POST in n (0 = off)" << endl;
+    cerr << "  --trace-file <path>                 where SIGUSR2 writes the latency trace (Chrome JSON)" << endl;
+}
+
+// Parses "rate" or "rate:burst", without an explicit burst the bucket holds two seconds worth.
+static void parseLimit(const string& argument, double& rate, double& burst) {
+    rate = 0;
+    burst = 0;
+    if (sscanf(argument.c_str(), "%lf:%lf", &rate, &burst) < 2) {
+        burst = rate * 2;
+    }
+}
+
 int main(int argc, char* argv[]) {
-    if (argc != 3) {
-        cerr << "Usage: " << argv[0] << " <server_ip> <server_port>" << endl;
+    if (argc < 3 || (argc - 3) % 2 != 0) {
+        printUsage(argv[0]);
         return 1;
     }
 
     string serverIP = argv[1];
     int serverPort = atoi(argv[2]);
 
-    Server server(serverIP, serverPort);
+    ServerConfig config;
+    for (int i = 3; i < argc; i += 2) {
+        string option = argv[i];
+        string argument = argv[i + 1];
+        int value = atoi(argument.c_str());
+        if (option == "--login-timeout") {
+            config.loginTimeoutSeconds = value;
+        } else if (option == "--heartbeat-interval") {
+            config.heartbeatIntervalSeconds = value;
+        } else if (option == "--heartbeat-timeout") {
+            config.heartbeatTimeoutSeconds = value;
+        } else if (option == "--idle-timeout") {
+            config.idleTimeoutSeconds = value;
+        } else if (option == "--history-limit") {
+            config.historyLimit = value;
+        } else if (option == "--room-log-bytes") {
+            config.roomLogBytes = strtoull(argument.c_str(), nullptr, 10);
+        } else if (option == "--attachment-dir") {
+            config.attachmentDirectory = argument;
+        } else if (option == "--max-attachment") {
+            config.maxAttachmentBytes = strtoull(argument.c_str(), nullptr, 10);
+        } else if (option == "--max-attachments") {
+            config.maxAttachments = value;
+        } else if (option == "--resume-grace") {
+            config.resumeGraceSeconds = value;
+        } else if (option == "--presence-window") {
+            config.presenceWindowMillis = value;
+        } else if (option == "--search-results") {
+            config.searchResultLimit = value;
+        } else if (option == "--client-msg-limit") {
+            parseLimit(argument, config.clientMessagesPerSecond, config.clientMessageBurst);
+        } else if (option == "--client-byte-limit") {
+            parseLimit(argument, config.clientBytesPerSecond, config.clientByteBurst);
+        } else if (option == "--room-msg-limit") {
+            parseLimit(argument, config.roomMessagesPerSecond, config.roomMessageBurst);
+        } else if (option == "--room-byte-limit") {
+            parseLimit(argument, config.roomBytesPerSecond, config.roomByteBurst);
+        } else if (option == "--fanout-threads") {
+            config.fanoutThreads = value;
+        } else if (option == "--parallel-fanout-min") {
+            config.parallelFanoutMinMembers = value;
+        } else if (option == "--handoff-socket") {
+            config.handoffSocketPath = argument;
+        } else if (option == "--takeover") {
+            config.handoffSocketPath = argument;
+            config.takeover = true;
+        } else if (option == "--node-id") {
+            config.nodeId = value;
+        } else if (option == "--federation-port") {
+            config.federationPort = value;
+        } else if (option == "--peer") {
+            config.peers.push_back(argument);
+        } else if (option == "--peer-heartbeat") {
+            config.peerHeartbeatSeconds = value;
+        } else if (option == "--peer-timeout") {
+            config.peerTimeoutSeconds = value;
+        } else if (option == "--capture") {
+            config.capturePath = argument;
+        } else if (option == "--trace-sample") {
+            config.traceSampleInterval = value;
+        } else if (option == "--trace-file") {
+            config.traceExportPath = argument;
+        } else {
+            cerr << "Unknown option: " << option << endl;
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    Server server(serverIP, serverPort, config);
 
     if (server.init()) {
         server.run();
@@ -0,0 +1,211 @@
+// Checks that a warm server handles POSTs without a single heap allocation on its event
+// loop thread. A replacement operator new counts what that thread allocates; the copies
+// the loopback transport makes are left out, they stand for the kernel's socket buffers.
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+#include "Server.h"
+#include "ServerConfig.h"
+#include "Transport/LoopbackTransport.h"
+#include "../common/Message.h"
+
+static thread_local bool onServerThread = false;
+static thread_local bool inTransport = false;
+static std::atomic<bool> counting(false);
+static std::atomic<uint64_t> allocations(0);
+
+void* operator new(size_t size) {
+    if (onServerThread && !inTransport && counting.load(std::memory_order_relaxed)) {
+        allocations.fetch_add(1, std::memory_order_relaxed);
+    }
+    void* memory = malloc(size == 0 ? 1 : size);
+    if (memory == nullptr) {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* memory) noexcept {
+    free(memory);
+}
+
+void operator delete[](void* memory) noexcept {
+    free(memory);
+}
+
+// The server's side of the loopback, with the allocations of the transport itself not counted
+class UncountedLoopback : public LoopbackTransport {
+public:
+    size_t poll(TransportEvent* events, size_t maxEvents) override {
+        Pause pause;
+        return LoopbackTransport::poll(events, maxEvents);
+    }
+    void watchWritable(int connection, bool watch) override {
+        Pause pause;
+        LoopbackTransport::watchWritable(connection, watch);
+    }
+    ssize_t receive(int connection, char* buffer, size_t length) override {
+        Pause pause;
+        return LoopbackTransport::receive(connection, buffer, length);
+    }
+    ssize_t send(int connection, const char* data, size_t length) override {
+        Pause pause;
+        return LoopbackTransport::send(connection, data, length);
+    }
+    ssize_t sendv(int connection, const struct iovec* iov, size_t count) override {
+        Pause pause;
+        return LoopbackTransport::sendv(connection, iov, count);
+    }
+
+private:
+    struct Pause {
+        Pause() { inTransport = true; }
+        ~Pause() { inTransport = false; }
+    };
+};
+
+static const int MEMBERS = 8;
+static const int WARMUP_ROUNDS = 1000; // Enough to fill the history and wrap the room log
+static const int COUNTED_ROUNDS = 250;
+
+static UncountedLoopback transport;
+static std::vector<int> connections;
+static std::string inbound[MEMBERS];
+static uint64_t deliveries = 0;
+static uint64_t joined = 0;
+
+// Reads what the server sent and counts the CHAT and JOIN frames
+static void drain() {
+    LoopbackChunk chunk;
+    while (transport.read(chunk)) {
+        if (chunk.kind != LoopbackChunk::DATA) {
+            continue;
+        }
+        std::string& buffer = inbound[chunk.connection - LoopbackTransport::FIRST_CONNECTION];
+        buffer.append(chunk.data);
+        size_t offset = 0;
+        const char* payload;
+        size_t payloadLength;
+        while (Message::findFrame(buffer.data() + offset, buffer.length() - offset, payload, payloadLength) ==
+               FrameStatus::Complete) {
+            MessageView view = Message::parse(payload, payloadLength);
+            if (view.type == MessageType::CHAT) {
+                deliveries++;
+            } else if (view.type == MessageType::JOIN) {
+                joined++;
+            }
+            offset += Message::FRAME_HEADER_SIZE + payloadLength;
+        }
+        buffer.erase(0, offset);
+    }
+}
+
+static void write(int connection, const std::string& frame) {
+    while (!transport.write(connection, frame)) {
+        transport.flush();
+        drain();
+        std::this_thread::yield();
+    }
+}
+
+static bool waitFor(const uint64_t& counter, uint64_t target) {
+    transport.flush();
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (counter < target) {
+        if (std::chrono::steady_clock::now() > deadline) {
+            std::cerr << "The server stalled at " << counter << " of " << target << "." << std::endl;
+            return false;
+        }
+        drain();
+        std::this_thread::yield();
+    }
+    return true;
+}
+
+// Every member posts in turn, each post reaches all of them. A round waits for its
+// deliveries, so every member keeps the same share of the history and the search index.
+static bool post(int rounds) {
+    std::string text(64, 'x');
+    std::string frame;
+    for (int round = 0; round < rounds; round++) {
+        uint64_t target = deliveries + MEMBERS * MEMBERS;
+        for (int connection : connections) {
+            Message::serializeTo(MessageType::POST, text.data(), text.length(), frame);
+            write(connection, frame);
+        }
+        if (!waitFor(deliveries, target)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main() {
+    ServerConfig config;
+    config.clientMessagesPerSecond = config.clientBytesPerSecond = 0;
+    config.roomMessagesPerSecond = config.roomBytesPerSecond = 0;
+    config.heartbeatIntervalSeconds = 3600;
+    config.loginTimeoutSeconds = 3600;
+    config.presenceWindowMillis = 3600 * 1000;
+    config.fanoutThreads = 0;
+    config.roomLogBytes = 64 * 1024;
+
+    Server server("loopback", 0, config, &transport);
+    if (!server.init()) {
+        std::cerr << "The server failed to start." << std::endl;
+        return 1;
+    }
+    std::atomic<bool> finished(false);
+    std::thread serverThread([&server, &finished]() {
+        onServerThread = true;
+        server.run();
+        finished = true;
+    });
+
+    std::string frame;
+    for (int i = 0; i < MEMBERS; i++) {
+        int connection = transport.connect();
+        connections.push_back(connection);
+        Message(MessageType::LOGIN, "member" + std::to_string(i)).serializeTo(frame);
+        write(connection, frame);
+        Message(i == 0 ? MessageType::CREATE : MessageType::JOIN, i == 0 ? "alloc;" : "alloc").serializeTo(frame);
+        write(connection, frame);
+        waitFor(joined, static_cast<uint64_t>(i) + 1); // The room exists before the next one joins
+    }
+
+    bool ok = post(WARMUP_ROUNDS);
+    counting = true;
+    ok = ok && post(COUNTED_ROUNDS);
+    counting = false;
+
+    // The server closes its connections on the way out, which needs room in the queue
+    server.stop();
+    transport.flush();
+    while (!finished) {
+        drain();
+        std::this_thread::yield();
+    }
+    serverThread.join();
+
+    if (!ok) {
+        std::cerr << "FAIL: not every post was delivered" << std::endl;
+        return 1;
+    }
+    if (allocations != 0) {
+        std::cerr << "FAIL: " << allocations << " allocations on the event loop for " << COUNTED_ROUNDS * MEMBERS
+                  << " posts once warm" << std::endl;
+        return 1;
+    }
+    std::cout << "OK: " << COUNTED_ROUNDS * MEMBERS << " posts to " << MEMBERS << " members, no allocations once warm"
+              << std::endl;
+    return 0;
+}
@@ -0,0 +1,229 @@
+// Starts three server nodes on loopback, linked into a federation, with one client on
+// each. A chatroom created on the first node is joined from the others, and every post
+// has to reach all three clients, whichever node it was posted on.
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <csignal>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include "../common/Message.h"
+
+static const int NODES = 3;
+static const int TIMEOUT_MILLIS = 10000;
+
+// A blocking client that speaks the framed protocol
+struct TestClient {
+    int fd = -1;
+    std::string inbound;
+
+    bool connectTo(int port) {
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_port = htons(static_cast<uint16_t>(port));
+        inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+        if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0) {
+            return true;
+        }
+        close(fd);
+        fd = -1;
+        return false;
+    }
+
+    void send(MessageType type, const std::string& body) {
+        std::string frame;
+        Message(type, body).serializeTo(frame);
+        ::send(fd, frame.data(), frame.length(), MSG_NOSIGNAL);
+    }
+
+    // Reads frames until one of 'type' has a body containing 'text', false on timeout.
+    // The body of that frame is left in 'body'.
+    std::string body;
+    bool waitFor(MessageType type, const std::string& text, int timeoutMillis = TIMEOUT_MILLIS) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMillis);
+        while (true) {
+            const char* payload;
+            size_t payloadLength;
+            while (Message::findFrame(inbound.data(), inbound.length(), payload, payloadLength) == FrameStatus::Complete) {
+                MessageView view = Message::parse(payload, payloadLength);
+                body.assign(view.body, view.bodyLength);
+                bool found = view.type == type && body.find(text) != std::string::npos;
+                inbound.erase(0, Message::FRAME_HEADER_SIZE + payloadLength);
+                if (found) {
+                    return true;
+                }
+            }
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+            struct pollfd readable = {fd, POLLIN, 0};
+            if (left.count() <= 0 || poll(&readable, 1, static_cast<int>(left.count())) <= 0) {
+                return false;
+            }
+            char buffer[4096];
+            ssize_t bytesRead = recv(fd, buffer, sizeof(buffer), 0);
+            if (bytesRead <= 0) {
+                return false;
+            }
+            inbound.append(buffer, static_cast<size_t>(bytesRead));
+        }
+    }
+};
+
+static pid_t startNode(const char* server, int node, int clientPort, const std::vector<int>& federationPorts) {
+    std::vector<std::string> args = {server, "127.0.0.1", std::to_string(clientPort),
+                                     "--node-id", std::to_string(node),
+                                     "--federation-port", std::to_string(federationPorts[node - 1])};
+    // Every node dials the ones started before it
+    for (int peer = 1; peer < node; peer++) {
+        args.push_back("--peer");
+        args.push_back("127.0.0.1:" + std::to_string(federationPorts[peer - 1]));
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+        int devNull = open("/dev/null", O_WRONLY);
+        dup2(devNull, STDOUT_FILENO);
+        std::vector<char*> argv;
+        for (std::string& arg : args) {
+            argv.push_back(&arg[0]);
+        }
+        argv.push_back(nullptr);
+        execv(server, argv.data());
+        _exit(127);
+    }
+    return pid;
+}
+
+// The sequence of a "room;sequence;text" body
+static std::string sequenceOf(const std::string& body) {
+    size_t start = body.find(';') + 1;
+    return body.substr(start, body.find(';', start) - start);
+}
+
+// Posts "<text><node>" on every node in turn. Every client has to get it, as a CHAT with
+// the same sequence everywhere.
+static bool postFromEveryNode(std::vector<TestClient>& clients, const std::string& text) {
+    for (int from = 0; from < NODES; from++) {
+        std::string post = text + std::to_string(from + 1);
+        clients[from].send(MessageType::POST, post);
+        std::string sequence;
+        for (int to = 0; to < NODES; to++) {
+            if (!clients[to].waitFor(MessageType::CHAT, post)) {
+                std::cerr << "FAIL: '" << post << "' didn't reach the client on node " << to + 1 << std::endl;
+                return false;
+            }
+            std::string received = sequenceOf(clients[to].body);
+            if (to == 0) {
+                sequence = received;
+            } else if (received != sequence) {
+                std::cerr << "FAIL: '" << post << "' is " << received << " on node " << to + 1 << " but "
+                          << sequence << " on node 1" << std::endl;
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static bool run(const char* server) {
+    // Ports from the process id, so tests running side by side don't collide
+    int basePort = 20000 + (getpid() % 2000) * 10;
+    std::vector<int> clientPorts;
+    std::vector<int> federationPorts;
+    for (int i = 0; i < NODES; i++) {
+        clientPorts.push_back(basePort + i);
+        federationPorts.push_back(basePort + NODES + i);
+    }
+
+    std::vector<pid_t> nodes;
+    for (int node = 1; node <= NODES; node++) {
+        nodes.push_back(startNode(server, node, clientPorts[node - 1], federationPorts));
+    }
+
+    bool ok = true;
+    std::vector<TestClient> clients(NODES);
+    for (int i = 0; i < NODES && ok; i++) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(TIMEOUT_MILLIS);
+        while (!clients[i].connectTo(clientPorts[i]) && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+        if (clients[i].fd == -1) {
+            std::cerr << "FAIL: node " << i + 1 << " doesn't accept clients" << std::endl;
+            ok = false;
+            break;
+        }
+        clients[i].send(MessageType::LOGIN, "user" + std::to_string(i + 1));
+    }
+
+    // The room is announced to the other nodes once their links are up, until then
+    // joining it fails and is retried
+    if (ok) {
+        clients[0].send(MessageType::CREATE, "federated;");
+        ok = clients[0].waitFor(MessageType::JOIN, "federated;");
+    }
+    for (int i = 1; i < NODES && ok; i++) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(TIMEOUT_MILLIS);
+        bool joined = false;
+        while (!joined && std::chrono::steady_clock::now() < deadline) {
+            clients[i].send(MessageType::JOIN, "federated");
+            joined = clients[i].waitFor(MessageType::JOIN, "federated;", 200);
+        }
+        if (!joined) {
+            std::cerr << "FAIL: node " << i + 1 << " never got the room of node 1" << std::endl;
+            ok = false;
+        }
+    }
+
+    // A post from every node, the owner's and the others', reaches every client
+    ok = ok && postFromEveryNode(clients, "hello from node ");
+
+    // Leaving drops the copy of node 2, joining again replaces it with the owner's history.
+    // Its members still see the owner's sequences afterwards.
+    if (ok) {
+        clients[1].send(MessageType::MENU, "");
+        ok = clients[1].waitFor(MessageType::MENU, "");
+    }
+    if (ok) {
+        // The JOIN carries the sequence of the next message, the one after the last post
+        uint64_t expected = std::stoull(sequenceOf(clients[0].body)) + 1;
+        clients[1].send(MessageType::JOIN, "federated");
+        ok = clients[1].waitFor(MessageType::JOIN, "federated;");
+        if (ok && std::stoull(sequenceOf(clients[1].body)) != expected) {
+            std::cerr << "FAIL: node 2 resumes the room at " << sequenceOf(clients[1].body) << " instead of "
+                      << expected << std::endl;
+            ok = false;
+        }
+    }
+    ok = ok && postFromEveryNode(clients, "hello again from node ");
+
+    for (TestClient& client : clients) {
+        if (client.fd != -1) {
+            close(client.fd);
+        }
+    }
+    for (pid_t pid : nodes) {
+        kill(pid, SIGTERM);
+        waitpid(pid, nullptr, 0);
+    }
+    return ok;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 2) {
+        std::cerr << "Usage: " << argv[0] << " <path of the Server binary>" << std::endl;
+        return 1;
+    }
+    if (!run(argv[1])) {
+        return 1;
+    }
+    std::cout << "OK: posts on each of " << NODES << " nodes reached the clients on all of them" << std::endl;
+    return 0;
+}
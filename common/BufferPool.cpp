@@ -0,0 +1,159 @@
+#include "BufferPool.h"
+
+const size_t BufferPool::SIZE_CLASS_COUNT;
+const size_t BufferPool::SIZE_CLASSES[BufferPool::SIZE_CLASS_COUNT] = {256, 1024, 4096, 16384, 65536};
+
+
+BufferPool::BufferPool(size_t maxFreePerClass)
+    : maxFreePerClass(maxFreePerClass), freeLists(SIZE_CLASS_COUNT) {}
+
+BufferPool::~BufferPool() {
+    for (std::vector<std::string*>& freeList : freeLists) {
+        for (std::string* buffer : freeList) {
+            delete buffer;
+        }
+    }
+}
+
+std::string* BufferPool::acquire(size_t minCapacity) {
+    for (size_t sizeClass = 0; sizeClass < SIZE_CLASS_COUNT; sizeClass++) {
+        if (SIZE_CLASSES[sizeClass] < minCapacity) {
+            continue;
+        }
+        // Take the smallest pooled buffer that fits, or allocate one of this class
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (size_t candidate = sizeClass; candidate < SIZE_CLASS_COUNT; candidate++) {
+                if (!freeLists[candidate].empty()) {
+                    std::string* buffer = freeLists[candidate].back();
+                    freeLists[candidate].pop_back();
+                    return buffer;
+                }
+            }
+        }
+        std::string* buffer = new std::string();
+        buffer->reserve(SIZE_CLASSES[sizeClass]);
+        return buffer;
+    }
+
+    // Larger than every class, these are not worth keeping around
+    std::string* buffer = new std::string();
+    buffer->reserve(minCapacity);
+    return buffer;
+}
+
+void BufferPool::release(std::string* buffer) {
+    buffer->clear();
+    size_t capacity = buffer->capacity();
+    if (capacity >= SIZE_CLASSES[0] && capacity <= SIZE_CLASSES[SIZE_CLASS_COUNT - 1] * 2) {
+        // File the buffer under the largest class it can serve
+        size_t sizeClass = SIZE_CLASS_COUNT - 1;
+        while (SIZE_CLASSES[sizeClass] > capacity) {
+            sizeClass--;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        if (freeLists[sizeClass].size() < maxFreePerClass) {
+            freeLists[sizeClass].push_back(buffer);
+            return;
+        }
+    }
+    delete buffer;
+}
+
+size_t BufferPool::getPooledBytes() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t bytes = 0;
+    for (const std::vector<std::string*>& freeList : freeLists) {
+        for (const std::string* buffer : freeList) {
+            bytes += buffer->capacity();
+        }
+    }
+    return bytes;
+}
+
+
+PooledBuffer::PooledBuffer() : buffer(nullptr) {}
+
+PooledBuffer::PooledBuffer(PooledBuffer&& other) : buffer(other.buffer) {
+    other.buffer = nullptr;
+}
+
+PooledBuffer& PooledBuffer::operator=(PooledBuffer&& other) {
+    if (this != &other) {
+        clear();
+        buffer = other.buffer;
+        other.buffer = nullptr;
+    }
+    return *this;
+}
+
+PooledBuffer::~PooledBuffer() {
+    clear();
+}
+
+BufferPool& PooledBuffer::sharedPool() {
+    static BufferPool pool;
+    return pool;
+}
+
+bool PooledBuffer::empty() const {
+    return buffer == nullptr || buffer->empty();
+}
+
+size_t PooledBuffer::length() const {
+    return buffer != nullptr ? buffer->length() : 0;
+}
+
+const char* PooledBuffer::data() const {
+    return buffer != nullptr ? buffer->data() : nullptr;
+}
+
+size_t PooledBuffer::capacity() const {
+    return buffer != nullptr ? buffer->capacity() : 0;
+}
+
+void PooledBuffer::reserve(size_t minCapacity) {
+    if (buffer == nullptr) {
+        buffer = sharedPool().acquire(minCapacity);
+    }
+}
+
+void PooledBuffer::append(const char* bytes, size_t count) {
+    if (count == 0) {
+        return;
+    }
+    reserve(count);
+    buffer->append(bytes, count);
+}
+
+void PooledBuffer::append(const std::string& bytes, size_t offset) {
+    append(bytes.data() + offset, bytes.length() - offset);
+}
+
+void PooledBuffer::consume(size_t count) {
+    if (buffer == nullptr) {
+        return;
+    }
+    if (count >= buffer->length()) {
+        clear();
+    } else {
+        buffer->erase(0, count);
+    }
+}
+
+void PooledBuffer::clear() {
+    if (buffer != nullptr) {
+        sharedPool().release(buffer);
+        buffer = nullptr;
+    }
+}
+
+const std::string& PooledBuffer::str() const {
+    static const std::string none;
+    return buffer != nullptr ? *buffer : none;
+}
+
+void PooledBuffer::assign(const std::string& bytes) {
+    clear();
+    append(bytes.data(), bytes.length());
+}
@@ -0,0 +1,76 @@
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <cstddef>
+
+// Recycles std::string buffers by size class, so buffers that come and go with
+// the traffic (receive buffers of partially read frames, for example) reuse
+// memory instead of going through the allocator once the pool is warm. The
+// string objects are pooled along with their memory, so handing one out
+// doesn't allocate either. Safe to use from several threads.
+class BufferPool {
+public:
+    static const size_t SIZE_CLASS_COUNT = 5;
+    static const size_t SIZE_CLASSES[SIZE_CLASS_COUNT];
+
+    explicit BufferPool(size_t maxFreePerClass = 1024);
+    ~BufferPool();
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    // Returns an empty buffer with a capacity of at least 'minCapacity', owned by
+    // the caller until it is released.
+    std::string* acquire(size_t minCapacity);
+
+    // Takes 'buffer' back into the pool, or deletes it if it is not worth keeping.
+    void release(std::string* buffer);
+
+    // Bytes held by buffers that are waiting in the pool.
+    size_t getPooledBytes() const;
+
+private:
+    size_t maxFreePerClass;
+    std::vector<std::vector<std::string*> > freeLists;
+    mutable std::mutex mutex;
+};
+
+// A byte buffer that holds no memory while it is empty: the first append takes a
+// buffer from the shared pool, and it goes back to the pool once everything was
+// consumed. An idle connection pays one pointer for it.
+class PooledBuffer {
+public:
+    PooledBuffer();
+    PooledBuffer(PooledBuffer&& other);
+    PooledBuffer& operator=(PooledBuffer&& other);
+    PooledBuffer(const PooledBuffer&) = delete;
+    PooledBuffer& operator=(const PooledBuffer&) = delete;
+    ~PooledBuffer();
+
+    bool empty() const;
+    size_t length() const;
+    const char* data() const;
+    size_t capacity() const; // Bytes held, 0 while idle
+
+    // Makes sure a buffer of at least 'minCapacity' is held before the first append
+    void reserve(size_t minCapacity);
+    void append(const char* bytes, size_t count);
+    void append(const std::string& bytes, size_t offset = 0);
+
+    // Drops 'count' bytes from the front, the buffer goes back to the pool once empty
+    void consume(size_t count);
+    void clear();
+
+    const std::string& str() const;
+    void assign(const std::string& bytes);
+
+    // The pool every PooledBuffer draws from
+    static BufferPool& sharedPool();
+
+private:
+    std::string* buffer;
+};
+
+#endif // BUFFERPOOL_H
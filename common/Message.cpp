@@ -1,9 +1,20 @@
 #include "Message.h"
 #include <sstream>
 
+const uint32_t Message::FRAME_HEADER_SIZE;
+const uint32_t Message::MAX_FRAME_SIZE;
+
+static const char INVALID_MESSAGE[] = "Invalid Message";
+
 Message::Message(MessageType messageType, const std::string& messageBody)
     : type(messageType), body(messageBody) {}
 
+Message::Message(MessageType messageType, std::string&& messageBody)
+    : type(messageType), body(std::move(messageBody)) {}
+
+Message::Message(const MessageView& view)
+    : type(view.type), body(view.body, view.bodyLength) {}
+
 Message::~Message() {}
 
 MessageType Message::getType() const {
@@ -15,17 +26,148 @@ const std::string& Message::getBody() const {
 }
 
 std::string Message::serialize() const {
-    return std::to_string(static_cast<int>(type)) + ";" + body;
+    std::string frame;
+    serializeTo(frame);
+    return frame;
+}
+
+void Message::serializeTo(std::string& frame) const {
+    serializeTo(type, body.data(), body.length(), frame);
+}
+
+// Renders 'number' backwards into 'digits', returns the digit count.
+static int renderDigits(uint64_t number, char* digits) {
+    int digitCount = 0;
+    do {
+        digits[digitCount++] = static_cast<char>('0' + number % 10);
+        number /= 10;
+    } while (number > 0);
+    return digitCount;
+}
+
+void Message::serializeTo(MessageType type, const char* body, size_t bodyLength, std::string& frame) {
+    // Message types are small, render the number by hand instead of through std::to_string
+    char typeDigits[20];
+    int digitCount = renderDigits(static_cast<uint64_t>(type), typeDigits);
+
+    writeFrameHeader(static_cast<uint32_t>(digitCount + 1 + bodyLength), frame);
+    while (digitCount > 0) {
+        frame.push_back(typeDigits[--digitCount]);
+    }
+    frame.push_back(';');
+    frame.append(body, bodyLength);
+}
+
+void Message::serializeTo(MessageType type, const std::string& room, uint64_t sequence, const char* body,
+                          size_t bodyLength, std::string& frame) {
+    char typeDigits[20];
+    char sequenceDigits[20];
+    int typeDigitCount = renderDigits(static_cast<uint64_t>(type), typeDigits);
+    int sequenceDigitCount = renderDigits(sequence, sequenceDigits);
+
+    writeFrameHeader(static_cast<uint32_t>(typeDigitCount + 1 + room.length() + 1 + sequenceDigitCount + 1 + bodyLength), frame);
+    while (typeDigitCount > 0) {
+        frame.push_back(typeDigits[--typeDigitCount]);
+    }
+    frame.push_back(';');
+    frame += room;
+    frame.push_back(';');
+    while (sequenceDigitCount > 0) {
+        frame.push_back(sequenceDigits[--sequenceDigitCount]);
+    }
+    frame.push_back(';');
+    frame.append(body, bodyLength);
+}
+
+bool Message::splitSequence(const std::string& body, uint64_t& sequence, std::string& text) {
+    size_t separator = body.find(';');
+    if (separator == 0 || separator == std::string::npos || separator > 20) {
+        return false;
+    }
+    sequence = 0;
+    for (size_t i = 0; i < separator; i++) {
+        if (body[i] < '0' || body[i] > '9') {
+            return false;
+        }
+        sequence = sequence * 10 + static_cast<uint64_t>(body[i] - '0');
+    }
+    text = body.substr(separator + 1);
+    return true;
+}
+
+bool Message::splitChat(const std::string& body, std::string& room, uint64_t& sequence, std::string& text) {
+    size_t separator = body.find(';');
+    if (separator == std::string::npos) {
+        return false;
+    }
+    room = body.substr(0, separator);
+    return splitSequence(body.substr(separator + 1), sequence, text);
+}
+
+void Message::writeFrameHeader(uint32_t payloadLength, std::string& frame) {
+    frame.clear();
+    frame.push_back(static_cast<char>((payloadLength >> 24) & 0xFF));
+    frame.push_back(static_cast<char>((payloadLength >> 16) & 0xFF));
+    frame.push_back(static_cast<char>((payloadLength >> 8) & 0xFF));
+    frame.push_back(static_cast<char>(payloadLength & 0xFF));
+}
+
+uint32_t Message::readFrameHeader(const char* header) {
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(header);
+    return (static_cast<uint32_t>(bytes[0]) << 24) | (static_cast<uint32_t>(bytes[1]) << 16) |
+           (static_cast<uint32_t>(bytes[2]) << 8) | static_cast<uint32_t>(bytes[3]);
 }
 
 Message Message::deserialize(const std::string& serializedData) {
-    size_t delimiterPos = serializedData.find(";");
-    if (delimiterPos != std::string::npos) {
-        int messageType = std::stoi(serializedData.substr(0, delimiterPos));
-        std::string messageBody = serializedData.substr(delimiterPos + 1);
-        return Message(static_cast<MessageType>(messageType), messageBody);
+    return Message(parse(serializedData.data(), serializedData.length()));
+}
+
+MessageView Message::parse(const char* payload, size_t length) {
+    MessageView view;
+    unsigned int messageType = 0;
+    size_t i = 0;
+    while (i < length && payload[i] >= '0' && payload[i] <= '9' && i < 9) {
+        messageType = messageType * 10 + static_cast<unsigned int>(payload[i] - '0');
+        i++;
+    }
+
+    if (i > 0 && i < length && payload[i] == ';') {
+        view.type = static_cast<MessageType>(messageType);
+        view.body = payload + i + 1;
+        view.bodyLength = length - i - 1;
     } else {
-        return Message(MessageType::POST, "Invalid Message");
+        view.type = MessageType::POST;
+        view.body = INVALID_MESSAGE;
+        view.bodyLength = sizeof(INVALID_MESSAGE) - 1;
+    }
+    return view;
+}
+
+FrameStatus Message::findFrame(const char* data, size_t length, const char*& payload, size_t& payloadLength) {
+    if (length < FRAME_HEADER_SIZE) {
+        return FrameStatus::Incomplete;
+    }
+
+    uint32_t frameLength = readFrameHeader(data);
+    if (frameLength > MAX_FRAME_SIZE) {
+        return FrameStatus::Invalid;
+    }
+    if (length < FRAME_HEADER_SIZE + frameLength) {
+        return FrameStatus::Incomplete;
     }
+
+    payload = data + FRAME_HEADER_SIZE;
+    payloadLength = frameLength;
+    return FrameStatus::Complete;
 }
 
+FrameStatus Message::extractFrame(std::string& buffer, std::string& payload) {
+    const char* framePayload;
+    size_t payloadLength;
+    FrameStatus status = findFrame(buffer.data(), buffer.length(), framePayload, payloadLength);
+    if (status == FrameStatus::Complete) {
+        payload.assign(framePayload, payloadLength);
+        buffer.erase(0, FRAME_HEADER_SIZE + payloadLength);
+    }
+    return status;
+}
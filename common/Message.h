@@ -3,23 +3,108 @@
 
 #include <string>
 #include <set>
+#include <cstdint>
+#include <cstddef>
 
 enum class MessageType {
-    JOIN, // the client uses JOIN msgs to ask the server to enter a chatroom, 
-          // the server uses JOIN msgs to notify the client that he succeded in joining a room.
-    
-    MENU, // the client uses MENU msgs to ask the server to leave a chatroom and recieve the chatroom menu,
+    JOIN, // the client uses JOIN msgs to ask the server to enter a chatroom (it stays in the ones it is in),
+          // the server uses JOIN msgs ("room;next sequence;history") to notify the client that he succeded
+          // in joining a room, which becomes the room the client posts to. A history too long for one
+          // frame is cut short, the rest follows as CHAT msgs starting at the sequence in the JOIN.
+
+    MENU, // the client uses MENU msgs to ask the server to leave the chatroom it posts to and recieve the chatroom menu,
           // the server uses MENU msgs to deliver the chatroom menu to the user.
-    
+
     QUIT, // the client uses QUIT msgs to notify the server that it's closing their socket,
           // the server uses QUIT msgs to notify the client that it's closing their socket.
-    
+
     POST, // the client uses POST msgs to send a msg to the chatroom,
           // the server uses POST msgs to send a msg to the client.
-    
+
     LOGIN, // the client uses LOGIN msgs to send it's username to the server.
 
-    CREATE // the client uses CREATE msgs to ask the server to create an new chatroom. 
+    CREATE, // the client uses CREATE msgs to ask the server to create an new chatroom.
+
+    PING, // the server uses PING msgs to check that a quiet client is still alive.
+
+    PONG, // the client answers every PING with a PONG.
+
+    SEARCH, // the client uses SEARCH msgs to search the history of its chatroom,
+            // the server answers with a POST listing the best matches.
+
+    PRESENCE, // the server uses PRESENCE msgs to tell who joined and left a chatroom lately,
+              // the client uses PRESENCE msgs ("on"/"off") to choose whether it wants them.
+
+    RESUME, // the server uses RESUME msgs to hand the client a resume token after login,
+            // a reconnecting client sends "token;room;next sequence;room;next sequence..." instead of a LOGIN.
+
+    CHAT,   // the server uses CHAT msgs ("room;sequence;text") to deliver chatroom messages.
+            // Sequences count the messages of a room, a client that knows the next
+            // one it expects can resume without receiving the history again.
+
+    ATTACH,   // the client uses ATTACH msgs ("name;size") to start uploading a file to its chatroom.
+
+    CHUNK,    // the client uses CHUNK msgs to send the raw bytes of the file it is uploading,
+              // the server uses CHUNK msgs to send the raw bytes of a file being downloaded.
+
+    DOWNLOAD, // the client uses DOWNLOAD msgs ("id") to ask for an attachment,
+              // the server answers with a DOWNLOAD msg ("id;name;size") followed by CHUNK msgs.
+
+    PART      // the client uses PART msgs ("room") to leave one of its chatrooms and stay in the others.
+};
+
+// Priority of the frames the server sends. Every connection queues its outbound frames
+// by class, and a frame of a higher class overtakes the queued frames of the lower ones
+// (never a frame that is already partly sent), so a client in a busy room gets the
+// answers to its commands without waiting for the room traffic before them.
+enum class TrafficClass : uint8_t {
+    CONTROL, // session control and the replies to the client's own requests
+    BULK     // chatroom traffic and attachment content
+};
+
+static const size_t TRAFFIC_CLASS_COUNT = 2;
+
+// The class of every MessageType, in the order of the enum. POSTs from the server are
+// always replies to one client, chatroom messages go out as CHAT.
+constexpr TrafficClass TRAFFIC_CLASSES[] = {
+    TrafficClass::CONTROL, // JOIN
+    TrafficClass::CONTROL, // MENU
+    TrafficClass::CONTROL, // QUIT
+    TrafficClass::CONTROL, // POST
+    TrafficClass::CONTROL, // LOGIN
+    TrafficClass::CONTROL, // CREATE
+    TrafficClass::CONTROL, // PING
+    TrafficClass::CONTROL, // PONG
+    TrafficClass::CONTROL, // SEARCH
+    TrafficClass::BULK,    // PRESENCE
+    TrafficClass::CONTROL, // RESUME
+    TrafficClass::BULK,    // CHAT
+    TrafficClass::CONTROL, // ATTACH
+    TrafficClass::BULK,    // CHUNK
+    TrafficClass::CONTROL, // DOWNLOAD
+    TrafficClass::CONTROL  // PART
+};
+
+static_assert(sizeof(TRAFFIC_CLASSES) / sizeof(TRAFFIC_CLASSES[0]) == static_cast<size_t>(MessageType::PART) + 1,
+              "every MessageType needs a TrafficClass");
+
+constexpr TrafficClass trafficClassOf(MessageType type) {
+    return TRAFFIC_CLASSES[static_cast<size_t>(type)];
+}
+
+// Result of trying to cut one frame off the front of a stream buffer.
+enum class FrameStatus {
+    Complete,   // a whole frame was extracted
+    Incomplete, // more bytes are needed
+    Invalid     // the header announces a frame larger than MAX_FRAME_SIZE
+};
+
+// Non-owning view of a received message. The body points into the buffer the
+// frame was read into and is only valid as long as that buffer is untouched.
+struct MessageView {
+    MessageType type;
+    const char* body;
+    size_t bodyLength;
 };
 
 class Message {
@@ -28,7 +113,19 @@ private:
     std::string body;
 
 public:
+    // On the wire every message is a frame: a 4-byte big-endian payload length
+    // followed by the payload "type;body". Framing keeps messages intact when
+    // several of them arrive in one recv() or one of them is split across two.
+    static const uint32_t FRAME_HEADER_SIZE = 4;
+    static const uint32_t MAX_FRAME_SIZE = 1 << 20;
+
     Message(MessageType messageType, const std::string& messageBody);
+    Message(MessageType messageType, std::string&& messageBody);
+    explicit Message(const MessageView& view);
+    Message(const Message& other) = default;
+    Message(Message&& other) = default;
+    Message& operator=(const Message& other) = default;
+    Message& operator=(Message&& other) = default;
     ~Message();
 
     MessageType getType() const;
@@ -36,7 +133,37 @@ public:
 
     std::string serialize() const;
     static Message deserialize(const std::string& serializedData);
-    
+
+    // Starts a frame of 'payloadLength' bytes: clears 'frame' and writes the header.
+    static void writeFrameHeader(uint32_t payloadLength, std::string& frame);
+
+    // The payload length announced by the FRAME_HEADER_SIZE bytes at 'header'.
+    static uint32_t readFrameHeader(const char* header);
+
+    // Writes the frame into 'frame', reusing its capacity.
+    void serializeTo(std::string& frame) const;
+    static void serializeTo(MessageType type, const char* body, size_t bodyLength, std::string& frame);
+
+    // Writes a frame whose body is "room;sequence;" followed by 'body'.
+    static void serializeTo(MessageType type, const std::string& room, uint64_t sequence, const char* body,
+                            size_t bodyLength, std::string& frame);
+
+    // Splits a "sequence;text" body. Returns false if it doesn't start with a sequence.
+    static bool splitSequence(const std::string& body, uint64_t& sequence, std::string& text);
+
+    // Splits a "room;sequence;text" body.
+    static bool splitChat(const std::string& body, std::string& room, uint64_t& sequence, std::string& text);
+
+    // Parses a payload without copying it.
+    static MessageView parse(const char* payload, size_t length);
+
+    // Looks for a complete frame at the start of 'data'. On Complete, 'payload' points at
+    // its payload, and the frame occupies FRAME_HEADER_SIZE + 'payloadLength' bytes.
+    static FrameStatus findFrame(const char* data, size_t length, const char*& payload, size_t& payloadLength);
+
+    // Moves the payload of the first complete frame in 'buffer' into 'payload'.
+    static FrameStatus extractFrame(std::string& buffer, std::string& payload);
+
 };
 
-#endif
\ No newline at end of file
+#endif
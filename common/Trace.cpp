@@ -0,0 +1,140 @@
+#include "Trace.h"
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+static const char TRACE_MAGIC[8] = {'C', 'H', 'T', 'R', 'A', 'C', 'E', '1'};
+
+const size_t TraceWriter::FLUSH_THRESHOLD;
+
+static uint64_t steadyMicros() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+TraceWriter::TraceWriter() : fd(-1), startMicros(0), lastMicros(0) {}
+
+TraceWriter::~TraceWriter() {
+    close();
+}
+
+bool TraceWriter::open(const std::string& path) {
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd == -1) {
+        return false;
+    }
+    startMicros = steadyMicros();
+    lastMicros = 0;
+    buffer.assign(TRACE_MAGIC, sizeof(TRACE_MAGIC));
+    return true;
+}
+
+bool TraceWriter::isOpen() const {
+    return fd != -1;
+}
+
+void TraceWriter::record(TraceRecordKind kind, uint32_t connection, const char* payload, size_t length) {
+    uint64_t micros = steadyMicros() - startMicros;
+    buffer.push_back(static_cast<char>(kind));
+    writeVarint(micros - lastMicros);
+    writeVarint(connection);
+    if (kind == TraceRecordKind::FRAME) {
+        writeVarint(length);
+        buffer.append(payload, length);
+    }
+    lastMicros = micros;
+    if (buffer.length() >= FLUSH_THRESHOLD) {
+        flush();
+    }
+}
+
+void TraceWriter::flush() {
+    size_t written = 0;
+    while (fd != -1 && written < buffer.length()) {
+        ssize_t result = write(fd, buffer.data() + written, buffer.length() - written);
+        if (result == -1 && errno == EINTR) {
+            continue;
+        }
+        if (result <= 0) {
+            break; // A full disk loses records, the server carries on
+        }
+        written += static_cast<size_t>(result);
+    }
+    buffer.clear();
+}
+
+void TraceWriter::close() {
+    if (fd != -1) {
+        flush();
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+void TraceWriter::writeVarint(uint64_t value) {
+    while (value >= 0x80) {
+        buffer.push_back(static_cast<char>((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    buffer.push_back(static_cast<char>(value));
+}
+
+
+TraceReader::TraceReader() : file(nullptr), timeMicros(0) {}
+
+TraceReader::~TraceReader() {
+    if (file != nullptr) {
+        fclose(file);
+    }
+}
+
+bool TraceReader::open(const std::string& path) {
+    file = fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        return false;
+    }
+    char magic[sizeof(TRACE_MAGIC)];
+    timeMicros = 0;
+    return fread(magic, 1, sizeof(magic), file) == sizeof(magic) && memcmp(magic, TRACE_MAGIC, sizeof(magic)) == 0;
+}
+
+bool TraceReader::next(TraceRecord& record) {
+    int kind = fgetc(file);
+    uint64_t delta, connection, length;
+    if (kind == EOF || kind > static_cast<int>(TraceRecordKind::CLOSE) || !readVarint(delta) || !readVarint(connection)) {
+        return false;
+    }
+    timeMicros += delta;
+    record.kind = static_cast<TraceRecordKind>(kind);
+    record.timeMicros = timeMicros;
+    record.connection = static_cast<uint32_t>(connection);
+    record.payload.clear();
+    if (record.kind == TraceRecordKind::FRAME) {
+        if (!readVarint(length)) {
+            return false;
+        }
+        record.payload.resize(static_cast<size_t>(length));
+        if (length > 0 && fread(&record.payload[0], 1, static_cast<size_t>(length), file) != length) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool TraceReader::readVarint(uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int byte = fgetc(file);
+        if (byte == EOF) {
+            return false;
+        }
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
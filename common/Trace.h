@@ -0,0 +1,71 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+
+// A traffic trace: what the clients of a server sent, frame by frame, with the time
+// it arrived. The server writes one in capture mode, the Replay tool plays it back.
+//
+// The file starts with TRACE_MAGIC, then holds one record after the other:
+//   u8 kind, varint microseconds since the previous record, varint connection id,
+//   and for FRAME records a varint length followed by the frame payload ("type;body").
+// Connection ids are handed out by the server in accept order and never reused.
+enum class TraceRecordKind : uint8_t {
+    CONNECT, // a client connected
+    FRAME,   // a complete frame was received from it
+    CLOSE    // its connection was closed
+};
+
+struct TraceRecord {
+    TraceRecordKind kind;
+    uint64_t timeMicros; // Since the start of the capture
+    uint32_t connection;
+    std::string payload; // FRAME records only
+};
+
+class TraceWriter {
+public:
+    TraceWriter();
+    ~TraceWriter();
+
+    bool open(const std::string& path);
+    bool isOpen() const;
+
+    void record(TraceRecordKind kind, uint32_t connection, const char* payload = nullptr, size_t length = 0);
+
+    // Records are buffered, the buffer is written out when it fills up and on flush()
+    void flush();
+    void close();
+
+private:
+    static const size_t FLUSH_THRESHOLD = 64 * 1024;
+
+    int fd;
+    uint64_t startMicros;
+    uint64_t lastMicros;
+    std::string buffer;
+
+    void writeVarint(uint64_t value);
+};
+
+class TraceReader {
+public:
+    TraceReader();
+    ~TraceReader();
+
+    bool open(const std::string& path);
+
+    // Reads the next record, returns false at the end of the trace or if it is truncated
+    bool next(TraceRecord& record);
+
+private:
+    FILE* file;
+    uint64_t timeMicros;
+
+    bool readVarint(uint64_t& value);
+};
+
+#endif // TRACE_H